@@ -0,0 +1,639 @@
+/*
+ * Micro benchmarks, not part of uvipc: see build.sh
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ipc.h"
+#include "json.h"
+#include "status.h"
+#include "series.h"
+#include "page.h"
+#include "watch.h"
+#include "procs.h"
+
+
+/* status responses per batch: about 1 KiB, 16 KiB, 110 KiB, 1 MiB */
+#define BATCH_ITEMS_1K   (9)
+#define BATCH_ITEMS_16K  (150)
+#define BATCH_ITEMS_110K (1000)
+#define BATCH_ITEMS_1M   (9500)
+#define PULL_CHUNK  (4096)
+#define FIND_ITERS  (200000)
+#define WRITE_CHUNK (4096)
+#define UINT_COUNT  (1024)
+#define UINT_ITERS  (2000)
+#define SPLIT_ITEMS (4096)
+#define SPLIT_ITERS (200)
+#define STATUS_ITERS (20000)
+#define SERIES_POINTS (86400)
+#define SERIES_FILE   "/tmp/uvipc-bench.series"
+#define PAGE_NAME     "/uvipc-bench.status"
+#define PAGE_ITERS    (1000000)
+#define WATCH_COUNT   (10000)
+#define WATCH_ITERS   (2000)
+#define PROCS_SCANS   (200)
+
+
+typedef struct {
+	const char *name;
+	const char *json;
+	size_t      len;
+	long        iters;
+} Input;
+
+
+static double _now(void);
+static char  *_make_batch(int items);
+static void   _bench_parse(const Input *in);
+static void   _bench_pull(const Input *in);
+static void   _bench_find(int members);
+static void   _bench_write(const Input *in);
+static int    _bench_write_sink(void *udata, const char data[], size_t size);
+static void   _bench_uint(void);
+static void   _bench_split(void);
+static void   _bench_status(void);
+static void   _bench_series(void);
+static void   _bench_series_point(void *udata, const IpcSample *point);
+static void   _bench_page(void);
+static void   _bench_watch(void);
+static void   _bench_watch_fired(void *udata, const Watch *w, uint64_t value);
+static void   _bench_procs(void);
+
+
+/*
+ * function impls
+ */
+int
+main(void)
+{
+	char *const batch_1k = _make_batch(BATCH_ITEMS_1K);
+	char *const batch_16k = _make_batch(BATCH_ITEMS_16K);
+	char *const batch_110k = _make_batch(BATCH_ITEMS_110K);
+	char *const batch_1m = _make_batch(BATCH_ITEMS_1M);
+	if ((batch_1k == NULL) || (batch_16k == NULL) || (batch_110k == NULL) || (batch_1m == NULL)) {
+		perror("bench: _make_batch");
+		return 1;
+	}
+
+	Input inputs[] = {
+		{ "request", "{\"code\":2,\"id\":1,\"body\":{\"fields\":[\"memory_usage\"]}}", 0, 2000000 },
+		{ "hello", "{\"code\":10,\"request_code\":1,\"body\":{\"message\":\"well, hello friend!\","
+			   "\"encodings\":1,\"framing\":2,\"compression\":1,\"max_frame\":65532,\"shm\":0}}", 0,
+		  1000000 },
+		{ "b1k", batch_1k, 0, 200000 },
+		{ "b16k", batch_16k, 0, 10000 },
+		{ "b110k", batch_110k, 0, 2000 },
+		{ "b1m", batch_1m, 0, 200 },
+	};
+
+	for (size_t i = 0; i < sizeof(inputs) / sizeof(inputs[0]); i++) {
+		inputs[i].len = strlen(inputs[i].json);
+		_bench_parse(&inputs[i]);
+		_bench_pull(&inputs[i]);
+		_bench_write(&inputs[i]);
+	}
+
+	_bench_find(4);
+	_bench_find(16);
+	_bench_find(64);
+	_bench_uint();
+	_bench_split();
+	_bench_status();
+	_bench_series();
+	_bench_page();
+	_bench_watch();
+	_bench_procs();
+
+	free(batch_1k);
+	free(batch_16k);
+	free(batch_110k);
+	free(batch_1m);
+	return 0;
+}
+
+
+static double
+_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+
+static char *
+_make_batch(int items)
+{
+	char *const buffer = malloc((size_t)items * 128);
+	if (buffer == NULL)
+		return NULL;
+
+	size_t len = (size_t)sprintf(buffer, "[");
+	for (int i = 0; i < items; i++) {
+		len += (size_t)sprintf(buffer + len, "%s{\"code\":10,\"request_code\":2,\"id\":%d,\"body\":"
+				       "{\"cpu_cores\":8,\"memory_usage\":%d,\"memory_capacity\":16777216}}",
+				       (i > 0) ? "," : "", i + 1, i * 4096);
+	}
+
+	sprintf(buffer + len, "]");
+	return buffer;
+}
+
+
+static void
+_bench_parse(const Input *in)
+{
+	static const struct {
+		const char *name;
+		size_t      flags;
+	} modes[] = {
+		{ "two pass", json_parse_flags_allow_location_information },
+		{ "single pass", json_parse_flags_allow_location_information | json_parse_flags_single_pass },
+		/* includes copying the input, in situ parsing writes to it */
+		{ "in situ", json_parse_flags_single_pass | json_parse_flags_in_situ },
+	};
+
+	char *const src = malloc(in->len);
+	if (src == NULL) {
+		perror("bench: _bench_parse: malloc");
+		exit(1);
+	}
+
+	memcpy(src, in->json, in->len);
+
+	for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+		const double start = _now();
+		for (long i = 0; i < in->iters; i++) {
+			if (modes[m].flags & json_parse_flags_in_situ)
+				memcpy(src, in->json, in->len);
+
+			json_value_t *const value = json_parse_ex(src, in->len, modes[m].flags, NULL, NULL, NULL);
+			if (value == NULL) {
+				fprintf(stderr, "bench: %s: parse failed\n", in->name);
+				exit(1);
+			}
+
+			free(value);
+		}
+
+		const double ns = (_now() - start) / (double)in->iters;
+		printf("parse %-8s %-12s %10.1f ns %8.3f ns/byte\n", in->name, modes[m].name, ns,
+		       ns / (double)in->len);
+	}
+
+	free(src);
+}
+
+
+/* reads the input in PULL_CHUNK pieces, as they would arrive from a socket */
+static void
+_bench_pull(const Input *in)
+{
+	char token[256];
+	char *const src = malloc(in->len);
+	if (src == NULL) {
+		perror("bench: _bench_pull: malloc");
+		exit(1);
+	}
+
+	long events = 0;
+	const double start = _now();
+	for (long i = 0; i < in->iters; i++) {
+		json_pull_t pull;
+		json_pull_init(&pull, token, sizeof(token));
+		memcpy(src, in->json, in->len);
+
+		int event = json_pull_need_more;
+		for (size_t off = 0; event == json_pull_need_more;) {
+			const size_t len = (in->len - off < PULL_CHUNK) ? (in->len - off) : PULL_CHUNK;
+			json_pull_feed(&pull, src + off, len, off + len == in->len);
+			off += len;
+
+			while ((event = json_pull_next(&pull)) > json_pull_error)
+				events++;
+		}
+
+		if (event != json_pull_end) {
+			fprintf(stderr, "bench: %s: pull failed\n", in->name);
+			exit(1);
+		}
+	}
+
+	const double ns = (_now() - start) / (double)in->iters;
+	printf("parse %-8s %-12s %10.1f ns %8.3f ns/byte (%ld events)\n", in->name, "pull", ns,
+	       ns / (double)in->len, events / in->iters);
+	free(src);
+}
+
+
+/* looks every member of an object up by name, through the list and the index */
+static void
+_bench_find(int members)
+{
+	static const struct {
+		const char *name;
+		size_t      flags;
+	} modes[] = {
+		{ "list", json_parse_flags_single_pass },
+		{ "index", json_parse_flags_single_pass | json_parse_flags_index_objects },
+	};
+
+	char *const src = malloc((size_t)members * 32 + 2);
+	if (src == NULL) {
+		perror("bench: _bench_find: malloc");
+		exit(1);
+	}
+
+	size_t len = (size_t)sprintf(src, "{");
+	for (int i = 0; i < members; i++)
+		len += (size_t)sprintf(src + len, "%s\"field_%d\":%d", (i > 0) ? "," : "", i, i);
+
+	len += (size_t)sprintf(src + len, "}");
+
+	for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+		json_value_t *const value = json_parse_ex(src, len, modes[m].flags, NULL, NULL, NULL);
+		if (value == NULL) {
+			fprintf(stderr, "bench: find: parse failed\n");
+			exit(1);
+		}
+
+		const json_object_t *const obj = json_value_as_object(value);
+		long found = 0;
+		const double start = _now();
+		for (long i = 0; i < FIND_ITERS; i++) {
+			for (const json_object_element_t *e = obj->start; e != NULL; e = e->next)
+				found += json_object_find(obj, e->name->string, e->name->string_size) != NULL;
+		}
+
+		const double ns = (_now() - start) / (double)(FIND_ITERS * members);
+		printf("find  %-8d %-12s %10.1f ns/lookup\n", members, modes[m].name, ns);
+		if (found != FIND_ITERS * members) {
+			fprintf(stderr, "bench: find: member missing\n");
+			exit(1);
+		}
+
+		free(value);
+	}
+
+	free(src);
+}
+
+
+/* re-emits the parsed input: malloc'ed string, caller buffer, WRITE_CHUNK chunks */
+static void
+_bench_write(const Input *in)
+{
+	json_value_t *const value = json_parse(in->json, in->len);
+	char *const buffer = malloc(in->len + 1);
+	if ((value == NULL) || (buffer == NULL)) {
+		fprintf(stderr, "bench: %s: _bench_write: setup failed\n", in->name);
+		exit(1);
+	}
+
+	char chunk[WRITE_CHUNK];
+	size_t total = 0;
+	for (int m = 0; m < 3; m++) {
+		const char *const name = (m == 0) ? "malloc" : (m == 1) ? "into" : "stream";
+		const double start = _now();
+		for (long i = 0; i < in->iters; i++) {
+			int failed;
+			switch (m) {
+			case 0: {
+				void *const str = json_write_minified(value, NULL);
+				failed = (str == NULL);
+				free(str);
+				break;
+			}
+			case 1:
+				failed = (json_write_minified_into(value, buffer, in->len + 1) != in->len + 1);
+				break;
+			default:
+				failed = json_write_minified_stream(value, chunk, sizeof(chunk), _bench_write_sink,
+								    &total);
+				break;
+			}
+
+			if (failed) {
+				fprintf(stderr, "bench: %s: write %s failed\n", in->name, name);
+				exit(1);
+			}
+		}
+
+		const double ns = (_now() - start) / (double)in->iters;
+		printf("write %-8s %-12s %10.1f ns %8.3f ns/byte\n", in->name, name, ns,
+		       ns / (double)in->len);
+	}
+
+	free(buffer);
+	free(value);
+}
+
+
+static int
+_bench_write_sink(void *udata, const char data[], size_t size)
+{
+	/* stands in for the socket write */
+	*(size_t *)udata += size + (size_t)data[0];
+	return 0;
+}
+
+
+/* all magnitudes, as in status responses: counts, sizes, byte totals */
+static void
+_bench_uint(void)
+{
+	unsigned long long nums[UINT_COUNT];
+	unsigned long long x = 0x9e3779b97f4a7c15ull;
+	for (int i = 0; i < UINT_COUNT; i++) {
+		x ^= x << 13;
+		x ^= x >> 7;
+		x ^= x << 17;
+		nums[i] = x >> (i % 64);
+	}
+
+	char buffer[32];
+	size_t total[2] = { 0, 0 };
+	for (int m = 0; m < 2; m++) {
+		const double start = _now();
+		for (long i = 0; i < UINT_ITERS; i++) {
+			for (int j = 0; j < UINT_COUNT; j++) {
+				if (m == 0)
+					total[m] += (size_t)snprintf(buffer, sizeof(buffer), "%llu", nums[j]);
+				else
+					total[m] += ipc_uint_to_str(buffer, nums[j]);
+			}
+		}
+
+		const double ns = (_now() - start) / (double)(UINT_ITERS * UINT_COUNT);
+		printf("uint  %-8s %-12s %10.1f ns/number\n", "mixed", (m == 0) ? "snprintf" : "digit pairs", ns);
+	}
+
+	if (total[0] != total[1]) {
+		fprintf(stderr, "bench: uint: length mismatch\n");
+		exit(1);
+	}
+}
+
+
+/* what a batch costs the loop thread: the split, against decoding it there */
+static void
+_bench_split(void)
+{
+	char *const src = malloc(SPLIT_ITEMS * 64);
+	char *const json = malloc(SPLIT_ITEMS * 64);
+	IpcSpan *const spans = malloc(sizeof(IpcSpan) * SPLIT_ITEMS);
+	if ((src == NULL) || (json == NULL) || (spans == NULL)) {
+		perror("bench: _bench_split: malloc");
+		exit(1);
+	}
+
+	size_t len = (size_t)sprintf(src, "[");
+	for (int i = 0; i < SPLIT_ITEMS; i++) {
+		len += (size_t)sprintf(src + len, "%s{\"code\":2,\"id\":%d,\"body\":{\"fields\":[\"cpu_cores\"]}}",
+				       (i > 0) ? "," : "", i + 1);
+	}
+
+	len += (size_t)sprintf(src + len, "]");
+
+	IpcArena arena;
+	ipc_arena_init(&arena);
+	for (int m = 0; m < 2; m++) {
+		size_t count = 0;
+		const double start = _now();
+		for (long i = 0; i < SPLIT_ITERS; i++) {
+			memcpy(json, src, len);
+			if (ipc_batch_split(spans, SPLIT_ITEMS, &count, json, len) < 0) {
+				fprintf(stderr, "bench: split: failed\n");
+				exit(1);
+			}
+
+			for (size_t j = 0; (m == 1) && (j < count); j++) {
+				IpcRequest req;
+				if (ipc_request_parse(&req, json + spans[j].off, spans[j].len, &arena) !=
+				    IPC_PARSE_SUCCESS) {
+					fprintf(stderr, "bench: split: decode failed\n");
+					exit(1);
+				}
+
+				ipc_arena_reset(&arena);
+			}
+		}
+
+		const double ns = (_now() - start) / (double)(SPLIT_ITERS * SPLIT_ITEMS);
+		printf("batch %-8d %-12s %10.1f ns/request\n", SPLIT_ITEMS, (m == 0) ? "split" : "split+decode",
+		       ns);
+	}
+
+	ipc_arena_deinit(&arena);
+	free(spans);
+	free(json);
+	free(src);
+}
+
+
+/* one sample as the server takes it, all fields */
+static void
+_bench_status(void)
+{
+	Status st;
+	IpcBodyStatus s;
+	if (status_init(&st) < 0)
+		exit(1);
+
+	const double start = _now();
+	for (long i = 0; i < STATUS_ITERS; i++) {
+		if (status_collect(&st, &s, 0) < 0) {
+			fprintf(stderr, "bench: status: collect failed\n");
+			exit(1);
+		}
+	}
+
+	const double ns = (_now() - start) / (double)STATUS_ITERS;
+	printf("status %-7s %-12s %10.1f ns/sample (%u cpus)\n", "all", "pread", ns, s.cpus.len);
+	status_deinit(&st);
+}
+
+
+/* a day of 1 s points: appending them, then replaying them as on startup */
+static void
+_bench_series(void)
+{
+	Series series;
+	unlink(SERIES_FILE);
+	if (series_open(&series, SERIES_FILE) < 0)
+		exit(1);
+
+	IpcSample point = { .time = 1700000000000 };
+	size_t memory = (size_t)1 << 32;
+	double start = _now();
+	for (long i = 0; i < SERIES_POINTS; i++) {
+		/* a slow drift with some noise, like a busy host */
+		memory += (size_t)(rand() % 64) * 4096;
+		memory -= (size_t)(rand() % 64) * 4096;
+		point.time += 1000;
+		point.memory_min = memory - ((size_t)(rand() % 16) * 4096);
+		point.memory_avg = memory;
+		point.memory_max = memory + ((size_t)(rand() % 16) * 4096);
+		point.cpu_min = (unsigned)(rand() % 500);
+		point.cpu_avg = point.cpu_min + (unsigned)(rand() % 500);
+		point.cpu_max = point.cpu_avg + (unsigned)(rand() % 500);
+		series_append(&series, &point);
+	}
+
+	const double append_ns = (_now() - start) / (double)SERIES_POINTS;
+
+	uint64_t bits = 0;
+	for (int i = 0; i < SERIES_BLOCKS; i++)
+		bits += series.header->index[i].bits;
+
+	long count = 0;
+	start = _now();
+	series_read(&series, 0, _bench_series_point, &count);
+
+	const double read_ns = (_now() - start) / (double)count;
+	printf("series %-7s %-12s %10.1f ns/point (%.1f bytes/point)\n", "append", "gorilla", append_ns,
+	       (double)bits / 8.0 / (double)SERIES_POINTS);
+	printf("series %-7s %-12s %10.1f ns/point (%ld points)\n", "read", "gorilla", read_ns, count);
+
+	series_close(&series);
+	unlink(SERIES_FILE);
+}
+
+
+static void
+_bench_series_point(void *udata, const IpcSample *point)
+{
+	(void)point;
+	(*(long *)udata)++;
+}
+
+
+/* a real sample published, then read back as a local client does */
+static void
+_bench_page(void)
+{
+	Status st;
+	IpcBodyStatus s;
+	Page writer, reader;
+	if ((status_init(&st) < 0) || (status_collect(&st, &s, 0) < 0))
+		exit(1);
+
+	if ((page_create(&writer, PAGE_NAME, 1000) < 0) || (page_write(&writer, &s, 1) < 0) ||
+	    (page_open(&reader, PAGE_NAME) < 0))
+		exit(1);
+
+	double start = _now();
+	for (long i = 0; i < PAGE_ITERS; i++)
+		page_write(&writer, &s, (uint64_t)time(NULL) * 1000);
+
+	const double write_ns = (_now() - start) / (double)PAGE_ITERS;
+
+	static IpcCpu cpus[PAGE_CPUS_MAX];
+	IpcBodyStatus out;
+	uint64_t t;
+	start = _now();
+	for (long i = 0; i < PAGE_ITERS; i++) {
+		if (page_read(&reader, &out, cpus, &t) < 0) {
+			fprintf(stderr, "bench: page: read failed\n");
+			exit(1);
+		}
+	}
+
+	const double read_ns = (_now() - start) / (double)PAGE_ITERS;
+	printf("page   %-7s %-12s %10.1f ns/status (%u cpus)\n", "write", "seqlock", write_ns, s.cpus.len);
+	printf("page   %-7s %-12s %10.1f ns/status\n", "read", "seqlock", read_ns);
+
+	page_close(&reader);
+	page_close(&writer);
+	status_deinit(&st);
+}
+
+
+/* WATCH_COUNT watches on every value, thresholds spread so a few fire and
+ * clear on each sample */
+static void
+_bench_watch(void)
+{
+	Status st;
+	IpcBodyStatus s;
+	Watches ws;
+	if ((status_init(&st) < 0) || (status_collect(&st, &s, 0) < 0))
+		exit(1);
+
+	const uint64_t fields[] = { IPC_FIELD(memory_usage), IPC_FIELD(cpu), IPC_FIELD(user), IPC_FIELD(iowait) };
+	watch_init(&ws);
+	for (unsigned i = 0; i < WATCH_COUNT; i++) {
+		const IpcBodyWatch b = {
+			.fields = fields[i % 4],
+			.above = (i % 4 == 0) ? s.memory_usage - 4096 + (i % 64) * 128 : i,
+		};
+
+		Watch w;
+		if (watch_compile(&w, &b, IPC_FIELD(fields) | IPC_FIELD(above)) < 0)
+			exit(1);
+
+		w.id = i + 1;
+		if (watch_add(&ws, &w) < 0)
+			exit(1);
+	}
+
+	unsigned fired = 0;
+	const double start = _now();
+	for (long i = 0; i < WATCH_ITERS; i++) {
+		s.memory_usage += (i & 1) ? 4096 : -4096;
+		s.cpu.user = (unsigned)(i * 37) % 10000;
+		watch_eval(&ws, &s, _bench_watch_fired, &fired);
+	}
+
+	const double ns = (_now() - start) / (double)WATCH_ITERS;
+	printf("watch  %-7s %-12s %10.1f ns/sample (%u watches, %.1f firing)\n", "eval", "flat", ns, ws.len,
+	       (double)fired / WATCH_ITERS);
+
+	watch_deinit(&ws);
+	status_deinit(&st);
+}
+
+
+static void
+_bench_watch_fired(void *udata, const Watch *w, uint64_t value)
+{
+	unsigned *const fired = udata;
+	(void)w;
+	(void)value;
+
+	(*fired)++;
+}
+
+
+/* whole scans of this host's /proc, the first one opens what the next keep */
+static void
+_bench_procs(void)
+{
+	static Procs p;
+	IpcBodyTop top;
+	if (procs_init(&p) < 0)
+		exit(1);
+
+	double start = 0;
+	for (int i = 0; i <= PROCS_SCANS; i++) {
+		if (i == 1)
+			start = _now();
+
+		int ret;
+		while ((ret = procs_scan(&p, &top)) == 0)
+			continue;
+
+		if (ret < 0)
+			exit(1);
+	}
+
+	const double ns = (_now() - start) / (double)PROCS_SCANS;
+	printf("procs  %-7s %-12s %10.1f ns/process (%u processes, %.1f us/scan)\n", "scan", "top heap",
+	       ns / (top.count ? top.count : 1), top.count, ns / 1000);
+
+	procs_deinit(&p);
+}
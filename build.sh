@@ -1,10 +1,11 @@
 #!/bin/sh
 
 
-cc -g -Wall -Wextra main.c ipc.c server.c client.c -luv -fsanitize=undefined -fsanitize=address \
+cc -g -Wall -Wextra main.c ipc.c server.c client.c status.c history.c series.c page.c watch.c procs.c -luv -fsanitize=undefined -fsanitize=address \
 	-o uvipc
 
-#cc -g -Wall -Wextra main.c ipc.c server.c client.c -luv     -o uvipc
+#cc -g -Wall -Wextra main.c ipc.c server.c client.c status.c history.c series.c page.c watch.c procs.c -luv     -o uvipc
 
-#cc -Wall -Wextra main.c ipc.c server.c client.c -luv     -o uvipc -O3
+#cc -Wall -Wextra main.c ipc.c server.c client.c status.c history.c series.c page.c watch.c procs.c -luv     -o uvipc -O3
 
+#cc -Wall -Wextra bench.c ipc.c status.c series.c page.c watch.c procs.c -o bench -O2
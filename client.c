@@ -1,9 +1,10 @@
 #include <errno.h>
 #include <fcntl.h>
+#include <inttypes.h>
 #include <stdio.h>
 #include <string.h>
-#include <strings.h>
 #include <stdlib.h>
+#include <time.h>
 #include <unistd.h>
 #include <signal.h>
 
@@ -12,44 +13,102 @@
 
 #include "client.h"
 #include "ipc.h"
+#include "page.h"
 
 
-static int  _parse_cmd(const char cmd[]);
+typedef struct {
+	int    fd;
+	int    framing;
+	size_t len;
+	size_t consumed;
+	char   buffer[65536];
+} Conn;
+
+
+static int  _parse_cmd(IpcRequest *req, const char cmd[]);
+static int  _parse_range(IpcRequest *req, const char args[]);
+static int  _parse_subscribe(IpcRequest *req, const char args[]);
+static int  _parse_watch(IpcRequest *req, const char args[]);
+static int  _run_page(const char status_page[], const char *cmds[], IpcRequest reqs[], int len);
 static int  _open_sock_file(const char sock_file[]);
-static int  _send_request(int req_code, int fd);
-static int  _recv_response(IpcResponse *resp, int fd);
+static int  _run_legacy(const char sock_file[], const char *cmds[], const IpcRequest reqs[], int len);
+static int  _run_pipelined(Conn *conn, const IpcResponse *hello, const char *cmds[], IpcRequest reqs[],
+			    int len);
+static int  _handshake(Conn *conn, IpcResponse *resp);
+static int  _send_all(int fd, const char buffer[], size_t len);
+static int  _send_request(Conn *conn, const IpcRequest *req);
+static int  _recv_frame(Conn *conn, int framing, char **payload, size_t *len);
+static int  _recv_response(Conn *conn, IpcResponse *resp);
 static void _print_response(const IpcResponse *resp, int req_code);
+static void _print_cpu(const char name[], const IpcCpu *cpu);
+static void _print_sample(const IpcSample *sample);
+static void _print_procs(const char name[], const IpcProcs *procs);
+
+
+/* parser memory, reset after every response */
+static IpcArena _arena;
+
+/* the cpus read from the status page */
+static IpcCpu _cpus[PAGE_CPUS_MAX];
+
+/* what this client can speak, see ipc_hello_negotiate() */
+static const IpcBodyHello _caps = {
+	.encodings = IPC_ENCODING_JSON,
+	.framing = IPC_FRAMING_NUL | IPC_FRAMING_LENGTH,
+	.compression = IPC_COMPRESSION_NONE,
+	.max_frame = sizeof(((Conn *)0)->buffer) - IPC_FRAME_HEAD_SIZE,
+	.shm = 1,
+};
 
 
 /*
  * public
  */
 int
-client_run(const char sock_file[], const char cmd[])
+client_run(const char sock_file[], const char status_page[], const char *cmds[], int len)
 {
 	signal(SIGPIPE, SIG_IGN);
 
-	const int cmd_num = _parse_cmd(cmd);
-	if (cmd_num == 0)
+	int ret = -1;
+	IpcRequest *const reqs = malloc(sizeof(IpcRequest) * (size_t)len);
+	if (reqs == NULL) {
+		perror("client: client_run: malloc");
 		return -1;
+	}
 
-	const int fd = _open_sock_file(sock_file);
-	if (fd < 0)
-		return -1;
+	for (int i = 0; i < len; i++) {
+		if (_parse_cmd(&reqs[i], cmds[i]) < 0)
+			goto out0;
+	}
 
-	int ret = -1;
-	if (_send_request(cmd_num, fd) < 0)
+	/* nothing left to ask the server */
+	if (_run_page(status_page, cmds, reqs, len) == 0) {
+		ret = 0;
 		goto out0;
+	}
 
-	IpcResponse resp;
-	if (_recv_response(&resp, fd) < 0)
+	Conn conn = { .fd = _open_sock_file(sock_file) };
+	if (conn.fd < 0)
 		goto out0;
 
-	_print_response(&resp, cmd_num);
-	ret = 0;
+	IpcResponse resp;
+	if (_handshake(&conn, &resp) < 0)
+		goto out1;
+
+	if (conn.framing == IPC_FRAMING_LEGACY) {
+		/* an old server: it has answered (or rejected) the hello and
+		 * closed the connection, ask again the old way */
+		ret = _run_legacy(sock_file, cmds, reqs, len);
+		goto out1;
+	}
 
+	ret = _run_pipelined(&conn, &resp, cmds, reqs, len);
+
+out1:
+	close(conn.fd);
 out0:
-	close(fd);
+	ipc_arena_deinit(&_arena);
+	free(reqs);
 	return ret;
 }
 
@@ -57,23 +116,216 @@ out0:
 /*
  * private
  */
+/* "name[:field,...]", the fields narrow the response body. "history[:seconds[,step]]",
+ * "subscribe[:interval[,count[,version]]]", "watch:key>threshold[,clear]", "top[:count]" */
 static int
-_parse_cmd(const char cmd[])
+_parse_cmd(IpcRequest *req, const char cmd[])
 {
-	if (strcasecmp(cmd, "hello") == 0)
-		return IPC_REQ_HELLO;
+	const char *const sep = strchr(cmd, ':');
+	const size_t name_len = (sep != NULL) ? (size_t)(sep - cmd) : strlen(cmd);
+
+	char name[32];
+	if (name_len >= sizeof(name)) {
+		fprintf(stderr, "client: _parse_cmd: invalid command: %s\n", cmd);
+		return -1;
+	}
+
+	memcpy(name, cmd, name_len);
+	name[name_len] = '\0';
+
+	*req = (IpcRequest) { .code = ipc_request_code_from_str(name) };
+	if (req->code == IPC_REQ_NONE) {
+		fprintf(stderr, "client: _parse_cmd: invalid command: %s\n", cmd);
+		return -1;
+	}
+
+	if (req->code == IPC_REQ_HISTORY)
+		return _parse_range(req, (sep != NULL) ? sep + 1 : "60");
 
-	if (strcasecmp(cmd, "status") == 0)
-		return IPC_REQ_STATUS;
+	if (req->code == IPC_REQ_SUBSCRIBE)
+		return _parse_subscribe(req, (sep != NULL) ? sep + 1 : "1000");
 
-	if (strcasecmp(cmd, "shutdown") == 0)
-		return IPC_REQ_SHUTDOWN;
+	if (req->code == IPC_REQ_WATCH)
+		return _parse_watch(req, (sep != NULL) ? sep + 1 : "");
 
-	fprintf(stderr, "client: _parse_cmd: invalid command\n");
+	if ((req->code == IPC_REQ_TOP) && (sep != NULL)) {
+		char *end;
+		const unsigned long count = strtoul(sep + 1, &end, 10);
+		if ((end == sep + 1) || (*end != '\0') || (count > (unsigned)-1)) {
+			fprintf(stderr, "client: _parse_cmd: top: invalid count: %s\n", sep + 1);
+			return -1;
+		}
+
+		req->limit.count = (unsigned)count;
+		req->fields = IPC_FIELD(count);
+		return 0;
+	}
+
+	if (sep == NULL)
+		return 0;
+
+	if (req->code != IPC_REQ_STATUS) {
+		fprintf(stderr, "client: _parse_cmd: %s: takes no fields\n", name);
+		return -1;
+	}
+
+	for (const char *f = sep + 1; *f != '\0';) {
+		const size_t len = strcspn(f, ",");
+		const uint64_t field = 1ull << ipc_key_from_str(f, len);
+		if ((len == 0) || ((field & IPC_FIELDS_ALL(IPC_BODY_STATUS)) == 0)) {
+			fprintf(stderr, "client: _parse_cmd: %s: invalid field: %.*s\n", name, (int)len, f);
+			return -1;
+		}
+
+		req->query.fields |= field;
+		f += len + (f[len] == ',');
+	}
+
+	req->fields = IPC_FIELD(fields);
 	return 0;
 }
 
 
+/* "seconds[,step]": the last "seconds" at "step" ms or coarser */
+static int
+_parse_range(IpcRequest *req, const char args[])
+{
+	char *end;
+	const unsigned long seconds = strtoul(args, &end, 10);
+	unsigned long step = 0;
+	if (*end == ',')
+		step = strtoul(end + 1, &end, 10);
+
+	if ((end == args) || (*end != '\0') || (seconds == 0) || (step > (unsigned)-1)) {
+		fprintf(stderr, "client: _parse_range: history: invalid range: %s\n", args);
+		return -1;
+	}
+
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+
+	const uint64_t now = ((uint64_t)ts.tv_sec * 1000) + ((uint64_t)ts.tv_nsec / 1000000);
+	req->range.from = (now > (seconds * 1000)) ? (now - (seconds * 1000)) : 0;
+	req->range.step = (unsigned)step;
+	req->fields = IPC_FIELD(from) | IPC_FIELD(step);
+	return 0;
+}
+
+
+/* "interval[,count[,version]]": ms between the pushes, how many, 0: until
+ * interrupted */
+static int
+_parse_subscribe(IpcRequest *req, const char args[])
+{
+	char *end;
+	const unsigned long interval = strtoul(args, &end, 10);
+	unsigned long count = 0;
+	if (*end == ',')
+		count = strtoul(end + 1, &end, 10);
+
+	/* a version, 0 for none yet: deltas from it on */
+	int delta = 0;
+	unsigned long long version = 0;
+	if (*end == ',') {
+		delta = 1;
+		version = strtoull(end + 1, &end, 10);
+	}
+
+	if ((end == args) || (*end != '\0') || (interval == 0) || (interval > (unsigned)-1) ||
+	    (count > (unsigned)-1)) {
+		fprintf(stderr, "client: _parse_subscribe: subscribe: invalid interval: %s\n", args);
+		return -1;
+	}
+
+	req->subscribe.interval = (unsigned)interval;
+	req->subscribe.count = (unsigned)count;
+	req->fields = IPC_FIELD(interval) | IPC_FIELD(count);
+	if (delta) {
+		req->subscribe.delta = 1;
+		req->subscribe.version = version;
+		req->fields |= IPC_FIELD(delta) | IPC_FIELD(version);
+	}
+
+	return 0;
+}
+
+
+/* "key>threshold[,clear]" or "key<threshold[,clear]", the alerts come until
+ * interrupted */
+static int
+_parse_watch(IpcRequest *req, const char args[])
+{
+	const size_t len = strcspn(args, "<>");
+	const int key = ipc_key_from_str(args, len);
+	if ((key == IPC_KEY_NONE) || (args[len] == '\0'))
+		goto err0;
+
+	char *end;
+	const char *const num = &args[len + 1];
+	const unsigned long long threshold = strtoull(num, &end, 10);
+	unsigned long long clear = threshold;
+	if ((end != num) && (*end == ','))
+		clear = strtoull(end + 1, &end, 10);
+
+	if ((end == num) || (*end != '\0'))
+		goto err0;
+
+	req->watch.fields = 1ull << key;
+	req->watch.clear = clear;
+	req->fields = IPC_FIELD(fields) | IPC_FIELD(clear);
+	if (args[len] == '>') {
+		req->watch.above = threshold;
+		req->fields |= IPC_FIELD(above);
+	} else {
+		req->watch.below = threshold;
+		req->fields |= IPC_FIELD(below);
+	}
+
+	return 0;
+
+err0:
+	fprintf(stderr, "client: _parse_watch: watch: invalid condition: %s\n", args);
+	return -1;
+}
+
+
+/* the status requests are answered from the page while it is fresh, and
+ * marked done. Returns how many are left for the server */
+static int
+_run_page(const char status_page[], const char *cmds[], IpcRequest reqs[], int len)
+{
+	Page page;
+	if ((status_page == NULL) || (page_open(&page, status_page) < 0))
+		return len;
+
+	int left = len;
+	for (int i = 0; i < len; i++) {
+		if (reqs[i].code != IPC_REQ_STATUS)
+			continue;
+
+		IpcResponse resp = {
+			.code = IPC_RES_OK,
+			.request_code = IPC_REQ_STATUS,
+			.fields = reqs[i].query.fields,
+		};
+
+		uint64_t time;
+		if (page_read(&page, &resp.status, _cpus, &time) < 0)
+			break;
+
+		if (len > 1)
+			printf("[%d] %s\n", i + 1, cmds[i]);
+
+		_print_response(&resp, IPC_REQ_STATUS);
+		reqs[i].code = IPC_REQ_NONE;
+		left--;
+	}
+
+	page_close(&page);
+	return left;
+}
+
+
 static int
 _open_sock_file(const char sock_file[])
 {
@@ -105,73 +357,254 @@ _open_sock_file(const char sock_file[])
 
 
 static int
-_send_request(int req_code, int fd)
+_run_legacy(const char sock_file[], const char *cmds[], const IpcRequest reqs[], int len)
 {
-	char *req = NULL;
-	switch (req_code) {
-	case IPC_REQ_HELLO: req = ipc_request_build_hello(); break;
-	case IPC_REQ_STATUS: req = ipc_request_build_status(); break;
-	case IPC_REQ_SHUTDOWN: req = ipc_request_build_shutdown(); break;
+	for (int i = 0; i < len; i++) {
+		if (reqs[i].code == IPC_REQ_NONE)
+			continue;
+
+		Conn conn = { .fd = _open_sock_file(sock_file) };
+		if (conn.fd < 0)
+			return -1;
+
+		IpcResponse resp;
+		/* old servers know no request bodies */
+		const IpcRequest req = { .code = reqs[i].code };
+		if ((_send_request(&conn, &req) < 0) || (_recv_response(&conn, &resp) < 0)) {
+			close(conn.fd);
+			return -1;
+		}
+
+		if (len > 1)
+			printf("[%d] %s\n", i + 1, cmds[i]);
+
+		_print_response(&resp, reqs[i].code);
+		close(conn.fd);
 	}
 
-	if (req == NULL) {
-		fprintf(stderr, "client: _send_request: failed to build request\n");
-		return -1;
+	return 0;
+}
+
+
+/* every request goes out at once with its index + 1 as the id, the responses
+ * are matched back by id in whatever order they complete */
+static int
+_run_pipelined(Conn *conn, const IpcResponse *hello, const char *cmds[], IpcRequest reqs[], int len)
+{
+	int pending = 0;
+	for (int i = 0; i < len; i++) {
+		if (reqs[i].code == IPC_REQ_NONE)
+			continue;
+
+		if (reqs[i].code == IPC_REQ_HELLO) {
+			/* already answered by the handshake */
+			if (len > 1)
+				printf("[%d] %s\n", i + 1, cmds[i]);
+
+			_print_response(hello, IPC_REQ_HELLO);
+			reqs[i].code = IPC_REQ_NONE;
+			continue;
+		}
+
+		reqs[i].id = (unsigned)i + 1;
+		if (_send_request(conn, &reqs[i]) < 0)
+			return -1;
+
+		pending++;
 	}
 
-	int ret = -1;
-	const size_t len = strlen(req) + 1;
+	while (pending > 0) {
+		/* pushes and alerts are read as they come, e.g. through a pipe */
+		fflush(stdout);
+
+		IpcResponse resp;
+		if (_recv_response(conn, &resp) < 0)
+			return -1;
+
+		const unsigned id = resp.id;
+		if ((id == 0) || (id > (unsigned)len) || (reqs[id - 1].code == IPC_REQ_NONE)) {
+			fprintf(stderr, "client: _run_pipelined: unexpected response id: %u\n", id);
+			continue;
+		}
+
+		if (len > 1)
+			printf("[%u] %s\n", id, cmds[id - 1]);
+
+		/* a subscription stays pending: acked, then pushed "count" status */
+		if (reqs[id - 1].code == IPC_REQ_SUBSCRIBE) {
+			IpcBodySubscribe *const sub = &reqs[id - 1].subscribe;
+			if (resp.request_code == IPC_REQ_STATUS) {
+				_print_response(&resp, IPC_REQ_STATUS);
+				if ((sub->count == 0) || (--sub->count > 0))
+					continue;
+			} else {
+				_print_response(&resp, IPC_REQ_SUBSCRIBE);
+				if (resp.code == IPC_RES_OK)
+					continue;
+			}
+
+			reqs[id - 1].code = IPC_REQ_NONE;
+			pending--;
+			continue;
+		}
+
+		/* so does a watch, acked, then alerted until interrupted */
+		if ((reqs[id - 1].code == IPC_REQ_WATCH) && (resp.code == IPC_RES_OK)) {
+			_print_response(&resp, IPC_REQ_WATCH);
+			continue;
+		}
+
+		_print_response(&resp, reqs[id - 1].code);
+		reqs[id - 1].code = IPC_REQ_NONE;
+		pending--;
+	}
+
+	return 0;
+}
+
+
+static int
+_handshake(Conn *conn, IpcResponse *resp)
+{
+	IpcRequest req = {
+		.code = IPC_REQ_HELLO,
+		.fields = IPC_FIELDS_ALL(IPC_BODY_HELLO) & ~IPC_FIELD(message),
+		.hello = _caps,
+	};
+
+	if (_send_request(conn, &req) < 0)
+		return -1;
+
+	/* '\0' terminated from a new server, closed by an old one */
+	if (_recv_response(conn, resp) < 0)
+		return -1;
+
+	if ((resp->code == IPC_RES_OK) && (resp->request_code == IPC_REQ_HELLO) &&
+	    (resp->fields & IPC_FIELD(framing)))
+		conn->framing = (int)resp->hello.framing;
+
+	return 0;
+}
+
+
+static int
+_send_all(int fd, const char buffer[], size_t len)
+{
 	for (size_t sent = 0; sent < len;) {
-		const ssize_t sn = send(fd, req + sent, len - sent, 0);
+		const ssize_t sn = send(fd, buffer + sent, len - sent, 0);
 		if (sn <= 0) {
 			if (sn < 0) {
-				perror("client: _send_request: send");
-				goto out0;
+				perror("client: _send_all: send");
+				return -1;
 			}
 
 			break;
 		}
-		
+
 		sent += (size_t)sn;
 	}
 
+	return 0;
+}
+
+
+static int
+_send_request(Conn *conn, const IpcRequest *req)
+{
+	char *const str = ipc_request_build(req);
+	if (str == NULL) {
+		fprintf(stderr, "client: _send_request: failed to build request\n");
+		return -1;
+	}
+
+	int ret = -1;
+	const size_t len = strlen(str);
+
+	char head[IPC_FRAME_HEAD_SIZE];
+	const size_t head_len = ipc_frame_head(head, conn->framing, len);
+	if (_send_all(conn->fd, head, head_len) < 0)
+		goto out0;
+
+	/* the '\0' terminates every frame except the length-prefixed ones */
+	if (_send_all(conn->fd, str, len + (conn->framing != IPC_FRAMING_LENGTH)) < 0)
+		goto out0;
+
 	ret = 0;
 
 out0:
-	free(req);
+	free(str);
 	return ret;
 }
 
 
 static int
-_recv_response(IpcResponse *resp, int fd)
+_recv_frame(Conn *conn, int framing, char **payload, size_t *len)
 {
-	char buffer[8192];
-	const size_t buffer_size = sizeof(buffer);
+	const size_t buffer_size = sizeof(conn->buffer) - 1;
+
 
+	conn->len -= conn->consumed;
+	memmove(conn->buffer, conn->buffer + conn->consumed, conn->len);
+	conn->consumed = 0;
+
+	for (;;) {
+		size_t off, plen, frame_len;
+		const int ret = ipc_frame_next(framing, conn->buffer, conn->len, buffer_size, &off, &plen,
+					       &frame_len);
+		if (ret < 0) {
+			fprintf(stderr, "client: _recv_frame: invalid frame\n");
+			return -1;
+		}
 
-	size_t recvd = 0;
-	while (recvd < buffer_size) {
-		const ssize_t rv = recv(fd, buffer + recvd, buffer_size - recvd, 0);
+		if (ret > 0) {
+			conn->consumed = frame_len;
+			*payload = conn->buffer + off;
+			*len = plen;
+			return 0;
+		}
+
+		if (conn->len == buffer_size) {
+			fprintf(stderr, "client: _recv_frame: frame too large\n");
+			return -1;
+		}
+
+		const ssize_t rv = recv(conn->fd, conn->buffer + conn->len, buffer_size - conn->len, 0);
 		if (rv < 0) {
-			perror("client: _recv_response: recv");
+			perror("client: _recv_frame: recv");
 			return -1;
 		}
 
 		if (rv == 0)
 			break;
 
-		recvd += (size_t)rv;
+		conn->len += (size_t)rv;
 	}
 
-	if (recvd == 0) {
-		fprintf(stderr, "client: _recv_response: recv: 0 byte\n");
+	/* legacy responses end with the connection */
+	if ((framing == IPC_FRAMING_LENGTH) || (conn->len == 0)) {
+		fprintf(stderr, "client: _recv_frame: recv: 0 byte\n");
 		return -1;
 	}
 
-	buffer[recvd] = '\0';
+	conn->buffer[conn->len] = '\0';
+	conn->consumed = conn->len;
+	*payload = conn->buffer;
+	*len = conn->len;
+	return 0;
+}
+
+
+static int
+_recv_response(Conn *conn, IpcResponse *resp)
+{
+	char *payload;
+	size_t len;
+	if (_recv_frame(conn, conn->framing, &payload, &len) < 0)
+		return -1;
 
-	const int ret = ipc_response_parse(resp, buffer, recvd);
+	/* the lists of the previous response live until here */
+	ipc_arena_reset(&_arena);
+	const int ret = ipc_response_parse(resp, payload, len, &_arena);
 	switch (ret) {
 	case IPC_PARSE_SUCCESS:
 		return 0;
@@ -204,18 +637,75 @@ _print_response(const IpcResponse *resp, int req_code)
 	}
 
 	const IpcBodyStatus *const status = &resp->status;
+	uint64_t fields;
+
+	const IpcBodyHello *const hello = &resp->hello;
+	const IpcBodyHistory *const history = &resp->history;
+	const IpcBodyAlert *const alert = &resp->alert;
+	const IpcBodyTop *const top = &resp->top;
 
 	switch (rcode) {
 	case IPC_REQ_HELLO:
+		printf("response: %.*s\n", (int)hello->message.len, hello->message.str);
+		if ((resp->fields & IPC_FIELD(framing)) == 0)
+			break;
+
+		printf(" encoding:    %s\n"
+		       " framing:     %s\n"
+		       " compression: %s\n"
+		       " max frame:   %zu\n"
+		       " shm:         %s\n",
+		       ipc_encoding_str(hello->encodings), ipc_framing_str(hello->framing),
+		       ipc_compression_str(hello->compression), hello->max_frame, hello->shm ? "yes" : "no");
+		break;
 	case IPC_REQ_SHUTDOWN:
-		printf("response: %s\n", resp->message);
+	case IPC_REQ_SUBSCRIBE:
+		printf("response: %.*s\n", (int)resp->msg.message.len, resp->msg.message.str);
 		break;
 	case IPC_REQ_STATUS:
-		printf("response: \n"
-		       " cpu cores:       %u\n"
-		       " memory usage:    %zu\n"
-		       " memory capacity: %zu\n",
-		       status->cpu_cores, status->memory_usage, status->memory_capacity);
+		/* a projected body only carries what was asked for */
+		fields = (resp->fields != 0) ? resp->fields : IPC_FIELDS_ALL(IPC_BODY_STATUS);
+
+		printf("response: \n");
+		if ((fields & IPC_FIELD(version)) && (status->version != 0))
+			printf(" version:         %" PRIu64 "\n", status->version);
+		if ((fields & IPC_FIELD(base)) && (status->base != 0))
+			printf(" delta from:      %" PRIu64 "\n", status->base);
+		if (fields & IPC_FIELD(cpu_cores))
+			printf(" cpu cores:       %u\n", status->cpu_cores);
+		if (fields & IPC_FIELD(memory_usage))
+			printf(" memory usage:    %zu\n", status->memory_usage);
+		if (fields & IPC_FIELD(memory_capacity))
+			printf(" memory capacity: %zu\n", status->memory_capacity);
+		if (fields & IPC_FIELD(cpu))
+			_print_cpu("cpu", &status->cpu);
+		if (fields & IPC_FIELD(cpus)) {
+			for (unsigned i = 0; i < status->cpus.len; i++) {
+				char name[24];
+				snprintf(name, sizeof(name), "cpu %u", status->cpus.list[i].id);
+				_print_cpu(name, &status->cpus.list[i]);
+			}
+		}
+		break;
+	case IPC_REQ_WATCH:
+		printf("response: %.*s", (int)alert->message.len, alert->message.str);
+		if (resp->fields & IPC_FIELD(value))
+			printf(": %" PRIu64 " at %" PRIu64 " ms", alert->value, alert->time);
+
+		printf("\n");
+		break;
+	case IPC_REQ_TOP:
+		printf("response: %u processes\n", top->count);
+		_print_procs("rss", &top->by_rss);
+		_print_procs("cpu", &top->by_cpu);
+		break;
+	case IPC_REQ_HISTORY:
+		printf("response: %u samples, %u ms apart\n", history->samples.len, history->step);
+		if (history->samples.len > 0)
+			printf(" %-12s %-26s %s\n", "time", "cpu min/avg/max", "memory min/avg/max");
+
+		for (unsigned i = 0; i < history->samples.len; i++)
+			_print_sample(&history->samples.list[i]);
 		break;
 	default:
 		printf("hmm...\n");
@@ -223,3 +713,44 @@ _print_response(const IpcResponse *resp, int req_code)
 	}
 }
 
+
+static void
+_print_cpu(const char name[], const IpcCpu *cpu)
+{
+	printf(" %-16s user %u.%02u%%, system %u.%02u%%, iowait %u.%02u%%, steal %u.%02u%%", name,
+	       cpu->user / 100, cpu->user % 100, cpu->system / 100, cpu->system % 100, cpu->iowait / 100,
+	       cpu->iowait % 100, cpu->steal / 100, cpu->steal % 100);
+
+	if (cpu->freq != 0)
+		printf(", %u MHz", cpu->freq);
+
+	printf("\n");
+}
+
+
+static void
+_print_sample(const IpcSample *sample)
+{
+	const time_t sec = (time_t)(sample->time / 1000);
+	struct tm tm;
+	localtime_r(&sec, &tm);
+
+	char cpu[40];
+	snprintf(cpu, sizeof(cpu), "%u.%02u/%u.%02u/%u.%02u%%", sample->cpu_min / 100, sample->cpu_min % 100,
+		 sample->cpu_avg / 100, sample->cpu_avg % 100, sample->cpu_max / 100, sample->cpu_max % 100);
+
+	printf(" %02d:%02d:%02d.%03u %-26s %zu/%zu/%zu\n", tm.tm_hour, tm.tm_min, tm.tm_sec,
+	       (unsigned)(sample->time % 1000), cpu, sample->memory_min, sample->memory_avg, sample->memory_max);
+}
+
+
+static void
+_print_procs(const char name[], const IpcProcs *procs)
+{
+	printf(" by %s:\n", name);
+	for (unsigned i = 0; i < procs->len; i++) {
+		const IpcProc *const proc = &procs->list[i];
+		printf("  %-8u %-16.*s %12zu %u.%02u%%\n", proc->pid, (int)proc->name.len, proc->name.str, proc->rss,
+		       proc->cpu / 100, proc->cpu % 100);
+	}
+}
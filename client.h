@@ -2,7 +2,9 @@
 #define __CLIENT_H__
 
 
-int client_run(const char sock_file[], const char cmd[]);
+/* runs every command in "cmds" over one connection when the server allows it,
+ * "status" is read from the "status_page" shared memory when it is up */
+int client_run(const char sock_file[], const char status_page[], const char *cmds[], int len);
 
 
 #endif
@@ -0,0 +1,220 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "history.h"
+
+
+static int              _level_add(HistoryLevel *l, const IpcSample *point);
+static const IpcSample *_level_at(const HistoryLevel *l, unsigned i);
+static unsigned         _level_find(const HistoryLevel *l, uint64_t time);
+static int              _level_holds(const HistoryLevel *l, uint64_t from, uint64_t since);
+
+
+/*
+ * public
+ */
+int
+history_init(History *h, unsigned interval)
+{
+	const struct {
+		unsigned step;
+		unsigned size;
+	} levels[HISTORY_LEVELS] = {
+		{ interval, HISTORY_RAW_SPAN / interval },
+		{ 1000, 600 },
+		{ 10000, 360 },
+		{ 60000, HISTORY_SPAN / 60000 },
+	};
+
+	memset(h, 0, sizeof(*h));
+	for (int i = 0; i < HISTORY_LEVELS; i++) {
+		HistoryLevel *const l = &h->levels[i];
+		l->step = levels[i].step;
+		l->size = levels[i].size;
+		if (i == 0)
+			l->size = (l->size < 2) ? 2 : (l->size > HISTORY_RAW_MAX) ? HISTORY_RAW_MAX : l->size;
+
+		l->ring = malloc(sizeof(IpcSample) * l->size);
+		if (l->ring == NULL) {
+			perror("history: history_init: malloc");
+			history_deinit(h);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+
+void
+history_deinit(History *h)
+{
+	for (int i = 0; i < HISTORY_LEVELS; i++)
+		free(h->levels[i].ring);
+
+	memset(h, 0, sizeof(*h));
+}
+
+
+const IpcSample *
+history_add(History *h, uint64_t time, const IpcBodyStatus *s)
+{
+	const unsigned cpu = s->cpu.user + s->cpu.system;
+	const IpcSample point = {
+		.time = time,
+		.memory_min = s->memory_usage,
+		.memory_avg = s->memory_usage,
+		.memory_max = s->memory_usage,
+		.cpu_min = cpu,
+		.cpu_avg = cpu,
+		.cpu_max = cpu,
+	};
+
+	const IpcSample *closed = NULL;
+	for (int i = 0; i < HISTORY_LEVELS; i++) {
+		HistoryLevel *const l = &h->levels[i];
+		if ((_level_add(l, &point) > 0) && (i == 1) && (l->len > 1))
+			closed = _level_at(l, l->len - 2);
+	}
+
+	return closed;
+}
+
+
+void
+history_restore(History *h, const IpcSample *point)
+{
+	/* the raw samples are not worth keeping across runs */
+	for (int i = 1; i < HISTORY_LEVELS; i++)
+		_level_add(&h->levels[i], point);
+
+	h->restored = point->time + h->levels[1].step;
+}
+
+
+void
+history_query(const History *h, uint64_t from, uint64_t to, unsigned step, IpcBodyHistory *res)
+{
+	const HistoryLevel *l = NULL;
+	unsigned first = 0;
+	unsigned last = 0;
+	for (int i = 0; i < HISTORY_LEVELS; i++) {
+		l = &h->levels[i];
+		if ((l->step < step) && (i < (HISTORY_LEVELS - 1)))
+			continue;
+
+		/* the points ending after "from" up to the ones starting at "to" */
+		first = _level_find(l, (from >= l->step) ? (from - l->step + 1) : 0);
+		last = _level_find(l, (to < UINT64_MAX) ? (to + 1) : to);
+		const uint64_t since = (i == 0) ? h->restored : 0;
+		if (_level_holds(l, from, since) && ((last - first) <= HISTORY_POINTS_MAX))
+			break;
+	}
+
+	memset(res, 0, sizeof(*res));
+	res->step = l->step;
+
+	/* "to" before "from": the difference would wrap past the ring */
+	if (last <= first)
+		return;
+
+	if ((last - first) > HISTORY_POINTS_MAX)
+		first = last - HISTORY_POINTS_MAX;
+
+	/* as two runs of the ring when it wraps, nothing is copied */
+	const unsigned start = (l->head + first) % l->size;
+	const unsigned len = last - first;
+	res->samples.list = &l->ring[start];
+	res->samples.len = (len < (l->size - start)) ? len : (l->size - start);
+	res->samples.wrap = l->ring;
+	res->samples.wrap_len = len - res->samples.len;
+}
+
+
+/*
+ * private
+ */
+/* into the newest point while "point" falls in it, else into a new one over
+ * the oldest. Returns 1: a new one, 0: merged, -1: older than the newest */
+static int
+_level_add(HistoryLevel *l, const IpcSample *point)
+{
+	const uint64_t start = point->time - (point->time % l->step);
+	if (l->len > 0) {
+		IpcSample *const p = (IpcSample *)_level_at(l, l->len - 1);
+		if (start < p->time)
+			return -1;
+
+		if (start == p->time) {
+			l->memory_sum += point->memory_avg;
+			l->cpu_sum += point->cpu_avg;
+			l->count++;
+
+			if (point->memory_min < p->memory_min)
+				p->memory_min = point->memory_min;
+			if (point->memory_max > p->memory_max)
+				p->memory_max = point->memory_max;
+			if (point->cpu_min < p->cpu_min)
+				p->cpu_min = point->cpu_min;
+			if (point->cpu_max > p->cpu_max)
+				p->cpu_max = point->cpu_max;
+
+			p->memory_avg = (size_t)(l->memory_sum / l->count);
+			p->cpu_avg = (unsigned)(l->cpu_sum / l->count);
+			return 0;
+		}
+	}
+
+	if (l->len == l->size)
+		l->head = (l->head + 1) % l->size;
+	else
+		l->len++;
+
+	IpcSample *const p = (IpcSample *)_level_at(l, l->len - 1);
+	*p = *point;
+	p->time = start;
+
+	l->memory_sum = point->memory_avg;
+	l->cpu_sum = point->cpu_avg;
+	l->count = 1;
+	return 1;
+}
+
+
+/* "i": from the oldest */
+static const IpcSample *
+_level_at(const HistoryLevel *l, unsigned i)
+{
+	return &l->ring[(l->head + i) % l->size];
+}
+
+
+/* the first point starting at or after "time" */
+static unsigned
+_level_find(const HistoryLevel *l, uint64_t time)
+{
+	unsigned lo = 0;
+	unsigned hi = l->len;
+	while (lo < hi) {
+		const unsigned mid = lo + ((hi - lo) / 2);
+		if (_level_at(l, mid)->time < time)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+
+/* the oldest is no younger than "from", or it has not dropped anything yet
+ * and nothing older than "since" is missing */
+static int
+_level_holds(const HistoryLevel *l, uint64_t from, uint64_t since)
+{
+	if ((l->len > 0) && (_level_at(l, 0)->time <= from))
+		return 1;
+
+	return (l->len < l->size) && (from >= since);
+}
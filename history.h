@@ -0,0 +1,59 @@
+#ifndef __HISTORY_H__
+#define __HISTORY_H__
+
+
+#include <stdint.h>
+
+#include "ipc.h"
+
+
+/* raw samples cover the last minute, at most HISTORY_RAW_MAX of them, the
+ * rollups: 1 s for 10 min, 10 s for 1 h, 1 min for 1 day */
+#define HISTORY_RAW_SPAN   (60000)
+#define HISTORY_RAW_MAX    (6000)
+#define HISTORY_LEVELS     (4)
+#define HISTORY_SPAN       (86400000)   /* of the coarsest level */
+
+/* per response, about 136 bytes each in a 64 KiB frame */
+#define HISTORY_POINTS_MAX (400)
+
+
+/* a ring of points "step" ms apart, the newest is still being filled */
+typedef struct {
+	unsigned   step;
+	unsigned   size;
+	unsigned   head;          /* the oldest */
+	unsigned   len;
+	IpcSample *ring;
+	uint64_t   memory_sum;    /* of the newest */
+	uint64_t   cpu_sum;
+	unsigned   count;
+} HistoryLevel;
+
+/* allocated once, then only written over */
+typedef struct {
+	HistoryLevel levels[HISTORY_LEVELS];
+	uint64_t     restored;    /* the end of history_restore(), the raw samples lack it */
+} History;
+
+
+/* "interval": ms between the samples */
+int  history_init(History *h, unsigned interval);
+void history_deinit(History *h);
+
+/* "time": ms since the epoch, samples going back are dropped. Returns the
+ * 1 s point it closed, if any, valid until the next call */
+const IpcSample *history_add(History *h, uint64_t time, const IpcBodyStatus *s);
+
+/* feeds a closed 1 s point back to the rollups, oldest first, e.g. from a
+ * previous run */
+void history_restore(History *h, const IpcSample *point);
+
+/* the points in [from, to] of the finest level holding "from" in at most
+ * HISTORY_POINTS_MAX points and at least "step" ms apart, the newest ones of
+ * the coarsest level if none does. "res" points into the rings until the next
+ * history_add() */
+void history_query(const History *h, uint64_t from, uint64_t to, unsigned step, IpcBodyHistory *res);
+
+
+#endif
@@ -1,18 +1,214 @@
 #include <assert.h>
-#include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 
 #include "ipc.h"
 #include "json.h"
 
 
+#define KEY_SLOTS_BITS (7)
+#define KEY_SLOTS      (1u << KEY_SLOTS_BITS)
+
+
+_Static_assert(IPC_KEY_COUNT <= 64, "IPC_KEYS must fit the uint64_t field masks");
+
+typedef struct {
+	const char *str;
+	size_t      len;
+} Key;
+
+typedef struct {
+	char   *str;
+	size_t  len;
+	size_t  size;
+	int     is_err;
+} Writer;
+
+/* an IpcArena allocation that did not fit */
+typedef struct Spill {
+	struct Spill *next;
+	max_align_t   data[];
+} Spill;
+
+
+static void     _key_table_init(void) __attribute__((constructor));
+static uint32_t _key_hash(const char str[], size_t len, uint32_t seed);
+static int      _key_find(const json_string_t *name);
+static int      _writer_init(Writer *w, size_t size);
+static void     _writer_raw(Writer *w, const char str[], size_t len);
+static void     _writer_str(Writer *w, const char str[], size_t len);
+static void     _writer_num(Writer *w, unsigned long long num);
+static void     _writer_key(Writer *w, const char **sep, const char key[], size_t len);
+static char    *_writer_finish(Writer *w);
+static void     _build_response(Writer *w, const IpcResponse *r, int with_id);
+static int      _pull_response_body(IpcResponse *r, int code, int request_code, json_pull_t *p, int event,
+				    IpcArena *arena);
+static void    *_arena_alloc(void *arena, size_t size);
+static size_t   _skip_space(const char str[], size_t len, size_t i);
+static int      _batch_span(IpcSpan spans[], size_t max, size_t *count, const char json[], size_t start,
+			    size_t end);
+static int      _parse_json(json_value_t **json_obj, char json[], size_t len, IpcArena *arena);
+static void     _free_json(json_value_t *json_obj, IpcArena *arena);
+static int      _parse_number(unsigned long long *num, json_value_t *value);
+static int      _parse_digits(unsigned long long *num, const char str[], size_t len);
+static int      _parse_pct(unsigned *v, const char str[], size_t len);
+static void     _enc_uint(Writer *w, const unsigned *v);
+static void     _enc_u64(Writer *w, const uint64_t *v);
+static void     _enc_size(Writer *w, const size_t *v);
+static void     _enc_str(Writer *w, const IpcStr *v);
+static void     _enc_keys(Writer *w, const uint64_t *v);
+static void     _enc_pct(Writer *w, const unsigned *v);
+static void     _enc_cpu(Writer *w, const IpcCpu *v);
+static void     _enc_cpus(Writer *w, const IpcCpus *v);
+static void     _enc_samples(Writer *w, const IpcSamples *v);
+static void     _enc_procs(Writer *w, const IpcProcs *v);
+static int      _dec_uint(unsigned *v, json_value_t *value, IpcArena *arena);
+static int      _dec_u64(uint64_t *v, json_value_t *value, IpcArena *arena);
+static int      _dec_size(size_t *v, json_value_t *value, IpcArena *arena);
+static int      _dec_str(IpcStr *v, json_value_t *value, IpcArena *arena);
+static int      _dec_keys(uint64_t *v, json_value_t *value, IpcArena *arena);
+static int      _dec_pct(unsigned *v, json_value_t *value, IpcArena *arena);
+static int      _dec_cpu(IpcCpu *v, json_value_t *value, IpcArena *arena);
+static int      _dec_cpus(IpcCpus *v, json_value_t *value, IpcArena *arena);
+static int      _dec_samples(IpcSamples *v, json_value_t *value, IpcArena *arena);
+static int      _dec_procs(IpcProcs *v, json_value_t *value, IpcArena *arena);
+static int      _pull_key(const json_pull_t *p);
+static int      _pull_skip(json_pull_t *p, int event);
+static void    *_pull_grow(void *list, unsigned len, unsigned *size, size_t item, IpcArena *arena);
+static int      _pull_uint(unsigned *v, json_pull_t *p, int event, IpcArena *arena);
+static int      _pull_u64(uint64_t *v, json_pull_t *p, int event, IpcArena *arena);
+static int      _pull_size(size_t *v, json_pull_t *p, int event, IpcArena *arena);
+static int      _pull_str(IpcStr *v, json_pull_t *p, int event, IpcArena *arena);
+static int      _pull_keys(uint64_t *v, json_pull_t *p, int event, IpcArena *arena);
+static int      _pull_pct(unsigned *v, json_pull_t *p, int event, IpcArena *arena);
+static int      _pull_cpu(IpcCpu *v, json_pull_t *p, int event, IpcArena *arena);
+static int      _pull_cpus(IpcCpus *v, json_pull_t *p, int event, IpcArena *arena);
+static int      _pull_samples(IpcSamples *v, json_pull_t *p, int event, IpcArena *arena);
+static int      _pull_procs(IpcProcs *v, json_pull_t *p, int event, IpcArena *arena);
+
+#define _writer_lit(w, lit) _writer_raw(w, lit, sizeof(lit) - 1)
+
+
+/* perfect hash over IPC_KEYS, the seed is searched once at startup */
+static const Key _keys[IPC_KEY_COUNT] = {
+#define KEY_ENTRY(key) [IPC_KEY_##key] = { #key, sizeof(#key) - 1 },
+	IPC_KEYS(KEY_ENTRY)
+#undef KEY_ENTRY
+};
+
+static uint8_t  _key_slots[KEY_SLOTS];
+static uint32_t _key_seed;
+
+/* "00" .. "99": two digits per division */
+static const char _digit_pairs[200] =
+	"00010203040506070809" "10111213141516171819" "20212223242526272829" "30313233343536373839"
+	"40414243444546474849" "50515253545556575859" "60616263646566676869" "70717273747576777879"
+	"80818283848586878889" "90919293949596979899";
 
-static char *_str_builder(const char fmt[], ...);
-static int   _parse_json(json_value_t **json_obj, const char json[], size_t len);
-static void  _parse_message(char message[], const json_object_t *body);
-static int   _parse_status(IpcBodyStatus *s, const json_object_t *body);
+
+/*
+ * Body codecs, expanded from IPC_BODIES
+ */
+#define BODY_ENC_FIELD(kind, key)                                       \
+	if (fields & IPC_FIELD(key)) {                                  \
+		_writer_key(w, &sep, "\"" #key "\":", sizeof(#key) + 2); \
+		_enc_##kind(w, &b->key);                                \
+	}
+
+#define BODY_DEC_FIELD(kind, key)                                       \
+	case IPC_KEY_##key:                                             \
+		if (_dec_##kind(&b->key, e->value, arena) < 0)          \
+			return IPC_PARSE_EINVAL;                        \
+		*fields |= IPC_FIELD(key);                              \
+		break;
+
+#define BODY_PULL_FIELD(kind, key)                                      \
+	case IPC_KEY_##key:                                             \
+		if (_pull_##kind(&b->key, p, event, arena) < 0)         \
+			return IPC_PARSE_EINVAL;                        \
+		*fields |= IPC_FIELD(key);                              \
+		break;
+
+/* requests are parsed through the DOM and responses pulled, each side
+ * leaves the other's decoders unused */
+#define BODY_CODEC(tag, Type, FIELDS)                                   \
+	static void                                                     \
+	_build_body_##tag(Writer *w, const Type *b, uint64_t fields)    \
+	{                                                               \
+		const char *sep = "";                                   \
+		if (fields == 0)                                        \
+			fields = IPC_FIELDS_ALL(FIELDS);                \
+									\
+		_writer_lit(w, "{");                                    \
+		FIELDS(BODY_ENC_FIELD)                                  \
+		_writer_lit(w, "}");                                    \
+		(void)sep;                                              \
+		(void)b;                                                \
+	}                                                               \
+									\
+	__attribute__((unused)) static int                              \
+	_parse_body_##tag(Type *b, uint64_t *fields, const json_object_t *body, IpcArena *arena) \
+	{                                                               \
+		memset(b, 0, sizeof(*b));                               \
+		*fields = 0;                                            \
+		(void)arena;                                            \
+		if (body == NULL)                                       \
+			return IPC_PARSE_SUCCESS;                       \
+									\
+		const json_object_element_t *e = body->start;           \
+		for (; e != NULL; e = e->next) {                        \
+			switch (_key_find(e->name)) {                   \
+			FIELDS(BODY_DEC_FIELD)                          \
+			default: break;                                 \
+			}                                               \
+		}                                                       \
+									\
+		return IPC_PARSE_SUCCESS;                               \
+	}                                                               \
+									\
+	/* "event": the one read before the body, NULL "p": none */     \
+	__attribute__((unused)) static int                              \
+	_pull_body_##tag(Type *b, uint64_t *fields, json_pull_t *p, int event, IpcArena *arena) \
+	{                                                               \
+		memset(b, 0, sizeof(*b));                               \
+		*fields = 0;                                            \
+		(void)arena;                                            \
+		if (p == NULL)                                          \
+			return IPC_PARSE_SUCCESS;                       \
+									\
+		if (event != json_pull_object_start)                    \
+			return IPC_PARSE_EINVAL;                        \
+									\
+		while ((event = json_pull_next(p)) != json_pull_object_end) { \
+			if (event != json_pull_key)                     \
+				return IPC_PARSE_EINVAL;                \
+									\
+			const int key = _pull_key(p);                   \
+			event = json_pull_next(p);                      \
+			switch (key) {                                  \
+			FIELDS(BODY_PULL_FIELD)                         \
+			default:                                        \
+				if (_pull_skip(p, event) < 0)           \
+					return IPC_PARSE_EINVAL;        \
+				break;                                  \
+			}                                               \
+		}                                                       \
+									\
+		return IPC_PARSE_SUCCESS;                               \
+	}
+
+IPC_BODIES(BODY_CODEC)
+BODY_CODEC(cpu, IpcCpu, IPC_CPU)
+BODY_CODEC(sample, IpcSample, IPC_SAMPLE)
+BODY_CODEC(proc, IpcProc, IPC_PROC)
+
+#undef BODY_CODEC
+#undef BODY_PULL_FIELD
+#undef BODY_DEC_FIELD
+#undef BODY_ENC_FIELD
 
 
 /*
@@ -25,9 +221,9 @@ const char *
 ipc_request_code_str(int code)
 {
 	switch (code) {
-	case IPC_REQ_HELLO: return "hello";
-	case IPC_REQ_STATUS: return "status";
-	case IPC_REQ_SHUTDOWN: return "shutdown";
+#define REQ_STR(NAME, name, req, res) case IPC_REQ_##NAME: return #name;
+	IPC_REQUESTS(REQ_STR)
+#undef REQ_STR
 	}
 
 	return "unknown";
@@ -48,36 +244,250 @@ ipc_response_code_str(int code)
 }
 
 
+const char *
+ipc_encoding_str(unsigned encoding)
+{
+	switch (encoding) {
+	case IPC_ENCODING_JSON: return "json";
+	}
+
+	return "unknown";
+}
+
+
+const char *
+ipc_framing_str(unsigned framing)
+{
+	switch (framing) {
+	case IPC_FRAMING_LEGACY: return "legacy";
+	case IPC_FRAMING_NUL: return "nul";
+	case IPC_FRAMING_LENGTH: return "length";
+	}
+
+	return "unknown";
+}
+
+
+const char *
+ipc_compression_str(unsigned compression)
+{
+	switch (compression) {
+	case IPC_COMPRESSION_NONE: return "none";
+	}
+
+	return "unknown";
+}
+
+
+int
+ipc_request_code_from_str(const char str[])
+{
+#define REQ_FROM_STR(NAME, name, req, res)          \
+	if (strcasecmp(str, #name) == 0)        \
+		return IPC_REQ_##NAME;
+
+	IPC_REQUESTS(REQ_FROM_STR)
+#undef REQ_FROM_STR
+
+	return IPC_REQ_NONE;
+}
+
+
+int
+ipc_key_from_str(const char str[], size_t len)
+{
+	const json_string_t name = { .string = str, .string_size = len };
+	return _key_find(&name);
+}
+
+
+size_t
+ipc_uint_to_str(char buf[IPC_UINT_STR_MAX], unsigned long long num)
+{
+	char tmp[IPC_UINT_STR_MAX];
+	char *p = tmp + sizeof(tmp);
+	while (num >= 100) {
+		const unsigned pair = (unsigned)(num % 100);
+		num /= 100;
+		p -= 2;
+		memcpy(p, &_digit_pairs[pair * 2], 2);
+	}
+
+	if (num >= 10) {
+		p -= 2;
+		memcpy(p, &_digit_pairs[num * 2], 2);
+	} else {
+		*--p = (char)('0' + num);
+	}
+
+	const size_t len = (size_t)((tmp + sizeof(tmp)) - p);
+	memcpy(buf, p, len);
+	return len;
+}
+
+
+int
+ipc_hello_negotiate(IpcBodyHello *res, const IpcBodyHello *req, const IpcBodyHello *local)
+{
+	const unsigned encodings = req->encodings & local->encodings;
+	const unsigned framing = req->framing & local->framing;
+	const unsigned compression = req->compression & local->compression;
+	if ((encodings == 0) || (framing == 0) || (compression == 0))
+		return -1;
+
+	/* the highest common bit wins */
+	res->encodings = 1u << (31 - __builtin_clz(encodings));
+	res->framing = 1u << (31 - __builtin_clz(framing));
+	res->compression = 1u << (31 - __builtin_clz(compression));
+
+	res->max_frame = local->max_frame;
+	if ((req->max_frame != 0) && (req->max_frame < res->max_frame))
+		res->max_frame = req->max_frame;
+
+	res->shm = req->shm && local->shm;
+	return 0;
+}
+
+
 /*
- * Request
+ * Framing
  */
-char *
-ipc_request_build_hello(void)
+size_t
+ipc_frame_head(char head[], int framing, size_t len)
 {
-	return _str_builder("{\"code\":%d}", IPC_REQ_HELLO);
+	if (framing != IPC_FRAMING_LENGTH)
+		return 0;
+
+	head[0] = (char)((len >> 24) & 0xff);
+	head[1] = (char)((len >> 16) & 0xff);
+	head[2] = (char)((len >> 8) & 0xff);
+	head[3] = (char)(len & 0xff);
+	return IPC_FRAME_HEAD_SIZE;
 }
 
 
-char *
-ipc_request_build_status(void)
+int
+ipc_frame_next(int framing, const char buf[], size_t len, size_t max, size_t *payload,
+	       size_t *payload_len, size_t *frame_len)
+{
+	if (framing == IPC_FRAMING_LENGTH) {
+		if (len < IPC_FRAME_HEAD_SIZE)
+			return 0;
+
+		const unsigned char *const h = (const unsigned char *)buf;
+		const size_t plen = ((size_t)h[0] << 24) | ((size_t)h[1] << 16) | ((size_t)h[2] << 8) |
+				    (size_t)h[3];
+		if (plen > max)
+			return -1;
+
+		if (len < (IPC_FRAME_HEAD_SIZE + plen))
+			return 0;
+
+		*payload = IPC_FRAME_HEAD_SIZE;
+		*payload_len = plen;
+		*frame_len = IPC_FRAME_HEAD_SIZE + plen;
+		return 1;
+	}
+
+	/* legacy requests are '\0' terminated as well */
+	const char *const end = memchr(buf, '\0', len);
+	if (end == NULL)
+		return (len > max) ? -1 : 0;
+
+	*payload = 0;
+	*payload_len = (size_t)(end - buf);
+	*frame_len = *payload_len + 1;
+	return 1;
+}
+
+
+/*
+ * Arena
+ */
+void
+ipc_arena_init(IpcArena *a)
+{
+	memset(a, 0, sizeof(*a));
+}
+
+
+void
+ipc_arena_reset(IpcArena *a)
+{
+	for (Spill *s = a->spills; s != NULL;) {
+		Spill *const next = s->next;
+		free(s);
+		s = next;
+	}
+
+	/* the contents are dead, no need to realloc() */
+	if (a->high_water > a->size) {
+		const size_t size = (a->high_water + 4095) & ~(size_t)4095;
+		char *const base = malloc(size);
+		if (base != NULL) {
+			free(a->base);
+			a->base = base;
+			a->size = size;
+		}
+	}
+
+	a->used = 0;
+	a->spills = NULL;
+}
+
+
+void
+ipc_arena_deinit(IpcArena *a)
 {
-	return _str_builder("{\"code\":%d}", IPC_REQ_STATUS);
+	ipc_arena_reset(a);
+	free(a->base);
+	memset(a, 0, sizeof(*a));
 }
 
 
+/*
+ * Request
+ */
 char *
-ipc_request_build_shutdown(void)
+ipc_request_build(const IpcRequest *r)
 {
-	return _str_builder("{\"code\":%d}", IPC_REQ_SHUTDOWN);
+	Writer w;
+	if (_writer_init(&w, 32) < 0)
+		return NULL;
+
+	_writer_lit(&w, "{\"code\":");
+	_writer_num(&w, (unsigned long long)r->code);
+
+	if (r->id != 0) {
+		_writer_lit(&w, ",\"id\":");
+		_writer_num(&w, r->id);
+	}
+
+	/* bodiless requests keep the legacy '{"code":N}' shape */
+	if (r->fields != 0) {
+		_writer_lit(&w, ",\"body\":");
+		switch (r->code) {
+#define REQ_BUILD(NAME, name, req, res) case IPC_REQ_##NAME: _build_body_##req(&w, &r->req, r->fields); break;
+		IPC_REQUESTS(REQ_BUILD)
+#undef REQ_BUILD
+		default: _writer_lit(&w, "{}"); break;
+		}
+	}
+
+	_writer_lit(&w, "}");
+	return _writer_finish(&w);
 }
 
 
 int
-ipc_request_parse(IpcRequest *r, const char json[], size_t len)
+ipc_request_parse(IpcRequest *r, char json[], size_t len, IpcArena *arena)
 {
 	json_value_t *jsp;
 
-	int ret = _parse_json(&jsp, json, len);
+	r->code = IPC_REQ_NONE;
+	r->id = 0;
+
+	int ret = _parse_json(&jsp, json, len, arena);
 	if (ret != IPC_PARSE_SUCCESS)
 		return ret;
 
@@ -87,252 +497,1174 @@ ipc_request_parse(IpcRequest *r, const char json[], size_t len)
 	if (root_obj == NULL)
 		goto out0;
 
-	if (root_obj->length != 1)
-		goto out0;
+	int has_code = 0;
+	unsigned long long num;
+	const json_object_t *body = NULL;
+	for (const json_object_element_t *e = root_obj->start; e != NULL; e = e->next) {
+		switch (_key_find(e->name)) {
+		case IPC_KEY_code:
+			if (_parse_number(&num, e->value) < 0)
+				goto out0;
+
+			r->code = (int)num;
+			has_code = 1;
+			break;
+		case IPC_KEY_id:
+			if ((_parse_number(&num, e->value) < 0) || (num > (unsigned)-1))
+				goto out0;
 
-	const json_object_element_t *const ename = root_obj->start; 
-	if (strcmp(ename->name->string, "code") != 0)
-		goto out0;
+			r->id = (unsigned)num;
+			break;
+		case IPC_KEY_body:
+			body = json_value_as_object(e->value);
+			break;
+		}
+	}
 
-	const json_number_t *const code = json_value_as_number(ename->value);
-	if (code == NULL)
+	if (has_code == 0)
 		goto out0;
 
-	r->code = atoi(code->number);
-	ret = IPC_PARSE_SUCCESS;
+	switch (r->code) {
+#define REQ_PARSE(NAME, name, req, res) \
+	case IPC_REQ_##NAME: ret = _parse_body_##req(&r->req, &r->fields, body, arena); break;
+	IPC_REQUESTS(REQ_PARSE)
+#undef REQ_PARSE
+	default:
+		ret = _parse_body_none(&r->none, &r->fields, NULL, arena);
+		break;
+	}
 
 out0:
-	free(jsp);
+	_free_json(jsp, arena);
 	return ret;
 }
 
 
+/*
+ * Batch
+ */
+int
+ipc_batch_is(const char json[], size_t len)
+{
+	const size_t i = _skip_space(json, len, 0);
+	return (i < len) && (json[i] == '[');
+}
+
+
+int
+ipc_batch_split(IpcSpan spans[], size_t max, size_t *count, const char json[], size_t len)
+{
+	size_t i = _skip_space(json, len, 0);
+	if ((i == len) || (json[i] != '['))
+		return -1;
+
+	*count = 0;
+
+	size_t depth = 0;
+	size_t start = ++i;
+	for (; i < len; i++) {
+		switch (json[i]) {
+		case '"':
+			/* to the closing quote, one preceded by an odd run of '\\' is escaped */
+			for (;;) {
+				const char *const end = memchr(json + i + 1, '"', len - i - 1);
+				if (end == NULL)
+					return -1;
+
+				i = (size_t)(end - json);
+
+				size_t n = 0;
+				while (json[i - 1 - n] == '\\')
+					n++;
+
+				if ((n & 1) == 0)
+					break;
+			}
+			break;
+		case '[':
+		case '{':
+			depth++;
+			break;
+		case '}':
+			if (depth == 0)
+				return -1;
+
+			depth--;
+			break;
+		case ']':
+			if (depth > 0) {
+				depth--;
+				break;
+			}
+
+			/* "[]" has no elements, "[1,]" an empty one */
+			if ((*count > 0) || (_skip_space(json, i, start) < i)) {
+				if (_batch_span(spans, max, count, json, start, i) < 0)
+					return -1;
+			}
+
+			return (_skip_space(json, len, i + 1) == len) ? 0 : -1;
+		case ',':
+			if (depth > 0)
+				break;
+
+			if (_batch_span(spans, max, count, json, start, i) < 0)
+				return -1;
+
+			start = i + 1;
+			break;
+		}
+	}
+
+	return -1;
+}
+
+
 /*
  * Response
  */
 char *
-ipc_response_build_hello(void)
+ipc_response_build(const IpcResponse *r)
 {
-	return _str_builder("{\"code\":%d, \"request_code\":%d, \"body\": {\"message\": \"%s\"}}",
-			    IPC_RES_OK, IPC_REQ_HELLO, "well, hello friend!");
+	Writer w;
+	if (_writer_init(&w, 128) < 0)
+		return NULL;
+
+	_build_response(&w, r, 1);
+	_writer_lit(&w, "}");
+	return _writer_finish(&w);
 }
 
 
 char *
-ipc_response_build_status(const IpcBodyStatus *status)
+ipc_response_build_open(const IpcResponse *r)
 {
-	return _str_builder("{\"code\": %d, \"request_code\": %d, \"body\": {"
-			    "\"cpu_cores\": %u, \"memory_usage\": %zu, \"memory_capacity\": %zu}}",
-			    IPC_RES_OK, IPC_REQ_STATUS, status->cpu_cores, status->memory_usage,
-			    status->memory_capacity);
+	Writer w;
+	if (_writer_init(&w, 128) < 0)
+		return NULL;
+
+	_build_response(&w, r, 0);
+	return _writer_finish(&w);
 }
 
 
-char *
-ipc_response_build_shutdown(void)
+size_t
+ipc_response_tail(char tail[IPC_RESPONSE_TAIL_MAX], unsigned id)
 {
-	return _str_builder("{\"code\":%d, \"request_code\":%d, \"body\": {\"message\":\"%s\"}}", IPC_RES_OK,
-			    IPC_REQ_SHUTDOWN, "shutting down...");
+	if (id == 0) {
+		tail[0] = '}';
+		return 1;
+	}
+
+	memcpy(tail, ",\"id\":", 6);
+
+	const size_t len = 6 + ipc_uint_to_str(tail + 6, id);
+	tail[len] = '}';
+	return len + 1;
 }
 
 
 char *
-ipc_response_build_error(int req, int res, const char message[])
+ipc_response_build_error(int req, unsigned id, int res, const char message[])
 {
-	size_t msg_len = strlen(message);
-	if (msg_len >= IPC_MESSAGE_SIZE)
-		msg_len = IPC_MESSAGE_SIZE - 1;
+	IpcResponse r = { .code = res, .request_code = req, .id = id };
+
+	const char *const code_str = ipc_response_code_str(res);
+	const size_t code_len = strlen(code_str);
+	const size_t msg_len = strlen(message);
 
-	return _str_builder("{\"code\":%d, \"request_code\":%d, \"body\": {\"message\":\"%s: %.*s\"}}", res, req,
-			    ipc_response_code_str(res), (int)msg_len, message);
+	char *const str = malloc(code_len + 2 + msg_len);
+	if (str == NULL)
+		return NULL;
+
+	memcpy(str, code_str, code_len);
+	memcpy(str + code_len, ": ", 2);
+	memcpy(str + code_len + 2, message, msg_len);
+
+	r.msg.message = (IpcStr) { .str = str, .len = code_len + 2 + msg_len };
+
+	char *const ret = ipc_response_build(&r);
+	free(str);
+	return ret;
 }
 
 
+/* pulled in one pass, the lists go straight into the arena. The body is
+ * decoded as what "code" and "request_code" say, they come before it */
 int
-ipc_response_parse(IpcResponse *r, const char json[], size_t len)
+ipc_response_parse(IpcResponse *r, char json[], size_t len, IpcArena *arena)
 {
-	json_value_t *jsp;
-
-	int ret = _parse_json(&jsp, json, len);
-	if (ret != IPC_PARSE_SUCCESS)
-		return ret;
-
-	ret = IPC_PARSE_EINVAL;
+	/* the whole frame is one chunk, no token is split into "token" */
+	char token[32];
+	json_pull_t p;
+	json_pull_init(&p, token, sizeof(token));
+	json_pull_feed(&p, json, len, 1);
 
-	const json_object_t *const root_obj = json_value_as_object(jsp);
-	if (root_obj == NULL)
-		goto out0;
+	if (json_pull_next(&p) != json_pull_object_start)
+		return IPC_PARSE_EINVAL;
 
 	// "body" is optional
-	if ((root_obj->length < 2) || (root_obj->length > 3))
-		goto out0;
-
-	int i = 3;
+	int i = 2;
 	int code = 0;
 	int request_code = 0;
-	const json_object_t *body = NULL;
-	for (const json_object_element_t *e = root_obj->start; (e != NULL) && (i > 0); e = e->next) {
-		const char *const name = e->name->string;
-		if (strcmp(name, "code") == 0) {
-			const json_number_t *const _code = json_value_as_number(e->value);
-			if (_code == NULL)
-				break;
+	unsigned id = 0;
+	int has_body = 0;
+	unsigned long long num;
+	int event;
+	int ret;
+	while ((event = json_pull_next(&p)) != json_pull_object_end) {
+		if (event != json_pull_key)
+			return IPC_PARSE_EINVAL;
+
+		const int key = _pull_key(&p);
+		event = json_pull_next(&p);
+		switch (key) {
+		case IPC_KEY_code:
+			if ((event != json_pull_number) || (_parse_digits(&num, p.value, p.value_size) < 0))
+				return IPC_PARSE_EINVAL;
 
-			code = atoi(_code->number);
+			code = (int)num;
 			i--;
-		} else if (strcmp(name, "request_code") == 0) {
-			const json_number_t *const _rcode = json_value_as_number(e->value);
-			if (_rcode == NULL)
-				break;
+			break;
+		case IPC_KEY_request_code:
+			if ((event != json_pull_number) || (_parse_digits(&num, p.value, p.value_size) < 0))
+				return IPC_PARSE_EINVAL;
 
-			request_code = atoi(_rcode->number);
-			i--;
-		} else if (strcmp(name, "body") == 0) {
-			body = json_value_as_object(e->value);
+			request_code = (int)num;
 			i--;
-		}
-	}
+			break;
+		case IPC_KEY_id:
+			if ((event != json_pull_number) || (_parse_digits(&num, p.value, p.value_size) < 0) ||
+			    (num > (unsigned)-1))
+				return IPC_PARSE_EINVAL;
 
-	if (code != IPC_RES_OK) {
-		_parse_message(r->message, body);
-	} else {
-		switch (request_code) {
-		case IPC_REQ_HELLO:
-		case IPC_REQ_SHUTDOWN:
-			_parse_message(r->message, body);
+			id = (unsigned)num;
 			break;
-		case IPC_REQ_STATUS:
-			if (_parse_status(&r->status, body) != IPC_PARSE_SUCCESS)
-				goto out1;
+		case IPC_KEY_body:
+			if ((i > 0) || has_body)
+				return IPC_PARSE_EINVAL;
+
+			ret = _pull_response_body(r, code, request_code, &p, event, arena);
+			if (ret != IPC_PARSE_SUCCESS)
+				return ret;
+
+			has_body = 1;
 			break;
 		default:
-			r->message[0] = '\0';
+			if (_pull_skip(&p, event) < 0)
+				return IPC_PARSE_EINVAL;
 			break;
 		}
 	}
 
-	ret = IPC_PARSE_SUCCESS;
+	if ((i > 0) || (json_pull_next(&p) != json_pull_end))
+		return IPC_PARSE_EINVAL;
+
+	if (has_body == 0)
+		_pull_response_body(r, code, request_code, NULL, 0, arena);
 
-out1:
 	r->code = code;
 	r->request_code = request_code;
-
-out0:
-	free(jsp);
-	return ret;
+	r->id = id;
+	return IPC_PARSE_SUCCESS;
 }
 
 
 /*
  * private
  */
-static char *
-_str_builder(const char fmt[], ...)
+static void
+_key_table_init(void)
 {
-	int ret;
-	va_list va;
+	for (uint32_t seed = 0x9e3779b1u; seed != 0x9e3779b1u + (1u << 20); seed += 2) {
+		memset(_key_slots, 0, sizeof(_key_slots));
 
+		int k = IPC_KEY_NONE + 1;
+		for (; k < IPC_KEY_COUNT; k++) {
+			const uint32_t slot = _key_hash(_keys[k].str, _keys[k].len, seed);
+			if (_key_slots[slot] != IPC_KEY_NONE)
+				break;
 
-	/* determine required size */
-	va_start(va, fmt);
-	ret = vsnprintf(NULL, 0, fmt, va);
-	va_end(va);
+			_key_slots[slot] = (uint8_t)k;
+		}
 
-	if (ret < 0)
-		return NULL;
+		if (k == IPC_KEY_COUNT) {
+			_key_seed = seed;
+			return;
+		}
+	}
 
+	/* IPC_KEYS has outgrown KEY_SLOTS, every lookup would misdecode */
+	fprintf(stderr, "ipc: _key_table_init: no seed fits %d keys in %u slots\n", IPC_KEY_COUNT - 1, KEY_SLOTS);
+	abort();
+}
 
-	const size_t str_len = ((size_t)ret) + 1;
-	char *const str = malloc(sizeof(char) * str_len);
-	if (str == NULL)
-		return NULL;
 
-	va_start(va, fmt);
-	ret = vsnprintf(str, str_len, fmt, va);
-	va_end(va);
+static uint32_t
+_key_hash(const char str[], size_t len, uint32_t seed)
+{
+	const uint32_t x = ((uint32_t)len) | ((uint32_t)(unsigned char)str[0] << 8) |
+			   ((uint32_t)(unsigned char)str[len / 2] << 16) |
+			   ((uint32_t)(unsigned char)str[len - 1] << 24);
 
-	if (ret < 0) {
-		free(str);
-		return NULL;
-	}
+	return (x * seed) >> (32 - KEY_SLOTS_BITS);
+}
+
+
+static int
+_key_find(const json_string_t *name)
+{
+	const size_t len = name->string_size;
+	if (len == 0)
+		return IPC_KEY_NONE;
+
+	const int key = _key_slots[_key_hash(name->string, len, _key_seed)];
+	if ((_keys[key].len != len) || (memcmp(_keys[key].str, name->string, len) != 0))
+		return IPC_KEY_NONE;
 
-	str[ret] = '\0';
-	return str;
+	return key;
 }
 
 
 static int
-_parse_json(json_value_t **json_obj, const char json[], size_t len)
+_writer_init(Writer *w, size_t size)
 {
-	int ret = IPC_PARSE_SUCCESS;
-	json_parse_result_t res;
-	json_value_t *const jsp = json_parse_ex(json, len, json_parse_flags_default, NULL, NULL, &res);
-	if (jsp == NULL) {
-		assert(res.error != json_parse_error_none);
-		switch (res.error) {
-		case json_parse_error_expected_comma_or_closing_bracket: ret = IPC_PARSE_EPART; break;
-		case json_parse_error_allocator_failed: ret = IPC_PARSE_ENOMEM; break;
-		default: ret = IPC_PARSE_EINVAL; break;
+	w->str = malloc(size);
+	if (w->str == NULL)
+		return -1;
+
+	w->len = 0;
+	w->size = size;
+	w->is_err = 0;
+	return 0;
+}
+
+
+static void
+_writer_raw(Writer *w, const char str[], size_t len)
+{
+	if (w->is_err)
+		return;
+
+	/* keep one byte for the terminating '\0' */
+	if ((w->len + len) >= w->size) {
+		size_t size = w->size * 2;
+		while ((w->len + len) >= size)
+			size *= 2;
+
+		char *const str = realloc(w->str, size);
+		if (str == NULL) {
+			w->is_err = 1;
+			return;
 		}
+
+		w->str = str;
+		w->size = size;
 	}
 
-	*json_obj = jsp;
-	return ret;
+	memcpy(w->str + w->len, str, len);
+	w->len += len;
 }
 
 
 static void
-_parse_message(char message[], const json_object_t *body)
-{
-	size_t msg_len = 0;
-	if ((body != NULL) && (body->length == 1)) {
-		const json_object_element_t *const body_o = body->start;
-		if (strcmp(body_o->name->string, "message") == 0) {
-			const json_string_t *const msg_o = json_value_as_string(body_o->value);
-			if (msg_o != NULL) {
-				msg_len = msg_o->string_size;
-				if (msg_len >= IPC_MESSAGE_SIZE)
-					msg_len = IPC_MESSAGE_SIZE - 1;
-
-				memcpy(message, msg_o->string, msg_len);
-			}
+_writer_str(Writer *w, const char str[], size_t len)
+{
+	static const char hex[] = "0123456789abcdef";
+
+	_writer_lit(w, "\"");
+
+	size_t start = 0;
+	for (size_t i = 0; i < len; i++) {
+		const unsigned char c = (unsigned char)str[i];
+		if ((c >= 0x20) && (c != '"') && (c != '\\'))
+			continue;
+
+		_writer_raw(w, str + start, i - start);
+		start = i + 1;
+
+		switch (c) {
+		case '"': _writer_lit(w, "\\\""); break;
+		case '\\': _writer_lit(w, "\\\\"); break;
+		case '\n': _writer_lit(w, "\\n"); break;
+		case '\r': _writer_lit(w, "\\r"); break;
+		case '\t': _writer_lit(w, "\\t"); break;
+		default: {
+			const char esc[6] = { '\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xf] };
+			_writer_raw(w, esc, sizeof(esc));
+			break;
+		}
 		}
 	}
 
-	message[msg_len] = '\0';
+	_writer_raw(w, str + start, len - start);
+	_writer_lit(w, "\"");
 }
 
 
-static int
-_parse_status(IpcBodyStatus *s, const json_object_t *body)
+static void
+_writer_num(Writer *w, unsigned long long num)
 {
-	if (body->length != 3)
-		return IPC_PARSE_EINVAL;
+	char buffer[IPC_UINT_STR_MAX];
+	_writer_raw(w, buffer, ipc_uint_to_str(buffer, num));
+}
 
-	for (const json_object_element_t *e = body->start; (e != NULL); e = e->next) {
-		const json_number_t *num;
-		const char *const name = e->name->string;
-		if (strcmp(name, "cpu_cores") == 0) {
-			num = json_value_as_number(e->value);
-			if (num == NULL)
-				return IPC_PARSE_EINVAL;
 
-			s->cpu_cores = (unsigned)atoi(num->number);
-		} else if (strcmp(name, "memory_usage") == 0) {
-			num = json_value_as_number(e->value);
-			if (num == NULL)
-				return IPC_PARSE_EINVAL;
+static void
+_writer_key(Writer *w, const char **sep, const char key[], size_t len)
+{
+	_writer_raw(w, *sep, strlen(*sep));
+	_writer_raw(w, key, len);
+	*sep = ",";
+}
 
-			s->memory_usage = (size_t)atoi(num->number);
-		} else if (strcmp(name, "memory_capacity") == 0) {
-			num = json_value_as_number(e->value);
-			if (num == NULL)
-				return IPC_PARSE_EINVAL;
 
-			s->memory_capacity = (size_t)atoi(num->number);
-		}
+static char *
+_writer_finish(Writer *w)
+{
+	if (w->is_err) {
+		free(w->str);
+		return NULL;
 	}
 
-	return IPC_PARSE_SUCCESS;
+	w->str[w->len] = '\0';
+	return w->str;
+}
+
+
+/* without the closing '}', "id" goes in front of the body or in the tail */
+static void
+_build_response(Writer *w, const IpcResponse *r, int with_id)
+{
+	_writer_lit(w, "{\"code\":");
+	_writer_num(w, (unsigned long long)r->code);
+	_writer_lit(w, ",\"request_code\":");
+	_writer_num(w, (unsigned long long)r->request_code);
+
+	/* old clients expect exactly "code", "request_code" and "body" */
+	if (with_id && (r->id != 0)) {
+		_writer_lit(w, ",\"id\":");
+		_writer_num(w, r->id);
+	}
+
+	_writer_lit(w, ",\"body\":");
+
+	if (r->code != IPC_RES_OK) {
+		_build_body_msg(w, &r->msg, r->fields);
+	} else {
+		switch (r->request_code) {
+#define RES_BUILD(NAME, name, req, res) case IPC_REQ_##NAME: _build_body_##res(w, &r->res, r->fields); break;
+		IPC_REQUESTS(RES_BUILD)
+#undef RES_BUILD
+		default: _writer_lit(w, "{}"); break;
+		}
+	}
 }
 
+
+/* "p" NULL: there is no body */
+static int
+_pull_response_body(IpcResponse *r, int code, int request_code, json_pull_t *p, int event, IpcArena *arena)
+{
+	if (code != IPC_RES_OK)
+		return _pull_body_msg(&r->msg, &r->fields, p, event, arena);
+
+	switch (request_code) {
+#define RES_PULL(NAME, name, req, res) \
+	case IPC_REQ_##NAME: return _pull_body_##res(&r->res, &r->fields, p, event, arena);
+	IPC_REQUESTS(RES_PULL)
+#undef RES_PULL
+	}
+
+	/* of a request this side does not know */
+	if ((p != NULL) && (_pull_skip(p, event) < 0))
+		return IPC_PARSE_EINVAL;
+
+	return _pull_body_msg(&r->msg, &r->fields, NULL, event, arena);
+}
+
+
+static void *
+_arena_alloc(void *arena, size_t size)
+{
+	IpcArena *const a = arena;
+	const size_t align = _Alignof(max_align_t);
+	const size_t start = (a->used + align - 1) & ~(align - 1);
+
+	void *ret;
+	if ((start <= a->size) && (size <= a->size - start)) {
+		ret = a->base + start;
+		a->used = start + size;
+	} else {
+		Spill *const s = malloc(sizeof(Spill) + size);
+		if (s == NULL)
+			return NULL;
+
+		s->next = a->spills;
+		a->spills = s;
+		a->used = start + size;
+		ret = s->data;
+	}
+
+	if (a->used > a->high_water)
+		a->high_water = a->used;
+
+	return ret;
+}
+
+
+static size_t
+_skip_space(const char str[], size_t len, size_t i)
+{
+	while ((i < len) && ((str[i] == ' ') || (str[i] == '\t') || (str[i] == '\n') || (str[i] == '\r')))
+		i++;
+
+	return i;
+}
+
+
+/* trims the element in "json[start..end)", an empty one is an error */
+static int
+_batch_span(IpcSpan spans[], size_t max, size_t *count, const char json[], size_t start, size_t end)
+{
+	start = _skip_space(json, end, start);
+	while ((end > start) && (_skip_space(json, end, end - 1) == end))
+		end--;
+
+	if (start == end)
+		return -1;
+
+	if (*count < max)
+		spans[*count] = (IpcSpan) { .off = start, .len = end - start };
+
+	(*count)++;
+	return 0;
+}
+
+
+static int
+_parse_json(json_value_t **json_obj, char json[], size_t len, IpcArena *arena)
+{
+	int ret = IPC_PARSE_SUCCESS;
+	json_parse_result_t res;
+	/* strings are decoded over "json" and used from there, see _dec_str() */
+	const size_t flags = json_parse_flags_single_pass | json_parse_flags_in_situ;
+	json_value_t *const jsp = json_parse_ex(json, len, flags, (arena != NULL) ? _arena_alloc : NULL, arena,
+						&res);
+	if (jsp == NULL) {
+		assert(res.error != json_parse_error_none);
+		switch (res.error) {
+		case json_parse_error_expected_comma_or_closing_bracket: ret = IPC_PARSE_EPART; break;
+		case json_parse_error_allocator_failed: ret = IPC_PARSE_ENOMEM; break;
+		default: ret = IPC_PARSE_EINVAL; break;
+		}
+	}
+
+	*json_obj = jsp;
+	return ret;
+}
+
+
+static void
+_free_json(json_value_t *json_obj, IpcArena *arena)
+{
+	/* arena memory goes with the next ipc_arena_reset() */
+	if (arena == NULL)
+		free(json_obj);
+}
+
+
+static int
+_parse_number(unsigned long long *num, json_value_t *value)
+{
+	const json_number_t *const n = json_value_as_number(value);
+	if (n == NULL)
+		return -1;
+
+	return _parse_digits(num, n->number, n->number_size);
+}
+
+
+/* non-negative integers only */
+static int
+_parse_digits(unsigned long long *num, const char str[], size_t len)
+{
+	if ((len == 0) || (len > 20))
+		return -1;
+
+	unsigned long long ret = 0;
+	for (size_t i = 0; i < len; i++) {
+		const unsigned d = (unsigned)(str[i] - '0');
+		if (d > 9)
+			return -1;
+
+		if (ret > ((~0ull - d) / 10))
+			return -1;
+
+		ret = (ret * 10) + d;
+	}
+
+	*num = ret;
+	return 0;
+}
+
+
+static void
+_enc_uint(Writer *w, const unsigned *v)
+{
+	_writer_num(w, *v);
+}
+
+
+static void
+_enc_u64(Writer *w, const uint64_t *v)
+{
+	_writer_num(w, *v);
+}
+
+
+static void
+_enc_size(Writer *w, const size_t *v)
+{
+	_writer_num(w, *v);
+}
+
+
+static void
+_enc_str(Writer *w, const IpcStr *v)
+{
+	_writer_str(w, v->str, v->len);
+}
+
+
+static void
+_enc_keys(Writer *w, const uint64_t *v)
+{
+	const char *sep = "";
+	_writer_lit(w, "[");
+	for (int k = IPC_KEY_NONE + 1; k < IPC_KEY_COUNT; k++) {
+		if ((*v & (1ull << k)) == 0)
+			continue;
+
+		_writer_raw(w, sep, strlen(sep));
+		_writer_str(w, _keys[k].str, _keys[k].len);
+		sep = ",";
+	}
+	_writer_lit(w, "]");
+}
+
+
+static void
+_enc_pct(Writer *w, const unsigned *v)
+{
+	char buffer[IPC_UINT_STR_MAX + 3];
+	size_t len = ipc_uint_to_str(buffer, *v / 100);
+
+	/* without the trailing zeros: "12.5", "12" */
+	const unsigned frac = *v % 100;
+	if (frac != 0) {
+		buffer[len++] = '.';
+		buffer[len++] = _digit_pairs[frac * 2];
+		if ((frac % 10) != 0)
+			buffer[len++] = _digit_pairs[(frac * 2) + 1];
+	}
+
+	_writer_raw(w, buffer, len);
+}
+
+
+/* the total, it has no id */
+static void
+_enc_cpu(Writer *w, const IpcCpu *v)
+{
+	_build_body_cpu(w, v, IPC_FIELDS_ALL(IPC_CPU) & ~IPC_FIELD(id));
+}
+
+
+static void
+_enc_cpus(Writer *w, const IpcCpus *v)
+{
+	_writer_lit(w, "[");
+	for (unsigned i = 0; i < v->len; i++) {
+		if (i > 0)
+			_writer_lit(w, ",");
+
+		_build_body_cpu(w, &v->list[i], 0);
+	}
+	_writer_lit(w, "]");
+}
+
+
+static void
+_enc_samples(Writer *w, const IpcSamples *v)
+{
+	_writer_lit(w, "[");
+	for (unsigned i = 0; i < (v->len + v->wrap_len); i++) {
+		if (i > 0)
+			_writer_lit(w, ",");
+
+		_build_body_sample(w, (i < v->len) ? &v->list[i] : &v->wrap[i - v->len], 0);
+	}
+	_writer_lit(w, "]");
+}
+
+
+static void
+_enc_procs(Writer *w, const IpcProcs *v)
+{
+	_writer_lit(w, "[");
+	for (unsigned i = 0; i < v->len; i++) {
+		if (i > 0)
+			_writer_lit(w, ",");
+
+		_build_body_proc(w, &v->list[i], 0);
+	}
+	_writer_lit(w, "]");
+}
+
+
+static int
+_dec_u64(uint64_t *v, json_value_t *value, IpcArena *arena)
+{
+	unsigned long long num;
+	if (_parse_number(&num, value) < 0)
+		return -1;
+
+	(void)arena;
+	*v = (uint64_t)num;
+	return 0;
+}
+
+
+static int
+_dec_uint(unsigned *v, json_value_t *value, IpcArena *arena)
+{
+	unsigned long long num;
+	if ((_parse_number(&num, value) < 0) || (num > (unsigned)-1))
+		return -1;
+
+	(void)arena;
+	*v = (unsigned)num;
+	return 0;
+}
+
+
+static int
+_dec_size(size_t *v, json_value_t *value, IpcArena *arena)
+{
+	unsigned long long num;
+	if ((_parse_number(&num, value) < 0) || (num > SIZE_MAX))
+		return -1;
+
+	(void)arena;
+	*v = (size_t)num;
+	return 0;
+}
+
+
+/* in situ parsing leaves the decoded string in the source buffer */
+static int
+_dec_str(IpcStr *v, json_value_t *value, IpcArena *arena)
+{
+	const json_string_t *const str = json_value_as_string(value);
+	if (str == NULL)
+		return -1;
+
+	(void)arena;
+	v->str = str->string;
+	v->len = str->string_size;
+	return 0;
+}
+
+
+/* names this side does not know are skipped, a newer peer may ask for more */
+static int
+_dec_keys(uint64_t *v, json_value_t *value, IpcArena *arena)
+{
+	const json_array_t *const arr = json_value_as_array(value);
+	if (arr == NULL)
+		return -1;
+
+	uint64_t keys = 0;
+	const json_array_element_t *e = arr->start;
+	for (; e != NULL; e = e->next) {
+		const json_string_t *const name = json_value_as_string(e->value);
+		if (name == NULL)
+			return -1;
+
+		const int key = _key_find(name);
+		if (key != IPC_KEY_NONE)
+			keys |= 1ull << key;
+	}
+
+	(void)arena;
+	*v = keys;
+	return 0;
+}
+
+
+static int
+_dec_pct(unsigned *v, json_value_t *value, IpcArena *arena)
+{
+	const json_number_t *const n = json_value_as_number(value);
+	if (n == NULL)
+		return -1;
+
+	(void)arena;
+	return _parse_pct(v, n->number, n->number_size);
+}
+
+
+/* digits past the hundredths are dropped */
+static int
+_parse_pct(unsigned *v, const char str[], size_t len)
+{
+	if (len == 0)
+		return -1;
+
+	unsigned long long ret = 0;
+	int frac = -1;
+	for (size_t i = 0; i < len; i++) {
+		if ((str[i] == '.') && (frac < 0) && (i > 0)) {
+			frac = 0;
+			continue;
+		}
+
+		const unsigned d = (unsigned)(str[i] - '0');
+		if (d > 9)
+			return -1;
+
+		if (frac >= 2)
+			continue;
+
+		ret = (ret * 10) + d;
+		if (ret > (unsigned)-1)
+			return -1;
+
+		if (frac >= 0)
+			frac++;
+	}
+
+	for (int i = (frac < 0) ? 0 : frac; i < 2; i++)
+		ret *= 10;
+
+	if (ret > (unsigned)-1)
+		return -1;
+
+	*v = (unsigned)ret;
+	return 0;
+}
+
+
+static int
+_dec_cpu(IpcCpu *v, json_value_t *value, IpcArena *arena)
+{
+	const json_object_t *const obj = json_value_as_object(value);
+	if (obj == NULL)
+		return -1;
+
+	uint64_t fields;
+	return _parse_body_cpu(v, &fields, obj, arena);
+}
+
+
+static int
+_dec_cpus(IpcCpus *v, json_value_t *value, IpcArena *arena)
+{
+	const json_array_t *const arr = json_value_as_array(value);
+	if ((arr == NULL) || (arena == NULL))
+		return -1;
+
+	IpcCpu *const list = _arena_alloc(arena, sizeof(IpcCpu) * (arr->length + 1));
+	if (list == NULL)
+		return -1;
+
+	unsigned len = 0;
+	const json_array_element_t *e = arr->start;
+	for (; e != NULL; e = e->next) {
+		if (_dec_cpu(&list[len++], e->value, arena) < 0)
+			return -1;
+	}
+
+	v->len = len;
+	v->list = list;
+	return 0;
+}
+
+
+static int
+_dec_samples(IpcSamples *v, json_value_t *value, IpcArena *arena)
+{
+	const json_array_t *const arr = json_value_as_array(value);
+	if ((arr == NULL) || (arena == NULL))
+		return -1;
+
+	IpcSample *const list = _arena_alloc(arena, sizeof(IpcSample) * (arr->length + 1));
+	if (list == NULL)
+		return -1;
+
+	unsigned len = 0;
+	const json_array_element_t *e = arr->start;
+	for (; e != NULL; e = e->next) {
+		const json_object_t *const obj = json_value_as_object(e->value);
+		uint64_t fields;
+		if ((obj == NULL) || (_parse_body_sample(&list[len++], &fields, obj, arena) < 0))
+			return -1;
+	}
+
+	*v = (IpcSamples) { .len = len, .list = list };
+	return 0;
+}
+
+
+static int
+_dec_procs(IpcProcs *v, json_value_t *value, IpcArena *arena)
+{
+	const json_array_t *const arr = json_value_as_array(value);
+	if ((arr == NULL) || (arena == NULL))
+		return -1;
+
+	IpcProc *const list = _arena_alloc(arena, sizeof(IpcProc) * (arr->length + 1));
+	if (list == NULL)
+		return -1;
+
+	unsigned len = 0;
+	const json_array_element_t *e = arr->start;
+	for (; e != NULL; e = e->next) {
+		const json_object_t *const obj = json_value_as_object(e->value);
+		uint64_t fields;
+		if ((obj == NULL) || (_parse_body_proc(&list[len++], &fields, obj, arena) < 0))
+			return -1;
+	}
+
+	*v = (IpcProcs) { .len = len, .list = list };
+	return 0;
+}
+
+
+static int
+_pull_key(const json_pull_t *p)
+{
+	const json_string_t name = { .string = p->value, .string_size = p->value_size };
+	return _key_find(&name);
+}
+
+
+/* the value "event" starts, whole: of a key this side does not know */
+static int
+_pull_skip(json_pull_t *p, int event)
+{
+	unsigned depth = 0;
+	for (;;) {
+		switch (event) {
+		case json_pull_object_start:
+		case json_pull_array_start:
+			depth++;
+			break;
+		case json_pull_object_end:
+		case json_pull_array_end:
+			if (depth == 0)
+				return -1;
+
+			depth--;
+			break;
+		case json_pull_key:
+		case json_pull_string:
+		case json_pull_number:
+		case json_pull_true:
+		case json_pull_false:
+		case json_pull_null:
+			break;
+		default:
+			return -1;
+		}
+
+		if (depth == 0)
+			return 0;
+
+		event = json_pull_next(p);
+	}
+}
+
+
+/* a pulled list comes without its length: copied to one twice the size
+ * when full, the arena takes them all back at once */
+static void *
+_pull_grow(void *list, unsigned len, unsigned *size, size_t item, IpcArena *arena)
+{
+	const unsigned grown = (*size == 0) ? 16 : (*size * 2);
+	void *const ret = _arena_alloc(arena, item * grown);
+	if (ret == NULL)
+		return NULL;
+
+	if (len > 0)
+		memcpy(ret, list, item * len);
+
+	*size = grown;
+	return ret;
+}
+
+
+static int
+_pull_u64(uint64_t *v, json_pull_t *p, int event, IpcArena *arena)
+{
+	unsigned long long num;
+	if ((event != json_pull_number) || (_parse_digits(&num, p->value, p->value_size) < 0))
+		return -1;
+
+	(void)arena;
+	*v = (uint64_t)num;
+	return 0;
+}
+
+
+static int
+_pull_uint(unsigned *v, json_pull_t *p, int event, IpcArena *arena)
+{
+	unsigned long long num;
+	if ((event != json_pull_number) || (_parse_digits(&num, p->value, p->value_size) < 0) ||
+	    (num > (unsigned)-1))
+		return -1;
+
+	(void)arena;
+	*v = (unsigned)num;
+	return 0;
+}
+
+
+static int
+_pull_size(size_t *v, json_pull_t *p, int event, IpcArena *arena)
+{
+	unsigned long long num;
+	if ((event != json_pull_number) || (_parse_digits(&num, p->value, p->value_size) < 0) ||
+	    (num > SIZE_MAX))
+		return -1;
+
+	(void)arena;
+	*v = (size_t)num;
+	return 0;
+}
+
+
+/* decoded in place like _dec_str(), it lives as long as the source buffer */
+static int
+_pull_str(IpcStr *v, json_pull_t *p, int event, IpcArena *arena)
+{
+	if (event != json_pull_string)
+		return -1;
+
+	(void)arena;
+	v->str = p->value;
+	v->len = p->value_size;
+	return 0;
+}
+
+
+static int
+_pull_keys(uint64_t *v, json_pull_t *p, int event, IpcArena *arena)
+{
+	if (event != json_pull_array_start)
+		return -1;
+
+	uint64_t keys = 0;
+	while ((event = json_pull_next(p)) != json_pull_array_end) {
+		if (event != json_pull_string)
+			return -1;
+
+		const int key = _pull_key(p);
+		if (key != IPC_KEY_NONE)
+			keys |= 1ull << key;
+	}
+
+	(void)arena;
+	*v = keys;
+	return 0;
+}
+
+
+static int
+_pull_pct(unsigned *v, json_pull_t *p, int event, IpcArena *arena)
+{
+	if (event != json_pull_number)
+		return -1;
+
+	(void)arena;
+	return _parse_pct(v, p->value, p->value_size);
+}
+
+
+static int
+_pull_cpu(IpcCpu *v, json_pull_t *p, int event, IpcArena *arena)
+{
+	uint64_t fields;
+	return (_pull_body_cpu(v, &fields, p, event, arena) == IPC_PARSE_SUCCESS) ? 0 : -1;
+}
+
+
+static int
+_pull_cpus(IpcCpus *v, json_pull_t *p, int event, IpcArena *arena)
+{
+	if ((event != json_pull_array_start) || (arena == NULL))
+		return -1;
+
+	IpcCpu *list = NULL;
+	unsigned len = 0;
+	unsigned size = 0;
+	while ((event = json_pull_next(p)) != json_pull_array_end) {
+		if ((len == size) && ((list = _pull_grow(list, len, &size, sizeof(IpcCpu), arena)) == NULL))
+			return -1;
+
+		if (_pull_cpu(&list[len++], p, event, arena) < 0)
+			return -1;
+	}
+
+	v->len = len;
+	v->list = list;
+	return 0;
+}
+
+
+static int
+_pull_samples(IpcSamples *v, json_pull_t *p, int event, IpcArena *arena)
+{
+	if ((event != json_pull_array_start) || (arena == NULL))
+		return -1;
+
+	IpcSample *list = NULL;
+	unsigned len = 0;
+	unsigned size = 0;
+	while ((event = json_pull_next(p)) != json_pull_array_end) {
+		if ((len == size) && ((list = _pull_grow(list, len, &size, sizeof(IpcSample), arena)) == NULL))
+			return -1;
+
+		uint64_t fields;
+		if (_pull_body_sample(&list[len++], &fields, p, event, arena) != IPC_PARSE_SUCCESS)
+			return -1;
+	}
+
+	*v = (IpcSamples) { .len = len, .list = list };
+	return 0;
+}
+
+
+static int
+_pull_procs(IpcProcs *v, json_pull_t *p, int event, IpcArena *arena)
+{
+	if ((event != json_pull_array_start) || (arena == NULL))
+		return -1;
+
+	IpcProc *list = NULL;
+	unsigned len = 0;
+	unsigned size = 0;
+	while ((event = json_pull_next(p)) != json_pull_array_end) {
+		if ((len == size) && ((list = _pull_grow(list, len, &size, sizeof(IpcProc), arena)) == NULL))
+			return -1;
+
+		uint64_t fields;
+		if (_pull_body_proc(&list[len++], &fields, p, event, arena) != IPC_PARSE_SUCCESS)
+			return -1;
+	}
+
+	*v = (IpcProcs) { .len = len, .list = list };
+	return 0;
+}
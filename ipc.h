@@ -3,13 +3,25 @@
 
 
 #include <stddef.h>
+#include <stdint.h>
 
 
 /* request format:
  *
  * {
- * 	"code": REQ_TYPE
+ * 	"code": REQ_TYPE,
+ * 	"id": NUM,
+ * 	"body": {
+ * 		...
+ * 	}
  * }
+ *
+ * "id" and "body" are optional: "id" is echoed back in the response so
+ * responses can arrive out of order, "body" is only sent when the request
+ * carries fields.
+ *
+ * A batch is an array of requests, "[REQUEST, ...]", each element is
+ * answered on its own. Batches need a negotiated framing.
  */
 
 /* response format:
@@ -17,26 +29,301 @@
  * {
  * 	"code": RES_TYPE,
  * 	"request_code": REQ_TYPE,
+ * 	"id": NUM,
  * 	"body": {
  * 		...
  * 	}
- *
- * body: Status
- * {
- * 	"cpu_cores": NUM,
- * 	"mem_usage": NUM,
- * 	"mem_capacity": NUM
  * }
+ *
+ * The bodies are described by the schema below.
+ */
+
+/* framing:
+ *
+ * A connection starts in the legacy mode: one '\0' terminated request, one
+ * response terminated by closing the connection. A hello carrying
+ * capabilities is answered with a '\0' terminated response, after that both
+ * sides switch to the negotiated framing and the connection stays open:
+ *
+ * IPC_FRAMING_NUL:    JSON '\0'
+ * IPC_FRAMING_LENGTH: u32 (big endian) length, JSON
  */
 
 
-#define IPC_MESSAGE_SIZE (256)
+#define IPC_FRAME_HEAD_SIZE (4)
+#define IPC_FRAME_SIZE_MAX  (1u << 20)
+
+
+/*
+ * Schema
+ *
+ * Every key that may appear on the wire, every body and every request is
+ * declared exactly once here. ipc.c expands these tables into the body
+ * structs, the encoders, the decoders and the key lookup table, so adding a
+ * command or a field needs no hand-written building or parsing.
+ */
+
+/* X(key) */
+#define IPC_KEYS(X)        \
+	X(code)            \
+	X(request_code)    \
+	X(id)              \
+	X(body)            \
+	X(message)         \
+	X(encodings)       \
+	X(framing)         \
+	X(compression)     \
+	X(max_frame)       \
+	X(shm)             \
+	X(fields)          \
+	X(cpu_cores)       \
+	X(memory_usage)    \
+	X(memory_capacity) \
+	X(cpu)             \
+	X(cpus)            \
+	X(user)            \
+	X(system)          \
+	X(iowait)          \
+	X(steal)           \
+	X(freq)            \
+	X(from)            \
+	X(to)              \
+	X(step)            \
+	X(samples)         \
+	X(time)            \
+	X(memory_min)      \
+	X(memory_avg)      \
+	X(memory_max)      \
+	X(cpu_min)         \
+	X(cpu_avg)         \
+	X(cpu_max)         \
+	X(interval)        \
+	X(count)           \
+	X(version)         \
+	X(base)            \
+	X(delta)           \
+	X(above)           \
+	X(below)           \
+	X(clear)           \
+	X(value)           \
+	X(by_rss)          \
+	X(by_cpu)          \
+	X(pid)             \
+	X(name)            \
+	X(rss)
+
+/* X(kind, key): "kind" selects the C type (IPC_FIELD_DECL_<kind>) and the codec */
+#define IPC_BODY_NONE(X)
+
+#define IPC_BODY_MSG(X) \
+	X(str, message)
+
+/* request: the supported sets, reply: the chosen one (a single bit each) */
+#define IPC_BODY_HELLO(X)         \
+	X(str,  message)          \
+	X(uint, encodings)        \
+	X(uint, framing)          \
+	X(uint, compression)      \
+	X(size, max_frame)        \
+	X(uint, shm)
+
+/* the body keys wanted in the reply, none: all of them */
+#define IPC_BODY_QUERY(X) \
+	X(keys, fields)
+
+/* "version": of the sample, 0: collected on request. "base": only in a delta,
+ * the version it applies to, the cpus in it replace the ones with their ids */
+#define IPC_BODY_STATUS(X)        \
+	X(uint, cpu_cores)        \
+	X(size, memory_usage)     \
+	X(size, memory_capacity)  \
+	X(cpu,  cpu)              \
+	X(cpus, cpus)             \
+	X(u64,  version)          \
+	X(u64,  base)
+
+/* the share of the time since the previous sample, "id" is not sent for the
+ * total. "freq" in MHz, 0: unknown */
+#define IPC_CPU(X)                \
+	X(uint, id)               \
+	X(pct,  user)             \
+	X(pct,  system)           \
+	X(pct,  iowait)           \
+	X(pct,  steal)            \
+	X(uint, freq)
+
+/* ms since the epoch, 0 "to": now. "step": the coarsest resolution wanted
+ * in ms, 0: the finest that holds "from" */
+#define IPC_BODY_RANGE(X)         \
+	X(u64,  from)             \
+	X(u64,  to)               \
+	X(uint, step)
+
+/* "step": the resolution answered with, in ms */
+#define IPC_BODY_HISTORY(X)       \
+	X(uint,    step)          \
+	X(samples, samples)
+
+/* one point of a history: the samples taken in [time, time + step), cpu is
+ * user + system */
+#define IPC_SAMPLE(X)             \
+	X(u64,  time)             \
+	X(size, memory_min)       \
+	X(size, memory_avg)       \
+	X(size, memory_max)       \
+	X(pct,  cpu_min)          \
+	X(pct,  cpu_avg)          \
+	X(pct,  cpu_max)
+
+/* status pushed every "interval" ms, rounded up to whole samples, "count"
+ * times (0: until the connection ends). 0 "interval": stop. "delta": push
+ * only what changed since the previous push, full ones now and then,
+ * resuming from "version" when the server still knows it */
+#define IPC_BODY_SUBSCRIBE(X)     \
+	X(uint, interval)         \
+	X(uint, count)            \
+	X(uint, delta)            \
+	X(u64,  version)
+
+/* a condition on one status value, "fields" holds its key: cpu_cores,
+ * memory_usage, memory_capacity, cpu (user + system of the total), user,
+ * system, iowait or steal. It fires once the value goes "above" or "below"
+ * the threshold (cpu ones in hundredths of a percent), and again only after
+ * it came back past "clear" (default: the threshold). No "fields": stop the
+ * watch with this id */
+#define IPC_BODY_WATCH(X)         \
+	X(keys, fields)           \
+	X(u64,  above)            \
+	X(u64,  below)            \
+	X(u64,  clear)
+
+/* a watch firing, with its request's id: "message" is "above" or "below",
+ * "time" the one of the sample. Only "message" in the reply to the watch */
+#define IPC_BODY_ALERT(X)         \
+	X(str,  message)          \
+	X(u64,  value)            \
+	X(u64,  time)
+
+/* at most "count" entries a list, 0: all there are */
+#define IPC_BODY_LIMIT(X)         \
+	X(uint, count)
+
+/* the processes using the most memory and cpu, of the "count" seen by the
+ * scan ending at "time", most first */
+#define IPC_BODY_TOP(X)           \
+	X(u64,   time)            \
+	X(uint,  count)           \
+	X(procs, by_rss)          \
+	X(procs, by_cpu)
+
+/* "rss" in bytes, "cpu" the share of one cpu since the previous scan, since
+ * the start of the process for one not seen before */
+#define IPC_PROC(X)               \
+	X(uint, pid)              \
+	X(str,  name)             \
+	X(size, rss)              \
+	X(pct,  cpu)
+
+/* X(tag, Type, FIELDS) */
+#define IPC_BODIES(X)                                       \
+	X(none,      IpcBodyNone,      IPC_BODY_NONE)       \
+	X(msg,       IpcBodyMsg,       IPC_BODY_MSG)        \
+	X(hello,     IpcBodyHello,     IPC_BODY_HELLO)      \
+	X(query,     IpcBodyQuery,     IPC_BODY_QUERY)      \
+	X(status,    IpcBodyStatus,    IPC_BODY_STATUS)     \
+	X(range,     IpcBodyRange,     IPC_BODY_RANGE)      \
+	X(history,   IpcBodyHistory,   IPC_BODY_HISTORY)    \
+	X(subscribe, IpcBodySubscribe, IPC_BODY_SUBSCRIBE)  \
+	X(watch,     IpcBodyWatch,     IPC_BODY_WATCH)      \
+	X(alert,     IpcBodyAlert,     IPC_BODY_ALERT)      \
+	X(limit,     IpcBodyLimit,     IPC_BODY_LIMIT)      \
+	X(top,       IpcBodyTop,       IPC_BODY_TOP)
+
+/* X(NAME, name, req, res): request code suffix, command name, body tags */
+#define IPC_REQUESTS(X)                              \
+	X(HELLO,     hello,     hello,     hello)    \
+	X(STATUS,    status,    query,     status)   \
+	X(SHUTDOWN,  shutdown,  none,      msg)      \
+	X(HISTORY,   history,   range,     history)  \
+	X(SUBSCRIBE, subscribe, subscribe, msg)      \
+	X(WATCH,     watch,     watch,     alert)    \
+	X(TOP,       top,       limit,     top)
+
+#define IPC_FIELD_DECL_uint(key) unsigned key;
+#define IPC_FIELD_DECL_u64(key)  uint64_t key;
+#define IPC_FIELD_DECL_size(key) size_t   key;
+#define IPC_FIELD_DECL_str(key)  IpcStr   key;
+#define IPC_FIELD_DECL_keys(key) uint64_t key;   /* a field mask, sent as an array of key names */
+#define IPC_FIELD_DECL_pct(key)  unsigned key;   /* hundredths of a percent, sent as "12.34" */
+#define IPC_FIELD_DECL_cpu(key)  IpcCpu   key;   /* an IPC_CPU object */
+#define IPC_FIELD_DECL_cpus(key) IpcCpus  key;   /* an array of them */
+#define IPC_FIELD_DECL_samples(key) IpcSamples key;   /* an array of IPC_SAMPLE objects */
+#define IPC_FIELD_DECL_procs(key)   IpcProcs   key;   /* an array of IPC_PROC objects */
+#define IPC_FIELD_DECL(kind, key) IPC_FIELD_DECL_##kind(key)
+
+/* body field masks, one bit per IPC_KEYS entry */
+#define IPC_FIELD(key)            (1ull << IPC_KEY_##key)
+#define IPC_FIELD_MASK(kind, key) | IPC_FIELD(key)
+#define IPC_FIELDS_ALL(FIELDS)    (0ull FIELDS(IPC_FIELD_MASK))
+
+
+/* a string view: not '\0' terminated, decoded ones point into the parsed
+ * buffer and live as long as it does */
+typedef struct {
+	const char *str;
+	size_t      len;
+} IpcStr;
+
+#define IPC_STR(lit) ((IpcStr) { .str = lit, .len = sizeof(lit) - 1 })
+
+typedef struct {
+	IPC_CPU(IPC_FIELD_DECL)
+} IpcCpu;
+
+/* decoded ones live in the parser's arena */
+typedef struct {
+	unsigned  len;
+	IpcCpu   *list;
+} IpcCpus;
+
+typedef struct {
+	IPC_SAMPLE(IPC_FIELD_DECL)
+} IpcSample;
+
+typedef struct {
+	IPC_PROC(IPC_FIELD_DECL)
+} IpcProc;
+
+/* decoded ones live in the parser's arena */
+typedef struct {
+	unsigned       len;
+	const IpcProc *list;
+} IpcProcs;
+
+/* "list" then "wrap": a slice of a ring is sent as it is, decoded ones have no
+ * "wrap" and live in the parser's arena */
+typedef struct {
+	unsigned         len;
+	const IpcSample *list;
+	unsigned         wrap_len;
+	const IpcSample *wrap;
+} IpcSamples;
+
+
+enum {
+	IPC_KEY_NONE = 0,
+#define IPC_KEY_ENUM(key) IPC_KEY_##key,
+	IPC_KEYS(IPC_KEY_ENUM)
+#undef IPC_KEY_ENUM
+	IPC_KEY_COUNT,
+};
 
 
 enum {
-	IPC_REQ_HELLO = 1,
-	IPC_REQ_STATUS,
-	IPC_REQ_SHUTDOWN,
+	IPC_REQ_NONE = 0,
+#define IPC_REQ_ENUM(NAME, name, req, res) IPC_REQ_##NAME,
+	IPC_REQUESTS(IPC_REQ_ENUM)
+#undef IPC_REQ_ENUM
 
 	/* -------------------------------- */
 
@@ -47,6 +334,21 @@ enum {
 	IPC_RES_ERR_UNKNOWN,
 };
 
+/* capability sets, the higher bit is preferred */
+enum {
+	IPC_ENCODING_JSON = (1 << 0),
+};
+
+enum {
+	IPC_FRAMING_LEGACY = 0,
+	IPC_FRAMING_NUL    = (1 << 0),
+	IPC_FRAMING_LENGTH = (1 << 1),
+};
+
+enum {
+	IPC_COMPRESSION_NONE = (1 << 0),
+};
+
 enum {
 	IPC_PARSE_SUCCESS = 0,
 	IPC_PARSE_ENOMEM,
@@ -55,50 +357,132 @@ enum {
 };
 
 
+#define IPC_BODY_STRUCT(tag, Type, FIELDS) \
+	typedef struct {                   \
+		FIELDS(IPC_FIELD_DECL)     \
+	} Type;
+
+IPC_BODIES(IPC_BODY_STRUCT)
+#undef IPC_BODY_STRUCT
+
+
 /*
  * Helpers
  */
 const char *ipc_request_code_str(int code);
 const char *ipc_response_code_str(int code);
+const char *ipc_encoding_str(unsigned encoding);
+const char *ipc_framing_str(unsigned framing);
+const char *ipc_compression_str(unsigned compression);
+int         ipc_request_code_from_str(const char str[]);
+int         ipc_key_from_str(const char str[], size_t len);
+
+/* writes "num" in decimal, not '\0' terminated, returns the length */
+#define IPC_UINT_STR_MAX (20)
+size_t      ipc_uint_to_str(char buf[IPC_UINT_STR_MAX], unsigned long long num);
+
+
+/* pick one bit of each set, "local" holds what this side supports */
+int ipc_hello_negotiate(IpcBodyHello *res, const IpcBodyHello *req, const IpcBodyHello *local);
+
+
+/*
+ * Framing
+ */
+/* returns the header size, "head" must hold IPC_FRAME_HEAD_SIZE bytes */
+size_t ipc_frame_head(char head[], int framing, size_t len);
+
+/* returns 1 and the payload of the first frame in "buf", 0 if incomplete, -1 if invalid */
+int    ipc_frame_next(int framing, const char buf[], size_t len, size_t max, size_t *payload,
+		      size_t *payload_len, size_t *frame_len);
+
+
+/*
+ * Arena
+ */
+/* scratch memory for the parser, released as a whole by ipc_arena_reset().
+ * What does not fit is malloc'ed, the next reset grows the arena to the
+ * high-water mark, so a steady stream of messages stops allocating */
+typedef struct {
+	char   *base;
+	size_t  size;
+	size_t  used;         /* including the spills */
+	size_t  high_water;
+	void   *spills;
+} IpcArena;
+
+void ipc_arena_init(IpcArena *a);
+void ipc_arena_reset(IpcArena *a);
+void ipc_arena_deinit(IpcArena *a);
 
 
 /*
  * Request
  */
 typedef struct {
-	int code;
+	int      code;
+	unsigned id;       /* 0: not sent */
+	uint64_t fields;   /* body keys present, 0: no body */
+	union {
+#define IPC_BODY_MEMBER(tag, Type, FIELDS) Type tag;
+		IPC_BODIES(IPC_BODY_MEMBER)
+#undef IPC_BODY_MEMBER
+	};
 } IpcRequest;
 
-char *ipc_request_build_hello(void);
-char *ipc_request_build_status(void);
-char *ipc_request_build_shutdown(void);
-int   ipc_request_parse(IpcRequest *r, const char json[], size_t len);
+/* "json" may be modified in place, decoded strings point into it. "arena"
+ * may be NULL (malloc), else it holds the parser's memory until reset. Lists
+ * are decoded into the arena, without one they are invalid */
+char *ipc_request_build(const IpcRequest *r);
+int   ipc_request_parse(IpcRequest *r, char json[], size_t len, IpcArena *arena);
 
 
 /*
- * Response
+ * Batch
  */
+/* an element of a batch, relative to the batch */
 typedef struct {
-	unsigned cpu_cores;
-	size_t   memory_usage;
-	size_t   memory_capacity;
-} IpcBodyStatus;
+	size_t off;
+	size_t len;
+} IpcSpan;
+
+/* returns 1 if "json" is an array */
+int ipc_batch_is(const char json[], size_t len);
 
+/* stores at most "max" element spans, "count" is set to how many there are.
+ * Only strings and brackets are tracked, the elements are left to
+ * ipc_request_parse(). Returns -1 if the array is malformed */
+int ipc_batch_split(IpcSpan spans[], size_t max, size_t *count, const char json[], size_t len);
+
+
+/*
+ * Response
+ */
 typedef struct {
-	int code;
-	int request_code;
+	int      code;
+	int      request_code;
+	unsigned id;       /* the request's, 0: not sent */
+	uint64_t fields;   /* body keys present, 0: the whole body */
 	union {
-		IpcBodyStatus status;
-		char          message[IPC_MESSAGE_SIZE];
+#define IPC_BODY_MEMBER(tag, Type, FIELDS) Type tag;
+		IPC_BODIES(IPC_BODY_MEMBER)
+#undef IPC_BODY_MEMBER
 	};
 } IpcResponse;
 
-char *ipc_response_build_hello(void);
-char *ipc_response_build_status(const IpcBodyStatus *status);
-char *ipc_response_build_shutdown(void);
-char *ipc_response_build_error(int req, int res, const char message[]);
-int   ipc_response_parse(IpcResponse *r, const char json[], size_t len);
+/* the body is picked from the schema: "msg" for errors, else by request_code */
+char *ipc_response_build(const IpcResponse *r);
+char *ipc_response_build_error(int req, unsigned id, int res, const char message[]);
 
+/* a response encoded once and sent to many requests: the open part leaves
+ * out "id" and the closing '}', each request appends its ipc_response_tail() */
+#define IPC_RESPONSE_TAIL_MAX (7 + IPC_UINT_STR_MAX)
+char  *ipc_response_build_open(const IpcResponse *r);
+size_t ipc_response_tail(char tail[IPC_RESPONSE_TAIL_MAX], unsigned id);
 
-#endif
+/* like ipc_request_parse(), but pulled without a DOM: "body" must come after
+ * "code" and "request_code", as ipc_response_build() puts it */
+int   ipc_response_parse(IpcResponse *r, char json[], size_t len, IpcArena *arena);
 
+
+#endif
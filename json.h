@@ -122,6 +122,23 @@ enum json_parse_flags_e {
   /* allow multi line string values. */
   json_parse_flags_allow_multi_line_strings = 0x2000,
 
+  /* validate and build the DOM in a single pass over the input, into one
+     block sized from the input length. Only strict JSON (optionally with
+     location information) takes this path, other flags are parsed in two
+     passes as usual. */
+  json_parse_flags_single_pass = 0x4000,
+
+  /* decode strings in place: the source must be writable, quoted keys and
+     string values are unescaped over their own text and '\0' terminated where
+     the closing quote was, so json_string_s points into the source and the
+     allocation only holds the structure (and numbers). */
+  json_parse_flags_in_situ = 0x8000,
+
+  /* give objects with at least JSON_OBJECT_INDEX_MIN members a hash index of
+     their keys, so json_object_find() does not walk the element list. The
+     index lives in the same allocation as the rest of the DOM. */
+  json_parse_flags_index_objects = 0x10000,
+
   /* allow simplified JSON to be parsed. Simplified JSON is an enabling of a set
      of other parsing options. */
   json_parse_flags_allow_simplified_json =
@@ -182,6 +199,25 @@ json_extract_value_ex(const struct json_value_s *value,
 json_weak void *json_write_minified(const struct json_value_s *value,
                                     size_t *out_size);
 
+/* Write out a minified JSON utf-8 string into buffer, which holds buffer_size
+ * bytes. Returns the size the null terminated string needs: like snprintf,
+ * nothing is written when that is more than buffer_size, so a call with a 0
+ * buffer_size just measures. Returns 0 if the value was malformed. Performs no
+ * allocation. */
+json_weak size_t json_write_minified_into(const struct json_value_s *value,
+                                         void *buffer, size_t buffer_size);
+
+/* Write out a minified JSON utf-8 string in chunks: the output is gathered in
+ * buffer and handed to write_func each time buffer_size bytes are ready, and
+ * once more for the rest (not null terminated). Strings of any length are
+ * split over chunks, a number must fit in buffer_size. Returns 0 on success, 1
+ * if the value was malformed or write_func returned non-zero. Performs no
+ * allocation. */
+json_weak int json_write_minified_stream(
+    const struct json_value_s *value, void *buffer, size_t buffer_size,
+    int (*write_func)(void *user_data, const char *data, size_t size),
+    void *user_data);
+
 /* Write out a pretty JSON utf-8 string. This string is encoded such that the
  * resultant JSON is pretty in that it is easily human readable. The indent and
  * newline parameters allow a user to specify what kind of indentation and
@@ -224,6 +260,13 @@ json_weak int json_value_is_false(const struct json_value_s *const value);
 /* Whether the value is null. */
 json_weak int json_value_is_null(const struct json_value_s *const value);
 
+/* Find the first member of an object named name (name_size bytes, not
+ * necessarily null terminated). Uses the object's key index when it has one,
+ * else walks the elements. Returns null if there is no such member. */
+json_weak struct json_value_s *
+json_object_find(const struct json_object_s *const object, const char *name,
+                 size_t name_size);
+
 /* The various types JSON values can be. Used to identify what a value is. */
 typedef enum json_type_e {
   json_type_string,
@@ -281,12 +324,28 @@ typedef struct json_object_element_s {
 
 } json_object_element_t;
 
+/* the smallest object that json_parse_flags_index_objects gives an index. */
+#ifndef JSON_OBJECT_INDEX_MIN
+#define JSON_OBJECT_INDEX_MIN 8
+#endif
+
+/* an open addressing table of an object's elements, by key hash. */
+typedef struct json_object_index_s {
+  /* the number of slots minus one, the number of slots is a power of two. */
+  size_t mask;
+  /* the elements, null where a slot is empty. */
+  struct json_object_element_s **slots;
+
+} json_object_index_t;
+
 /* a JSON object value. */
 typedef struct json_object_s {
   /* a linked list of the elements in the object. */
   struct json_object_element_s *start;
   /* the number of elements in the object. */
   size_t length;
+  /* the key index (can be NULL, see json_parse_flags_index_objects). */
+  struct json_object_index_s *index;
 
 } json_object_t;
 
@@ -395,6 +454,80 @@ typedef struct json_parse_result_s {
 
 } json_parse_result_t;
 
+/* Pull parsing: reads one event at a time from input that arrives in chunks,
+ * without building a DOM. Memory stays constant, a token split between two
+ * chunks is gathered in the caller's token buffer and nesting is limited to
+ * JSON_PULL_MAX_DEPTH. Only strict JSON is accepted. Like
+ * json_parse_flags_in_situ, strings are decoded in place, in the chunk or in
+ * the token buffer. */
+#ifndef JSON_PULL_MAX_DEPTH
+#define JSON_PULL_MAX_DEPTH 64
+#endif
+
+enum json_pull_event_e {
+  /* the chunk is used up, feed the next one. */
+  json_pull_need_more,
+
+  /* the value is complete and nothing but whitespace followed. */
+  json_pull_end,
+
+  /* the input is invalid, see error (sticky). */
+  json_pull_error,
+
+  json_pull_object_start,
+  json_pull_object_end,
+  json_pull_array_start,
+  json_pull_array_end,
+
+  /* value and value_size hold the (decoded) text. */
+  json_pull_key,
+  json_pull_string,
+  json_pull_number,
+
+  json_pull_true,
+  json_pull_false,
+  json_pull_null
+};
+
+typedef struct json_pull_s {
+  /* the text of the last key, string or number event, valid until the next
+   * json_pull_next() or json_pull_feed(). Keys and strings are '\0'
+   * terminated, numbers may not be. */
+  const char *value;
+  size_t value_size;
+
+  /* one of json_parse_error_e once json_pull_error was returned. */
+  size_t error;
+
+  /* the rest is private. */
+  char *src;
+  size_t size;
+  size_t offset;
+  int is_last;
+  char *token;
+  size_t token_size;
+  size_t token_len;
+  int token_type;
+  int token_is_key;
+  int escaped;
+  int expect;
+  size_t depth;
+  char stack[JSON_PULL_MAX_DEPTH];
+} json_pull_t;
+
+/* "token" holds keys, strings and numbers split between chunks, the longest
+ * such token plus one byte must fit. */
+json_weak void json_pull_init(struct json_pull_s *pull, char *token,
+                              size_t token_size);
+
+/* hands over the next chunk, it must stay alive (and writable) while events
+ * are read from it. "is_last" marks the end of the input. */
+json_weak void json_pull_feed(struct json_pull_s *pull, char *src,
+                              size_t size, int is_last);
+
+/* returns the next json_pull_event_e. */
+json_weak int json_pull_next(struct json_pull_s *pull);
+
 #ifdef __cplusplus
 } /* extern "C". */
 #endif
@@ -516,6 +649,342 @@ int json_hexadecimal_value(const char *c, const unsigned long size,
   return 1;
 }
 
+/* SIMD scanning kernels. They only ever skip bytes the scalar loops would
+ * have consumed one at a time, and stop at the first byte that needs the
+ * scalar path (the quote, a reverse solidus, a control character or a
+ * non-whitespace byte), so the parsers stay the single source of truth for
+ * validation. AVX2 is chosen at runtime, SSE2 is part of the x86-64 baseline.
+ * Define JSON_NO_SIMD to build the scalar path only. */
+#if !defined(JSON_NO_SIMD) && (defined(__GNUC__) || defined(__clang__)) &&   \
+    defined(__SSE2__) && (defined(__x86_64__) || defined(__i386__))
+#define JSON_SIMD_X86 1
+#include <immintrin.h>
+
+/* bytes that end a run of plain string characters. */
+#define JSON_SIMD_STRING_STOP(cmpeq, min, v, quote, rsolidus, ctrl)            \
+  cmpeq(v, quote) | cmpeq(v, rsolidus) | cmpeq(min(v, ctrl), v)
+
+#define JSON_SIMD_WHITESPACE(cmpeq, v, space, tab, cr, lf)                     \
+  cmpeq(v, space) | cmpeq(v, tab) | cmpeq(v, cr) | cmpeq(v, lf)
+
+json_weak size_t json_string_run_sse2(const char *src, size_t size,
+                                      char quote);
+size_t json_string_run_sse2(const char *src, size_t size, char quote) {
+  const __m128i q = _mm_set1_epi8(quote);
+  const __m128i rsolidus = _mm_set1_epi8('\\');
+  const __m128i ctrl = _mm_set1_epi8(0x1f);
+  size_t run = 0;
+
+  for (; run + 16 <= size; run += 16) {
+    const __m128i v = _mm_loadu_si128((const __m128i *)(src + run));
+    const unsigned mask = (unsigned)_mm_movemask_epi8(JSON_SIMD_STRING_STOP(
+        _mm_cmpeq_epi8, _mm_min_epu8, v, q, rsolidus, ctrl));
+    if (mask != 0) {
+      return run + (size_t)__builtin_ctz(mask);
+    }
+  }
+
+  return run;
+}
+
+json_weak size_t json_string_run_avx2(const char *src, size_t size,
+                                      char quote)
+    JSON_ATTRIBUTE(target("avx2"));
+size_t json_string_run_avx2(const char *src, size_t size, char quote) {
+  const __m256i q = _mm256_set1_epi8(quote);
+  const __m256i rsolidus = _mm256_set1_epi8('\\');
+  const __m256i ctrl = _mm256_set1_epi8(0x1f);
+  size_t run = 0;
+
+  for (; run + 32 <= size; run += 32) {
+    const __m256i v = _mm256_loadu_si256((const __m256i *)(src + run));
+    const unsigned mask = (unsigned)_mm256_movemask_epi8(JSON_SIMD_STRING_STOP(
+        _mm256_cmpeq_epi8, _mm256_min_epu8, v, q, rsolidus, ctrl));
+    if (mask != 0) {
+      return run + (size_t)__builtin_ctz(mask);
+    }
+  }
+
+  return run + json_string_run_sse2(src + run, size - run, quote);
+}
+
+/* returns the whitespace run length, counting the '\n's it skips over. */
+json_weak size_t json_whitespace_run_sse2(const char *src, size_t size,
+                                          size_t *newlines, size_t *last_lf);
+size_t json_whitespace_run_sse2(const char *src, size_t size,
+                                size_t *newlines, size_t *last_lf) {
+  const __m128i space = _mm_set1_epi8(' ');
+  const __m128i tab = _mm_set1_epi8('\t');
+  const __m128i cr = _mm_set1_epi8('\r');
+  const __m128i lf = _mm_set1_epi8('\n');
+  size_t run = 0;
+
+  for (; run + 16 <= size; run += 16) {
+    const __m128i v = _mm_loadu_si128((const __m128i *)(src + run));
+    const unsigned ws = (unsigned)_mm_movemask_epi8(
+        JSON_SIMD_WHITESPACE(_mm_cmpeq_epi8, v, space, tab, cr, lf));
+    unsigned lfs = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, lf));
+    const unsigned stop = ~ws & 0xffffu;
+
+    if (stop != 0) {
+      lfs &= (1u << __builtin_ctz(stop)) - 1;
+    }
+
+    if (lfs != 0) {
+      *newlines += (size_t)__builtin_popcount(lfs);
+      *last_lf = run + 31 - (size_t)__builtin_clz(lfs);
+    }
+
+    if (stop != 0) {
+      return run + (size_t)__builtin_ctz(stop);
+    }
+  }
+
+  return run;
+}
+
+json_weak size_t json_whitespace_run_avx2(const char *src, size_t size,
+                                          size_t *newlines, size_t *last_lf)
+    JSON_ATTRIBUTE(target("avx2"));
+size_t json_whitespace_run_avx2(const char *src, size_t size,
+                                size_t *newlines, size_t *last_lf) {
+  const __m256i space = _mm256_set1_epi8(' ');
+  const __m256i tab = _mm256_set1_epi8('\t');
+  const __m256i cr = _mm256_set1_epi8('\r');
+  const __m256i lf = _mm256_set1_epi8('\n');
+  size_t run = 0;
+
+  for (; run + 32 <= size; run += 32) {
+    const __m256i v = _mm256_loadu_si256((const __m256i *)(src + run));
+    const unsigned ws = (unsigned)_mm256_movemask_epi8(
+        JSON_SIMD_WHITESPACE(_mm256_cmpeq_epi8, v, space, tab, cr, lf));
+    unsigned lfs = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, lf));
+    const unsigned stop = ~ws;
+
+    if (stop != 0) {
+      lfs &= (unsigned)((1ull << __builtin_ctz(stop)) - 1);
+    }
+
+    if (lfs != 0) {
+      *newlines += (size_t)__builtin_popcount(lfs);
+      *last_lf = run + 31 - (size_t)__builtin_clz(lfs);
+    }
+
+    if (stop != 0) {
+      return run + (size_t)__builtin_ctz(stop);
+    }
+  }
+
+  if (run == size) {
+    return run;
+  }
+
+  {
+    size_t tail_lf = 0;
+    const size_t newlines_before = *newlines;
+    const size_t tail = json_whitespace_run_sse2(src + run, size - run,
+                                                 newlines, &tail_lf);
+    if (*newlines != newlines_before) {
+      *last_lf = run + tail_lf;
+    }
+    return run + tail;
+  }
+}
+
+/* structural indexing, see json_tape_fill(): one bitmask per byte class over a
+ * 64 byte block. '[' and '{' (and ']' and '}') differ only in bit 0x20. The
+ * last class is what the string decoder has to look at. */
+#define JSON_SIMD_STRUCTURAL(cmpeq, vor, v, lower, open, close, colon, comma)  \
+  cmpeq(vor(v, lower), open) | cmpeq(vor(v, lower), close) |                  \
+      cmpeq(v, colon) | cmpeq(v, comma)
+
+json_weak void json_tape_classify_sse2(const char *block,
+                                       unsigned long long *masks);
+void json_tape_classify_sse2(const char *block, unsigned long long *masks) {
+  const __m128i quote = _mm_set1_epi8('"');
+  const __m128i rsolidus = _mm_set1_epi8('\\');
+  const __m128i space = _mm_set1_epi8(' ');
+  const __m128i tab = _mm_set1_epi8('\t');
+  const __m128i cr = _mm_set1_epi8('\r');
+  const __m128i lf = _mm_set1_epi8('\n');
+  const __m128i lower = _mm_set1_epi8(0x20);
+  const __m128i open = _mm_set1_epi8('{');
+  const __m128i close = _mm_set1_epi8('}');
+  const __m128i colon = _mm_set1_epi8(':');
+  const __m128i comma = _mm_set1_epi8(',');
+  const __m128i nul = _mm_setzero_si128();
+  size_t i;
+
+  masks[0] = masks[1] = masks[2] = masks[3] = masks[4] = 0;
+
+  for (i = 0; i < 64; i += 16) {
+    const __m128i v = _mm_loadu_si128((const __m128i *)(block + i));
+
+    masks[0] |= (unsigned long long)(unsigned)_mm_movemask_epi8(
+                    _mm_cmpeq_epi8(v, quote))
+                << i;
+    masks[1] |= (unsigned long long)(unsigned)_mm_movemask_epi8(
+                    _mm_cmpeq_epi8(v, rsolidus))
+                << i;
+    masks[2] |= (unsigned long long)(unsigned)_mm_movemask_epi8(
+                    JSON_SIMD_WHITESPACE(_mm_cmpeq_epi8, v, space, tab, cr, lf))
+                << i;
+    masks[3] |= (unsigned long long)(unsigned)_mm_movemask_epi8(
+                    JSON_SIMD_STRUCTURAL(_mm_cmpeq_epi8, _mm_or_si128, v,
+                                         lower, open, close, colon, comma))
+                << i;
+    masks[4] |= (unsigned long long)(unsigned)_mm_movemask_epi8(
+                    _mm_cmpeq_epi8(v, rsolidus) | _mm_cmpeq_epi8(v, nul) |
+                    _mm_cmpeq_epi8(v, tab) | _mm_cmpeq_epi8(v, cr) |
+                    _mm_cmpeq_epi8(v, lf))
+                << i;
+  }
+}
+
+json_weak void json_tape_classify_avx2(const char *block,
+                                       unsigned long long *masks)
+    JSON_ATTRIBUTE(target("avx2"));
+void json_tape_classify_avx2(const char *block, unsigned long long *masks) {
+  const __m256i quote = _mm256_set1_epi8('"');
+  const __m256i rsolidus = _mm256_set1_epi8('\\');
+  const __m256i space = _mm256_set1_epi8(' ');
+  const __m256i tab = _mm256_set1_epi8('\t');
+  const __m256i cr = _mm256_set1_epi8('\r');
+  const __m256i lf = _mm256_set1_epi8('\n');
+  const __m256i lower = _mm256_set1_epi8(0x20);
+  const __m256i open = _mm256_set1_epi8('{');
+  const __m256i close = _mm256_set1_epi8('}');
+  const __m256i colon = _mm256_set1_epi8(':');
+  const __m256i comma = _mm256_set1_epi8(',');
+  const __m256i nul = _mm256_setzero_si256();
+  size_t i;
+
+  masks[0] = masks[1] = masks[2] = masks[3] = masks[4] = 0;
+
+  for (i = 0; i < 64; i += 32) {
+    const __m256i v = _mm256_loadu_si256((const __m256i *)(block + i));
+
+    masks[0] |= (unsigned long long)(unsigned)_mm256_movemask_epi8(
+                    _mm256_cmpeq_epi8(v, quote))
+                << i;
+    masks[1] |= (unsigned long long)(unsigned)_mm256_movemask_epi8(
+                    _mm256_cmpeq_epi8(v, rsolidus))
+                << i;
+    masks[2] |=
+        (unsigned long long)(unsigned)_mm256_movemask_epi8(
+            JSON_SIMD_WHITESPACE(_mm256_cmpeq_epi8, v, space, tab, cr, lf))
+        << i;
+    masks[3] |= (unsigned long long)(unsigned)_mm256_movemask_epi8(
+                    JSON_SIMD_STRUCTURAL(_mm256_cmpeq_epi8, _mm256_or_si256, v,
+                                         lower, open, close, colon, comma))
+                << i;
+    masks[4] |= (unsigned long long)(unsigned)_mm256_movemask_epi8(
+                    _mm256_cmpeq_epi8(v, rsolidus) | _mm256_cmpeq_epi8(v, nul) |
+                    _mm256_cmpeq_epi8(v, tab) | _mm256_cmpeq_epi8(v, cr) |
+                    _mm256_cmpeq_epi8(v, lf))
+                << i;
+  }
+}
+
+/* the number of '[', '{' and ',' bytes, see json_single_pass_size(). Byte
+ * counters are folded into 64 bit ones before they can wrap. */
+json_weak size_t json_slot_count_sse2(const char *src, size_t size);
+size_t json_slot_count_sse2(const char *src, size_t size) {
+  const __m128i lower = _mm_set1_epi8(0x20);
+  const __m128i open = _mm_set1_epi8('{');
+  const __m128i comma = _mm_set1_epi8(',');
+  __m128i total = _mm_setzero_si128();
+  size_t count = 0;
+  size_t i = 0;
+
+  while (i + 16 <= size) {
+    __m128i bytes = _mm_setzero_si128();
+    size_t round;
+
+    for (round = 0; round < 255 && i + 16 <= size; round++, i += 16) {
+      const __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+      bytes = _mm_sub_epi8(bytes, _mm_cmpeq_epi8(_mm_or_si128(v, lower), open));
+      bytes = _mm_sub_epi8(bytes, _mm_cmpeq_epi8(v, comma));
+    }
+
+    total = _mm_add_epi64(total, _mm_sad_epu8(bytes, _mm_setzero_si128()));
+  }
+
+  {
+    json_uintmax_t halves[2];
+    _mm_storeu_si128((__m128i *)halves, total);
+    count = (size_t)(halves[0] + halves[1]);
+  }
+
+  for (; i < size; i++) {
+    count += ('[' == src[i]) | ('{' == src[i]) | (',' == src[i]);
+  }
+
+  return count;
+}
+
+/* libgcc fills the cpu model in before main(), so this is a plain load. */
+#define json_simd_has_avx2() __builtin_cpu_supports("avx2")
+
+#undef JSON_SIMD_STRUCTURAL
+#undef JSON_SIMD_WHITESPACE
+#undef JSON_SIMD_STRING_STOP
+#endif
+
+/* the number of plain string characters (no quote, reverse solidus or control
+ * character) at src[offset], 0 when the scalar loop should look at it. */
+json_weak size_t json_string_run(const char *src, size_t offset, size_t size,
+                                 char quote);
+size_t json_string_run(const char *src, size_t offset, size_t size,
+                       char quote) {
+#if defined(JSON_SIMD_X86)
+  if (size - offset >= 32 && json_simd_has_avx2()) {
+    return json_string_run_avx2(src + offset, size - offset, quote);
+  }
+  if (size - offset >= 16) {
+    return json_string_run_sse2(src + offset, size - offset, quote);
+  }
+#else
+  (void)src;
+  (void)offset;
+  (void)size;
+  (void)quote;
+#endif
+  return 0;
+}
+
+/* skips a run of whitespace at state->offset, keeping the line counters in
+ * step, and leaves the remainder (< 16 bytes or the first non-whitespace
+ * byte) to the scalar loop. */
+json_weak size_t json_whitespace_run(struct json_parse_state_s *state,
+                                     size_t offset);
+size_t json_whitespace_run(struct json_parse_state_s *state, size_t offset) {
+#if defined(JSON_SIMD_X86)
+  const size_t size = state->size;
+  size_t newlines = 0;
+  size_t last_lf = 0;
+  size_t run = 0;
+
+  if (size - offset >= 32 && json_simd_has_avx2()) {
+    run = json_whitespace_run_avx2(state->src + offset, size - offset,
+                                   &newlines, &last_lf);
+  } else if (size - offset >= 16) {
+    run = json_whitespace_run_sse2(state->src + offset, size - offset,
+                                   &newlines, &last_lf);
+  }
+
+  if (newlines != 0) {
+    state->line_no += newlines;
+    state->line_offset = offset + last_lf;
+  }
+
+  return offset + run;
+#else
+  (void)state;
+  return offset;
+#endif
+}
+
 json_weak int json_skip_whitespace(struct json_parse_state_s *state);
 int json_skip_whitespace(struct json_parse_state_s *state) {
   size_t offset = state->offset;
@@ -538,6 +1007,12 @@ int json_skip_whitespace(struct json_parse_state_s *state) {
     break;
   }
 
+  offset = json_whitespace_run(state, offset);
+  if (offset >= size) {
+    state->offset = offset;
+    return 1;
+  }
+
   do {
     switch (src[offset]) {
     default:
@@ -717,6 +1192,14 @@ int json_get_string_size(struct json_parse_state_s *state, size_t is_key) {
   offset++;
 
   while ((offset < size) && (quote_to_use != src[offset])) {
+    /* skip a run of plain characters at once. */
+    const size_t run = json_string_run(src, offset, size, quote_to_use);
+    if (run != 0) {
+      data_size += run;
+      offset += run;
+      continue;
+    }
+
     /* add space for the character. */
     data_size++;
 
@@ -853,11 +1336,14 @@ int json_get_string_size(struct json_parse_state_s *state, size_t is_key) {
   /* skip trailing '"' or '\''. */
   offset++;
 
-  /* add enough space to store the string. */
-  state->data_size += data_size;
+  /* in situ strings stay in the source. */
+  if (!(json_parse_flags_in_situ & flags_bitset)) {
+    /* add enough space to store the string. */
+    state->data_size += data_size;
 
-  /* one more byte for null terminator ending the string! */
-  state->data_size++;
+    /* one more byte for null terminator ending the string! */
+    state->data_size++;
+  }
 
   /* update offset. */
   state->offset = offset;
@@ -918,6 +1404,90 @@ int json_get_key_size(struct json_parse_state_s *state) {
   }
 }
 
+/* the number of index slots for an object of length elements, 0 if it gets
+ * no index. At most 4 per element, the table is kept at most half full. */
+json_weak size_t json_object_index_slots(size_t flags_bitset, size_t length);
+size_t json_object_index_slots(size_t flags_bitset, size_t length) {
+  size_t slots = 4;
+
+  if (!(json_parse_flags_index_objects & flags_bitset) ||
+      length < JSON_OBJECT_INDEX_MIN) {
+    return 0;
+  }
+
+  while (slots < 2 * length) {
+    slots *= 2;
+  }
+
+  return slots;
+}
+
+json_weak size_t json_object_index_size(size_t flags_bitset, size_t length);
+size_t json_object_index_size(size_t flags_bitset, size_t length) {
+  const size_t slots = json_object_index_slots(flags_bitset, length);
+
+  if (0 == slots) {
+    return 0;
+  }
+
+  return sizeof(struct json_object_index_s) +
+         (sizeof(struct json_object_element_s *) * slots);
+}
+
+/* FNV-1a. */
+json_weak size_t json_object_key_hash(const char *name, size_t name_size);
+size_t json_object_key_hash(const char *name, size_t name_size) {
+  unsigned long hash = 2166136261ul;
+  size_t i;
+
+  for (i = 0; i < name_size; i++) {
+    hash = ((hash ^ (unsigned char)name[i]) * 16777619ul) & 0xfffffffful;
+  }
+
+  return (size_t)hash;
+}
+
+/* builds the index of a parsed object at state->dom. Probing keeps elements
+ * with the same key in order, so the first one is found first. */
+json_weak void json_object_index_build(struct json_parse_state_s *state,
+                                       struct json_object_s *object);
+void json_object_index_build(struct json_parse_state_s *state,
+                             struct json_object_s *object) {
+  const size_t slots =
+      json_object_index_slots(state->flags_bitset, object->length);
+  struct json_object_index_s *index;
+  struct json_object_element_s *element;
+
+  object->index = json_null;
+
+  if (0 == slots) {
+    return;
+  }
+
+  index = (struct json_object_index_s *)state->dom;
+  state->dom += sizeof(struct json_object_index_s);
+
+  index->mask = slots - 1;
+  index->slots = (struct json_object_element_s **)state->dom;
+  state->dom += sizeof(struct json_object_element_s *) * slots;
+  memset(index->slots, 0, sizeof(struct json_object_element_s *) * slots);
+
+  for (element = object->start; json_null != element;
+       element = element->next) {
+    size_t slot = json_object_key_hash(element->name->string,
+                                       element->name->string_size) &
+                  index->mask;
+
+    while (json_null != index->slots[slot]) {
+      slot = (slot + 1) & index->mask;
+    }
+
+    index->slots[slot] = element;
+  }
+
+  object->index = index;
+}
+
 json_weak int json_get_object_size(struct json_parse_state_s *state,
                                    int is_global_object);
 int json_get_object_size(struct json_parse_state_s *state,
@@ -1052,6 +1622,7 @@ int json_get_object_size(struct json_parse_state_s *state,
   }
 
   state->dom_size += sizeof(struct json_object_element_s) * elements;
+  state->dom_size += json_object_index_size(flags_bitset, elements);
 
   return 0;
 }
@@ -1470,7 +2041,8 @@ void json_parse_string(struct json_parse_state_s *state,
   size_t bytes_written = 0;
   const char *const src = state->src;
   const char quote_to_use = '\'' == src[offset] ? '\'' : '"';
-  char *data = state->data;
+  const int in_situ = (json_parse_flags_in_situ & state->flags_bitset) != 0;
+  char *data = in_situ ? (char *)src + offset + 1 : state->data;
   unsigned long high_surrogate = 0;
   unsigned long codepoint;
 
@@ -1480,6 +2052,15 @@ void json_parse_string(struct json_parse_state_s *state,
   offset++;
 
   while (quote_to_use != src[offset]) {
+    /* copy a run of plain characters at once. */
+    const size_t run = json_string_run(src, offset, state->size, quote_to_use);
+    if (run != 0) {
+      memmove(data + bytes_written, src + offset, run);
+      bytes_written += run;
+      offset += run;
+      continue;
+    }
+
     if ('\\' == src[offset]) {
       /* skip the reverse solidus. */
       offset++;
@@ -1588,7 +2169,9 @@ void json_parse_string(struct json_parse_state_s *state,
   data[bytes_written++] = '\0';
 
   /* move data along. */
-  state->data += bytes_written;
+  if (!in_situ) {
+    state->data += bytes_written;
+  }
 
   /* update offset. */
   state->offset = offset;
@@ -1770,6 +2353,8 @@ void json_parse_object(struct json_parse_state_s *state, int is_global_object,
   }
 
   object->length = elements;
+
+  json_object_index_build(state, object);
 }
 
 json_weak void json_parse_array(struct json_parse_state_s *state,
@@ -2058,126 +2643,1531 @@ void json_parse_value(struct json_parse_state_s *state, int is_global_object,
   }
 }
 
-struct json_value_s *
-json_parse_ex(const void *src, size_t src_size, size_t flags_bitset,
-              void *(*alloc_func_ptr)(void *user_data, size_t size),
-              void *user_data, struct json_parse_result_s *result) {
-  struct json_parse_state_s state;
-  void *allocation;
-  struct json_value_s *value;
-  size_t total_size;
-  int input_error;
-
-  if (result) {
-    result->error = json_parse_error_none;
-    result->error_offset = 0;
-    result->error_line_no = 0;
-    result->error_row_no = 0;
-  }
-
-  if (json_null == src) {
-    /* invalid src pointer was null! */
-    return json_null;
-  }
-
-  state.src = (const char *)src;
-  state.size = src_size;
-  state.offset = 0;
-  state.line_no = 1;
-  state.line_offset = 0;
-  state.error = json_parse_error_none;
-  state.dom_size = 0;
-  state.data_size = 0;
-  state.flags_bitset = flags_bitset;
-
-  input_error = json_get_value_size(
-      &state, (int)(json_parse_flags_allow_global_object & state.flags_bitset));
-
-  if (0 == input_error) {
-    json_skip_all_skippables(&state);
-
-    if (state.offset != state.size) {
-      /* our parsing didn't have an error, but there are characters remaining in
-       * the input that weren't part of the JSON! */
-
-      state.error = json_parse_error_unexpected_trailing_characters;
-      input_error = 1;
-    }
-  }
+/* Single pass parsing (json_parse_flags_single_pass).
+ *
+ * Validates and builds the DOM in one walk over the input, into a block sized
+ * from the input alone: every value but the root follows a '[', '{' or ',',
+ * so counting those bytes bounds the number of values and keys, and no string
+ * or number decodes to more bytes than it takes in the input. The bound is
+ * usually a few times the exact size, large blocks come from mmap and are only
+ * committed as far as they are written.
+ *
+ * Only strict JSON is handled here. Anything this rejects is handed to the
+ * two pass parser, which reports the exact error (or accepts one of its
+ * lenient edge cases), so both modes always agree on the result. */
+json_weak int json_single_pass_value(struct json_parse_state_s *state,
+                                     struct json_value_s *value);
+
+json_weak size_t json_single_pass_size(const char *src, size_t size,
+                                       size_t flags_bitset, size_t *dom_size);
+size_t json_single_pass_size(const char *src, size_t size,
+                             size_t flags_bitset, size_t *dom_size) {
+  size_t slots = 1;
+  size_t slot_size;
+
+#if defined(JSON_SIMD_X86)
+  slots += json_slot_count_sse2(src, size);
+#else
+  {
+    size_t i;
 
-  if (input_error) {
-    /* parsing value's size failed (most likely an invalid JSON DOM!). */
-    if (result) {
-      result->error = state.error;
-      result->error_offset = state.offset;
-      result->error_line_no = state.line_no;
-      result->error_row_no = state.offset - state.line_offset;
+    for (i = 0; i < size; i++) {
+      slots += ('[' == src[i]) | ('{' == src[i]) | (',' == src[i]);
     }
-    return json_null;
   }
+#endif
 
-  /* our total allocation is the combination of the dom and data sizes (we. */
-  /* first encode the structure of the JSON, and then the data referenced by. */
-  /* the JSON values). */
-  total_size = state.dom_size + state.data_size;
-
-  if (json_null == alloc_func_ptr) {
-    allocation = malloc(total_size);
+  /* a value, its payload (an object is the largest), and the object element
+   * and key it may belong to. */
+  if (json_parse_flags_allow_location_information & flags_bitset) {
+    slot_size = sizeof(struct json_value_ex_s) + sizeof(struct json_object_s) +
+                sizeof(struct json_object_element_s) +
+                sizeof(struct json_string_ex_s);
   } else {
-    allocation = alloc_func_ptr(user_data, total_size);
+    slot_size = sizeof(struct json_value_s) + sizeof(struct json_object_s) +
+                sizeof(struct json_object_element_s) +
+                sizeof(struct json_string_s);
   }
 
-  if (json_null == allocation) {
-    /* malloc failed! */
-    if (result) {
-      result->error = json_parse_error_allocator_failed;
-      result->error_offset = 0;
-      result->error_line_no = 0;
-      result->error_row_no = 0;
-    }
-
-    return json_null;
+  /* and a share of a key index: a header per object, 4 slots per key. */
+  if (json_parse_flags_index_objects & flags_bitset) {
+    slot_size += sizeof(struct json_object_index_s) +
+                 (4 * sizeof(struct json_object_element_s *));
   }
 
-  /* reset offset so we can reuse it. */
-  state.offset = 0;
-
-  /* reset the line information so we can reuse it. */
-  state.line_no = 1;
-  state.line_offset = 0;
+  *dom_size = slots * slot_size;
 
-  state.dom = (char *)allocation;
-  state.data = state.dom + state.dom_size;
+  /* the data: every input byte once, plus a '\0' per string and number. */
+  return *dom_size + size + (2 * slots);
+}
 
-  if (json_parse_flags_allow_location_information & state.flags_bitset) {
-    struct json_value_ex_s *value_ex = (struct json_value_ex_s *)state.dom;
-    state.dom += sizeof(struct json_value_ex_s);
+json_weak struct json_value_s *
+json_single_pass_alloc_value(struct json_parse_state_s *state);
+struct json_value_s *
+json_single_pass_alloc_value(struct json_parse_state_s *state) {
+  if (json_parse_flags_allow_location_information & state->flags_bitset) {
+    struct json_value_ex_s *value_ex = (struct json_value_ex_s *)state->dom;
+    state->dom += sizeof(struct json_value_ex_s);
 
-    value_ex->offset = state.offset;
-    value_ex->line_no = state.line_no;
-    value_ex->row_no = state.offset - state.line_offset;
+    value_ex->offset = state->offset;
+    value_ex->line_no = state->line_no;
+    value_ex->row_no = state->offset - state->line_offset;
 
-    value = &(value_ex->value);
+    return &(value_ex->value);
   } else {
-    value = (struct json_value_s *)state.dom;
-    state.dom += sizeof(struct json_value_s);
+    struct json_value_s *value = (struct json_value_s *)state->dom;
+    state->dom += sizeof(struct json_value_s);
+
+    return value;
   }
+}
 
-  json_parse_value(
-      &state, (int)(json_parse_flags_allow_global_object & state.flags_bitset),
-      value);
+json_weak int json_single_pass_hex4(struct json_parse_state_s *state,
+                                    size_t offset, unsigned long *codepoint);
+int json_single_pass_hex4(struct json_parse_state_s *state, size_t offset,
+                          unsigned long *codepoint) {
+  /* 4 digits and the closing quote must still be ahead. */
+  if (offset + 4 >= state->size) {
+    return 1;
+  }
 
-  return (struct json_value_s *)allocation;
+  return !json_hexadecimal_value(&state->src[offset], 4, codepoint);
 }
 
-struct json_value_s *json_parse(const void *src, size_t src_size) {
-  return json_parse_ex(src, src_size, json_parse_flags_default, json_null,
-                       json_null, json_null);
-}
+json_weak int json_single_pass_string(struct json_parse_state_s *state,
+                                      struct json_string_s *string);
+int json_single_pass_string(struct json_parse_state_s *state,
+                            struct json_string_s *string) {
+  const char *const src = state->src;
+  const size_t size = state->size;
+  size_t offset = state->offset + 1;
+  size_t bytes_written = 0;
+  const int in_situ = (json_parse_flags_in_situ & state->flags_bitset) != 0;
+  char *const data = in_situ ? (char *)src + offset : state->data;
+  unsigned long codepoint;
+  unsigned long low;
 
-struct json_extract_result_s {
-  size_t dom_size;
-  size_t data_size;
+  string->string = data;
+
+  for (;;) {
+    const size_t run = json_string_run(src, offset, size, '"');
+    memmove(data + bytes_written, src + offset, run);
+    bytes_written += run;
+    offset += run;
+
+    if (offset >= size) {
+      return 1;
+    }
+
+    switch (src[offset]) {
+    case '"':
+      /* skip trailing '"'. */
+      state->offset = offset + 1;
+      string->string_size = bytes_written;
+      data[bytes_written++] = '\0';
+      if (!in_situ) {
+        state->data += bytes_written;
+      }
+      return 0;
+    case '\0':
+    case '\t':
+    case '\r':
+    case '\n':
+      return 1;
+    case '\\':
+      break;
+    default:
+      data[bytes_written++] = src[offset++];
+      continue;
+    }
+
+    /* skip the reverse solidus. */
+    offset++;
+    if (offset >= size) {
+      return 1;
+    }
+
+    switch (src[offset++]) {
+    default:
+      return 1;
+    case '"':
+      data[bytes_written++] = '"';
+      break;
+    case '\\':
+      data[bytes_written++] = '\\';
+      break;
+    case '/':
+      data[bytes_written++] = '/';
+      break;
+    case 'b':
+      data[bytes_written++] = '\b';
+      break;
+    case 'f':
+      data[bytes_written++] = '\f';
+      break;
+    case 'n':
+      data[bytes_written++] = '\n';
+      break;
+    case 'r':
+      data[bytes_written++] = '\r';
+      break;
+    case 't':
+      data[bytes_written++] = '\t';
+      break;
+    case 'u':
+      if (json_single_pass_hex4(state, offset, &codepoint)) {
+        return 1;
+      }
+
+      offset += 4;
+
+      if (codepoint <= 0x7fu) {
+        data[bytes_written++] = (char)codepoint; /* 0xxxxxxx. */
+      } else if (codepoint <= 0x7ffu) {
+        data[bytes_written++] =
+            (char)(0xc0u | (codepoint >> 6)); /* 110xxxxx. */
+        data[bytes_written++] =
+            (char)(0x80u | (codepoint & 0x3fu)); /* 10xxxxxx. */
+      } else if (codepoint >= 0xd800 && codepoint <= 0xdbff) {
+        /* a high surrogate must be followed by an escaped low one. */
+        if (offset + 2 > size || '\\' != src[offset] ||
+            'u' != src[offset + 1] ||
+            json_single_pass_hex4(state, offset + 2, &low) || low < 0xdc00 ||
+            low > 0xdfff) {
+          return 1;
+        }
+
+        offset += 6;
+
+        codepoint = (codepoint << 10) + low + 0x10000u - (0xD800u << 10) -
+                    0xDC00u;
+        data[bytes_written++] =
+            (char)(0xF0u | (codepoint >> 18)); /* 11110xxx. */
+        data[bytes_written++] =
+            (char)(0x80u | ((codepoint >> 12) & 0x3fu)); /* 10xxxxxx. */
+        data[bytes_written++] =
+            (char)(0x80u | ((codepoint >> 6) & 0x3fu)); /* 10xxxxxx. */
+        data[bytes_written++] =
+            (char)(0x80u | (codepoint & 0x3fu)); /* 10xxxxxx. */
+      } else if (codepoint >= 0xdc00 && codepoint <= 0xdfff) {
+        /* a low surrogate on its own. */
+        return 1;
+      } else {
+        data[bytes_written++] =
+            (char)(0xe0u | (codepoint >> 12)); /* 1110xxxx. */
+        data[bytes_written++] =
+            (char)(0x80u | ((codepoint >> 6) & 0x3fu)); /* 10xxxxxx. */
+        data[bytes_written++] =
+            (char)(0x80u | (codepoint & 0x3fu)); /* 10xxxxxx. */
+      }
+      break;
+    }
+  }
+}
+
+json_weak int json_single_pass_digits(const char *src, size_t size,
+                                      size_t *offset);
+int json_single_pass_digits(const char *src, size_t size, size_t *offset) {
+  const size_t start = *offset;
+
+  while ((*offset < size) && ('0' <= src[*offset] && src[*offset] <= '9')) {
+    (*offset)++;
+  }
+
+  return start == *offset;
+}
+
+json_weak int json_single_pass_number(struct json_parse_state_s *state,
+                                      struct json_number_s *number);
+int json_single_pass_number(struct json_parse_state_s *state,
+                            struct json_number_s *number) {
+  const char *const src = state->src;
+  const size_t size = state->size;
+  const size_t start = state->offset;
+  size_t offset = start;
+
+  if ('-' == src[offset]) {
+    offset++;
+  }
+
+  if ((offset < size) && ('0' == src[offset])) {
+    offset++;
+  } else if (json_single_pass_digits(src, size, &offset)) {
+    return 1;
+  }
+
+  if ((offset < size) && ('.' == src[offset])) {
+    offset++;
+    if (json_single_pass_digits(src, size, &offset)) {
+      return 1;
+    }
+  }
+
+  if ((offset < size) && ('e' == src[offset] || 'E' == src[offset])) {
+    offset++;
+    if ((offset < size) && ('-' == src[offset] || '+' == src[offset])) {
+      offset++;
+    }
+    if (json_single_pass_digits(src, size, &offset)) {
+      return 1;
+    }
+  }
+
+  if (offset < size) {
+    switch (src[offset]) {
+    default:
+      return 1;
+    case ' ':
+    case '\t':
+    case '\r':
+    case '\n':
+    case '}':
+    case ',':
+    case ']':
+      break;
+    }
+  }
+
+  number->number = state->data;
+  number->number_size = offset - start;
+  memcpy(state->data, src + start, offset - start);
+  state->data[offset - start] = '\0';
+  state->data += offset - start + 1;
+  state->offset = offset;
+
+  return 0;
+}
+
+json_weak int json_single_pass_object(struct json_parse_state_s *state,
+                                      struct json_object_s *object);
+int json_single_pass_object(struct json_parse_state_s *state,
+                            struct json_object_s *object) {
+  const char *const src = state->src;
+  const size_t size = state->size;
+  struct json_object_element_s *previous = json_null;
+  size_t elements = 0;
+
+  /* skip leading '{'. */
+  state->offset++;
+  (void)json_skip_whitespace(state);
+
+  object->start = json_null;
+  object->index = json_null;
+
+  if ((state->offset < size) && ('}' == src[state->offset])) {
+    state->offset++;
+    object->length = 0;
+    return 0;
+  }
+
+  for (;;) {
+    struct json_object_element_s *element;
+    struct json_string_s *string;
+
+    if ((state->offset >= size) || ('"' != src[state->offset])) {
+      return 1;
+    }
+
+    element = (struct json_object_element_s *)state->dom;
+    state->dom += sizeof(struct json_object_element_s);
+
+    if (json_null == previous) {
+      object->start = element;
+    } else {
+      previous->next = element;
+    }
+
+    previous = element;
+    element->next = json_null;
+
+    if (json_parse_flags_allow_location_information & state->flags_bitset) {
+      struct json_string_ex_s *string_ex =
+          (struct json_string_ex_s *)state->dom;
+      state->dom += sizeof(struct json_string_ex_s);
+
+      string_ex->offset = state->offset;
+      string_ex->line_no = state->line_no;
+      string_ex->row_no = state->offset - state->line_offset;
+
+      string = &(string_ex->string);
+    } else {
+      string = (struct json_string_s *)state->dom;
+      state->dom += sizeof(struct json_string_s);
+    }
+
+    element->name = string;
+
+    if (json_single_pass_string(state, string)) {
+      return 1;
+    }
+
+    (void)json_skip_whitespace(state);
+    if ((state->offset >= size) || (':' != src[state->offset])) {
+      return 1;
+    }
+
+    /* skip colon. */
+    state->offset++;
+    (void)json_skip_whitespace(state);
+
+    element->value = json_single_pass_alloc_value(state);
+    if (json_single_pass_value(state, element->value)) {
+      return 1;
+    }
+
+    elements++;
+
+    (void)json_skip_whitespace(state);
+    if (state->offset >= size) {
+      return 1;
+    }
+
+    if ('}' == src[state->offset]) {
+      state->offset++;
+      object->length = elements;
+      json_object_index_build(state, object);
+      return 0;
+    }
+
+    if (',' != src[state->offset]) {
+      return 1;
+    }
+
+    /* skip comma. */
+    state->offset++;
+    (void)json_skip_whitespace(state);
+  }
+}
+
+json_weak int json_single_pass_array(struct json_parse_state_s *state,
+                                     struct json_array_s *array);
+int json_single_pass_array(struct json_parse_state_s *state,
+                           struct json_array_s *array) {
+  const char *const src = state->src;
+  const size_t size = state->size;
+  struct json_array_element_s *previous = json_null;
+  size_t elements = 0;
+
+  /* skip leading '['. */
+  state->offset++;
+  (void)json_skip_whitespace(state);
+
+  array->start = json_null;
+
+  if ((state->offset < size) && (']' == src[state->offset])) {
+    state->offset++;
+    array->length = 0;
+    return 0;
+  }
+
+  for (;;) {
+    struct json_array_element_s *element =
+        (struct json_array_element_s *)state->dom;
+    state->dom += sizeof(struct json_array_element_s);
+
+    if (json_null == previous) {
+      array->start = element;
+    } else {
+      previous->next = element;
+    }
+
+    previous = element;
+    element->next = json_null;
+
+    element->value = json_single_pass_alloc_value(state);
+    if (json_single_pass_value(state, element->value)) {
+      return 1;
+    }
+
+    elements++;
+
+    (void)json_skip_whitespace(state);
+    if (state->offset >= size) {
+      return 1;
+    }
+
+    if (']' == src[state->offset]) {
+      state->offset++;
+      array->length = elements;
+      return 0;
+    }
+
+    if (',' != src[state->offset]) {
+      return 1;
+    }
+
+    /* skip comma. */
+    state->offset++;
+    (void)json_skip_whitespace(state);
+  }
+}
+
+/* state->offset is at the first byte of the value, whitespace skipped. */
+int json_single_pass_value(struct json_parse_state_s *state,
+                           struct json_value_s *value) {
+  const char *const src = state->src;
+  const size_t size = state->size;
+  const size_t offset = state->offset;
+
+  if (offset >= size) {
+    return 1;
+  }
+
+  switch (src[offset]) {
+  case '"':
+    value->type = json_type_string;
+    value->payload = state->dom;
+    state->dom += sizeof(struct json_string_s);
+    return json_single_pass_string(state,
+                                   (struct json_string_s *)value->payload);
+  case '{':
+    value->type = json_type_object;
+    value->payload = state->dom;
+    state->dom += sizeof(struct json_object_s);
+    return json_single_pass_object(state,
+                                   (struct json_object_s *)value->payload);
+  case '[':
+    value->type = json_type_array;
+    value->payload = state->dom;
+    state->dom += sizeof(struct json_array_s);
+    return json_single_pass_array(state,
+                                  (struct json_array_s *)value->payload);
+  case '-':
+  case '0':
+  case '1':
+  case '2':
+  case '3':
+  case '4':
+  case '5':
+  case '6':
+  case '7':
+  case '8':
+  case '9':
+    value->type = json_type_number;
+    value->payload = state->dom;
+    state->dom += sizeof(struct json_number_s);
+    return json_single_pass_number(state,
+                                   (struct json_number_s *)value->payload);
+  default:
+    value->payload = json_null;
+    if ((offset + 4) <= size && 0 == memcmp(src + offset, "true", 4)) {
+      value->type = json_type_true;
+      state->offset += 4;
+    } else if ((offset + 5) <= size &&
+               0 == memcmp(src + offset, "false", 5)) {
+      value->type = json_type_false;
+      state->offset += 5;
+    } else if ((offset + 4) <= size && 0 == memcmp(src + offset, "null", 4)) {
+      value->type = json_type_null;
+      state->offset += 4;
+    } else {
+      return 1;
+    }
+    return 0;
+  }
+}
+
+#if defined(JSON_SIMD_X86)
+/* Structural indexing (json_parse_flags_single_pass, inputs of at least
+ * JSON_TAPE_MIN_SIZE bytes).
+ *
+ * Stage 1 classifies 64 bytes at a time into bitmasks and derives, without a
+ * branch per byte, which quotes are escaped, which bytes are inside strings,
+ * and from that the offsets of every structural character, every quote and
+ * the first byte of every number or literal: the tape. Stage 2 walks the tape
+ * and builds the DOM with the single pass functions, jumping from one
+ * structural to the next instead of skipping whitespace and looking for
+ * delimiters byte by byte. The tape is filled JSON_TAPE_BATCH offsets at a
+ * time, so it stays in the cache and needs no allocation.
+ *
+ * Stage 2 checks everything stage 1 found against what the single pass
+ * functions parse (a string must end on the quote the tape has next, a scalar
+ * on whitespace or a structural), so a disagreement is a parse failure and the
+ * result is the same as from the single pass parser. */
+#ifndef JSON_TAPE_MIN_SIZE
+#define JSON_TAPE_MIN_SIZE 4096
+#endif
+
+#define JSON_TAPE_BATCH 1024
+
+/* set on the closing quote of a string the decoder has to look at. */
+#define JSON_TAPE_DECODE (~(~(size_t)0 >> 1))
+
+struct json_tape_s {
+  const char *src;
+  size_t size;
+  /* the offset of the next block stage 1 classifies. */
+  size_t block;
+  /* carried over from the previous block: the first byte is escaped, all
+   * ones if inside a string, the last byte was part of a scalar. */
+  unsigned long long escaped;
+  unsigned long long in_string;
+  unsigned long long scalar;
+  /* the open string has escapes or control characters so far. */
+  int decode;
+  size_t count;
+  size_t next;
+  size_t offsets[JSON_TAPE_BATCH];
+};
+
+json_weak void json_tape_fill(struct json_tape_s *tape);
+void json_tape_fill(struct json_tape_s *tape) {
+  /* the odd bits, reverse solidus runs that start on one are odd length. */
+  const unsigned long long odd = 0xaaaaaaaaaaaaaaaaull;
+  const int has_avx2 = json_simd_has_avx2();
+
+  tape->count = 0;
+  tape->next = 0;
+
+  while (tape->block < tape->size && tape->count + 64 <= JSON_TAPE_BATCH) {
+    const char *block = tape->src + tape->block;
+    /* quote, reverse solidus, whitespace, structural, decoder. */
+    unsigned long long masks[5];
+    unsigned long long escaped;
+    unsigned long long quote;
+    unsigned long long in_string;
+    unsigned long long scalar;
+    unsigned long long entries;
+    unsigned long long decode;
+    /* the first bit of the open string's contents in this block. */
+    unsigned from = 0;
+    char padded[64];
+
+    if (tape->size - tape->block < 64) {
+      memset(padded, ' ', sizeof(padded));
+      memcpy(padded, block, tape->size - tape->block);
+      block = padded;
+    }
+
+    if (has_avx2) {
+      json_tape_classify_avx2(block, masks);
+    } else {
+      json_tape_classify_sse2(block, masks);
+    }
+
+    /* the bytes after an odd length run of reverse solidi. */
+    if (0 == masks[1]) {
+      escaped = tape->escaped;
+      tape->escaped = 0;
+    } else {
+      const unsigned long long potential = masks[1] & ~tape->escaped;
+      const unsigned long long code =
+          (((potential << 1) | odd) - potential) ^ odd;
+      escaped = code ^ (masks[1] | tape->escaped);
+      tape->escaped = (code & masks[1]) >> 63;
+    }
+
+    /* a prefix xor of the quotes: from an opening quote up to (not
+     * including) its closing one. */
+    quote = masks[0] & ~escaped;
+    in_string = quote;
+    in_string ^= in_string << 1;
+    in_string ^= in_string << 2;
+    in_string ^= in_string << 4;
+    in_string ^= in_string << 8;
+    in_string ^= in_string << 16;
+    in_string ^= in_string << 32;
+    in_string ^= tape->in_string;
+    tape->in_string = 0ull - (in_string >> 63);
+
+    scalar = ~(masks[2] | masks[3] | quote | in_string);
+    entries = (masks[3] & ~in_string) | quote |
+              (scalar & ~((scalar << 1) | tape->scalar));
+    tape->scalar = scalar >> 63;
+    decode = masks[4] & in_string;
+
+    while (0 != entries) {
+      const unsigned bit = (unsigned)__builtin_ctzll(entries);
+      size_t offset = tape->block + bit;
+
+      if (1 & (quote >> bit)) {
+        if (1 & (in_string >> bit)) {
+          tape->decode = 0;
+          from = bit + 1;
+        } else {
+          if (tape->decode ||
+              0 != (decode & ((1ull << bit) - 1) & (~0ull << from))) {
+            offset |= JSON_TAPE_DECODE;
+          }
+          tape->decode = 0;
+        }
+      }
+
+      /* the padding past the end is whitespace, nothing is found there. */
+      tape->offsets[tape->count++] = offset;
+      entries &= entries - 1;
+    }
+
+    if (0 != tape->in_string && from < 64 && 0 != (decode & (~0ull << from))) {
+      tape->decode = 1;
+    }
+
+    tape->block += 64;
+  }
+}
+
+/* the offset of the next tape entry, size at the end. */
+json_weak size_t json_tape_next(struct json_tape_s *tape);
+size_t json_tape_next(struct json_tape_s *tape) {
+  if (tape->next == tape->count) {
+    json_tape_fill(tape);
+
+    if (0 == tape->count) {
+      return tape->size;
+    }
+  }
+
+  return tape->offsets[tape->next++];
+}
+
+json_weak int json_tape_value(struct json_parse_state_s *state,
+                              struct json_tape_s *tape, size_t offset,
+                              struct json_value_s *value);
+
+/* a string at offset, its closing quote must be the next entry. That is
+ * taken first: in situ decoding writes over the string, which stage 1 must
+ * have classified by then. */
+json_weak int json_tape_string(struct json_parse_state_s *state,
+                               struct json_tape_s *tape, size_t offset,
+                               struct json_string_s *string);
+int json_tape_string(struct json_parse_state_s *state, struct json_tape_s *tape,
+                     size_t offset, struct json_string_s *string) {
+  size_t end;
+
+  if ((offset >= state->size) || ('"' != state->src[offset])) {
+    return 1;
+  }
+
+  end = json_tape_next(tape);
+
+  /* nothing to decode, the contents are the bytes between the quotes. */
+  if (end < state->size) {
+    const size_t size = end - offset - 1;
+
+    if (json_parse_flags_in_situ & state->flags_bitset) {
+      char *const data = (char *)state->src + offset + 1;
+      data[size] = '\0';
+      string->string = data;
+    } else {
+      memcpy(state->data, state->src + offset + 1, size);
+      state->data[size] = '\0';
+      string->string = state->data;
+      state->data += size + 1;
+    }
+
+    string->string_size = size;
+    state->offset = end + 1;
+    return 0;
+  }
+
+  end &= ~JSON_TAPE_DECODE;
+  state->offset = offset;
+
+  if (json_single_pass_string(state, string)) {
+    return 1;
+  }
+
+  return end + 1 != state->offset;
+}
+
+json_weak int json_tape_object(struct json_parse_state_s *state,
+                               struct json_tape_s *tape,
+                               struct json_object_s *object);
+int json_tape_object(struct json_parse_state_s *state, struct json_tape_s *tape,
+                     struct json_object_s *object) {
+  const char *const src = state->src;
+  const size_t size = state->size;
+  struct json_object_element_s *previous = json_null;
+  size_t elements = 0;
+  size_t offset = json_tape_next(tape);
+
+  object->start = json_null;
+  object->index = json_null;
+
+  if ((offset < size) && ('}' == src[offset])) {
+    object->length = 0;
+    return 0;
+  }
+
+  for (;;) {
+    struct json_object_element_s *element =
+        (struct json_object_element_s *)state->dom;
+    state->dom += sizeof(struct json_object_element_s);
+
+    if (json_null == previous) {
+      object->start = element;
+    } else {
+      previous->next = element;
+    }
+
+    previous = element;
+    element->next = json_null;
+
+    element->name = (struct json_string_s *)state->dom;
+    state->dom += sizeof(struct json_string_s);
+
+    if (json_tape_string(state, tape, offset, element->name)) {
+      return 1;
+    }
+
+    offset = json_tape_next(tape);
+    if ((offset >= size) || (':' != src[offset])) {
+      return 1;
+    }
+
+    element->value = json_single_pass_alloc_value(state);
+    if (json_tape_value(state, tape, json_tape_next(tape), element->value)) {
+      return 1;
+    }
+
+    elements++;
+
+    offset = json_tape_next(tape);
+    if (offset >= size) {
+      return 1;
+    }
+
+    if ('}' == src[offset]) {
+      object->length = elements;
+      json_object_index_build(state, object);
+      return 0;
+    }
+
+    if (',' != src[offset]) {
+      return 1;
+    }
+
+    offset = json_tape_next(tape);
+  }
+}
+
+json_weak int json_tape_array(struct json_parse_state_s *state,
+                              struct json_tape_s *tape,
+                              struct json_array_s *array);
+int json_tape_array(struct json_parse_state_s *state, struct json_tape_s *tape,
+                    struct json_array_s *array) {
+  const char *const src = state->src;
+  const size_t size = state->size;
+  struct json_array_element_s *previous = json_null;
+  size_t elements = 0;
+  size_t offset = json_tape_next(tape);
+
+  array->start = json_null;
+
+  if ((offset < size) && (']' == src[offset])) {
+    array->length = 0;
+    return 0;
+  }
+
+  for (;;) {
+    struct json_array_element_s *element =
+        (struct json_array_element_s *)state->dom;
+    state->dom += sizeof(struct json_array_element_s);
+
+    if (json_null == previous) {
+      array->start = element;
+    } else {
+      previous->next = element;
+    }
+
+    previous = element;
+    element->next = json_null;
+
+    element->value = json_single_pass_alloc_value(state);
+    if (json_tape_value(state, tape, offset, element->value)) {
+      return 1;
+    }
+
+    elements++;
+
+    offset = json_tape_next(tape);
+    if (offset >= size) {
+      return 1;
+    }
+
+    if (']' == src[offset]) {
+      array->length = elements;
+      return 0;
+    }
+
+    if (',' != src[offset]) {
+      return 1;
+    }
+
+    offset = json_tape_next(tape);
+  }
+}
+
+/* the value's first byte is the tape entry at offset. */
+int json_tape_value(struct json_parse_state_s *state, struct json_tape_s *tape,
+                    size_t offset, struct json_value_s *value) {
+  const char *const src = state->src;
+  const size_t size = state->size;
+
+  if (offset >= size) {
+    return 1;
+  }
+
+  switch (src[offset]) {
+  case '"':
+    value->type = json_type_string;
+    value->payload = state->dom;
+    state->dom += sizeof(struct json_string_s);
+    return json_tape_string(state, tape, offset,
+                            (struct json_string_s *)value->payload);
+  case '{':
+    value->type = json_type_object;
+    value->payload = state->dom;
+    state->dom += sizeof(struct json_object_s);
+    return json_tape_object(state, tape,
+                            (struct json_object_s *)value->payload);
+  case '[':
+    value->type = json_type_array;
+    value->payload = state->dom;
+    state->dom += sizeof(struct json_array_s);
+    return json_tape_array(state, tape, (struct json_array_s *)value->payload);
+  default:
+    break;
+  }
+
+  /* a number or literal, it must run up to whitespace or a structural. */
+  state->offset = offset;
+  if (json_single_pass_value(state, value)) {
+    return 1;
+  }
+
+  if (state->offset < size) {
+    switch (src[state->offset]) {
+    default:
+      return 1;
+    case ' ':
+    case '\t':
+    case '\r':
+    case '\n':
+    case '}':
+    case ',':
+    case ']':
+      break;
+    }
+  }
+
+  return 0;
+}
+
+/* the whole input as one value: nothing may follow it on the tape. */
+json_weak int json_tape_parse(struct json_parse_state_s *state,
+                              struct json_value_s *value);
+int json_tape_parse(struct json_parse_state_s *state,
+                    struct json_value_s *value) {
+  struct json_tape_s tape;
+
+  tape.src = state->src;
+  tape.size = state->size;
+  tape.block = 0;
+  tape.escaped = 0;
+  tape.in_string = 0;
+  tape.scalar = 0;
+  tape.decode = 0;
+  tape.count = 0;
+  tape.next = 0;
+
+  if (json_tape_value(state, &tape, json_tape_next(&tape), value)) {
+    return 1;
+  }
+
+  state->offset = state->size;
+  return json_tape_next(&tape) != state->size;
+}
+#endif
+
+/* returns json_null if the input is not strict JSON or allocation failed, the
+ * caller falls back to the two pass parser in both cases. A block from
+ * alloc_func_ptr is not handed back on failure, the allocator owns it.
+ *
+ * In situ parsing cannot fall back, the strings before the failure are
+ * already decoded over the source: "result" then gets where the single pass
+ * stopped, reported as json_parse_error_invalid_value. */
+json_weak struct json_value_s *
+json_parse_single_pass(const void *src, size_t src_size, size_t flags_bitset,
+                       void *(*alloc_func_ptr)(void *user_data, size_t size),
+                       void *user_data, struct json_parse_result_s *result);
+struct json_value_s *
+json_parse_single_pass(const void *src, size_t src_size, size_t flags_bitset,
+                       void *(*alloc_func_ptr)(void *user_data, size_t size),
+                       void *user_data, struct json_parse_result_s *result) {
+  struct json_parse_state_s state;
+  struct json_value_s *value;
+  size_t total_size;
+  size_t dom_size;
+  void *allocation;
+  int parsed = 0;
+
+  total_size = json_single_pass_size((const char *)src, src_size, flags_bitset,
+                                     &dom_size);
+
+  if (json_null == alloc_func_ptr) {
+    allocation = malloc(total_size);
+  } else {
+    allocation = alloc_func_ptr(user_data, total_size);
+  }
+
+  if (json_null == allocation) {
+    if (result && (json_parse_flags_in_situ & flags_bitset)) {
+      result->error = json_parse_error_allocator_failed;
+    }
+
+    return json_null;
+  }
+
+  state.src = (const char *)src;
+  state.size = src_size;
+  state.offset = 0;
+  state.line_no = 1;
+  state.line_offset = 0;
+  state.error = json_parse_error_none;
+  state.flags_bitset = flags_bitset;
+  state.dom = (char *)allocation;
+  state.data = state.dom + dom_size;
+  state.dom_size = dom_size;
+  state.data_size = total_size - dom_size;
+
+  /* the root records offset 0, before any leading whitespace. */
+  value = json_single_pass_alloc_value(&state);
+
+#if defined(JSON_SIMD_X86)
+  if ((JSON_TAPE_MIN_SIZE <= src_size) &&
+      !(json_parse_flags_allow_location_information & flags_bitset)) {
+    parsed = (0 == json_tape_parse(&state, value));
+  } else
+#endif
+  {
+    (void)json_skip_whitespace(&state);
+
+    if (0 == json_single_pass_value(&state, value)) {
+      (void)json_skip_whitespace(&state);
+      parsed = (state.offset == state.size);
+    }
+  }
+
+  if (parsed) {
+    return (struct json_value_s *)allocation;
+  }
+
+  if (json_null == alloc_func_ptr) {
+    free(allocation);
+  }
+
+  if (result && (json_parse_flags_in_situ & flags_bitset)) {
+    result->error = json_parse_error_invalid_value;
+    result->error_offset = state.offset;
+    result->error_line_no = state.line_no;
+    result->error_row_no = state.offset - state.line_offset;
+  }
+
+  return json_null;
+}
+
+struct json_value_s *
+json_parse_ex(const void *src, size_t src_size, size_t flags_bitset,
+              void *(*alloc_func_ptr)(void *user_data, size_t size),
+              void *user_data, struct json_parse_result_s *result) {
+  struct json_parse_state_s state;
+  void *allocation;
+  struct json_value_s *value;
+  size_t total_size;
+  int input_error;
+
+  if (result) {
+    result->error = json_parse_error_none;
+    result->error_offset = 0;
+    result->error_line_no = 0;
+    result->error_row_no = 0;
+  }
+
+  if (json_null == src) {
+    /* invalid src pointer was null! */
+    return json_null;
+  }
+
+  if ((json_parse_flags_single_pass & flags_bitset) &&
+      0 == (flags_bitset & ~(json_parse_flags_single_pass |
+                             json_parse_flags_allow_location_information |
+                             json_parse_flags_in_situ |
+                             json_parse_flags_index_objects))) {
+    value = json_parse_single_pass(src, src_size, flags_bitset, alloc_func_ptr,
+                                   user_data, result);
+    if (json_null != value ||
+        (json_parse_flags_in_situ & flags_bitset)) {
+      return value;
+    }
+  }
+
+  state.src = (const char *)src;
+  state.size = src_size;
+  state.offset = 0;
+  state.line_no = 1;
+  state.line_offset = 0;
+  state.error = json_parse_error_none;
+  state.dom_size = 0;
+  state.data_size = 0;
+  state.flags_bitset = flags_bitset;
+
+  input_error = json_get_value_size(
+      &state, (int)(json_parse_flags_allow_global_object & state.flags_bitset));
+
+  if (0 == input_error) {
+    json_skip_all_skippables(&state);
+
+    if (state.offset != state.size) {
+      /* our parsing didn't have an error, but there are characters remaining in
+       * the input that weren't part of the JSON! */
+
+      state.error = json_parse_error_unexpected_trailing_characters;
+      input_error = 1;
+    }
+  }
+
+  if (input_error) {
+    /* parsing value's size failed (most likely an invalid JSON DOM!). */
+    if (result) {
+      result->error = state.error;
+      result->error_offset = state.offset;
+      result->error_line_no = state.line_no;
+      result->error_row_no = state.offset - state.line_offset;
+    }
+    return json_null;
+  }
+
+  /* our total allocation is the combination of the dom and data sizes (we. */
+  /* first encode the structure of the JSON, and then the data referenced by. */
+  /* the JSON values). */
+  total_size = state.dom_size + state.data_size;
+
+  if (json_null == alloc_func_ptr) {
+    allocation = malloc(total_size);
+  } else {
+    allocation = alloc_func_ptr(user_data, total_size);
+  }
+
+  if (json_null == allocation) {
+    /* malloc failed! */
+    if (result) {
+      result->error = json_parse_error_allocator_failed;
+      result->error_offset = 0;
+      result->error_line_no = 0;
+      result->error_row_no = 0;
+    }
+
+    return json_null;
+  }
+
+  /* reset offset so we can reuse it. */
+  state.offset = 0;
+
+  /* reset the line information so we can reuse it. */
+  state.line_no = 1;
+  state.line_offset = 0;
+
+  state.dom = (char *)allocation;
+  state.data = state.dom + state.dom_size;
+
+  if (json_parse_flags_allow_location_information & state.flags_bitset) {
+    struct json_value_ex_s *value_ex = (struct json_value_ex_s *)state.dom;
+    state.dom += sizeof(struct json_value_ex_s);
+
+    value_ex->offset = state.offset;
+    value_ex->line_no = state.line_no;
+    value_ex->row_no = state.offset - state.line_offset;
+
+    value = &(value_ex->value);
+  } else {
+    value = (struct json_value_s *)state.dom;
+    state.dom += sizeof(struct json_value_s);
+  }
+
+  json_parse_value(
+      &state, (int)(json_parse_flags_allow_global_object & state.flags_bitset),
+      value);
+
+  return (struct json_value_s *)allocation;
+}
+
+struct json_value_s *json_parse(const void *src, size_t src_size) {
+  return json_parse_ex(src, src_size, json_parse_flags_default, json_null,
+                       json_null, json_null);
+}
+
+enum json_pull_expect_e {
+  json_pull_expect_value,
+  json_pull_expect_value_or_close,
+  json_pull_expect_key,
+  json_pull_expect_key_or_close,
+  json_pull_expect_colon,
+  json_pull_expect_comma_or_close,
+  json_pull_expect_done
+};
+
+void json_pull_init(struct json_pull_s *pull, char *token, size_t token_size) {
+  memset(pull, 0, sizeof(*pull));
+  pull->token = token;
+  pull->token_size = token_size;
+  pull->expect = json_pull_expect_value;
+}
+
+void json_pull_feed(struct json_pull_s *pull, char *src, size_t size,
+                    int is_last) {
+  pull->src = src;
+  pull->size = size;
+  pull->offset = 0;
+  pull->is_last = is_last;
+}
+
+json_weak int json_pull_fail(struct json_pull_s *pull, size_t error);
+int json_pull_fail(struct json_pull_s *pull, size_t error) {
+  pull->error = error;
+  return json_pull_error;
+}
+
+/* a value is complete, what may follow depends on where it was. */
+json_weak int json_pull_value_done(struct json_pull_s *pull, int event);
+int json_pull_value_done(struct json_pull_s *pull, int event) {
+  pull->expect = (pull->depth > 0) ? json_pull_expect_comma_or_close
+                                   : json_pull_expect_done;
+  return event;
+}
+
+/* the offset of the closing quote, or size if it is not in this chunk.
+ * "escaped" carries a trailing reverse solidus over to the next chunk,
+ * "plain" is cleared by anything the decoder would have to look at. */
+json_weak size_t json_pull_string_end(const char *src, size_t size,
+                                      size_t offset, int *escaped,
+                                      int *plain);
+size_t json_pull_string_end(const char *src, size_t size, size_t offset,
+                            int *escaped, int *plain) {
+  while (offset < size) {
+    if (*escaped) {
+      *escaped = 0;
+      offset++;
+      continue;
+    }
+
+    offset += json_string_run(src, offset, size, '"');
+    if (offset >= size) {
+      break;
+    }
+
+    if ('"' == src[offset]) {
+      return offset;
+    }
+
+    switch (src[offset]) {
+    case '\\':
+      *escaped = 1;
+      /* fallthrough */
+    case '\0':
+    case '\t':
+    case '\r':
+    case '\n':
+      *plain = 0;
+      break;
+    default:
+      break;
+    }
+
+    offset++;
+  }
+
+  return size;
+}
+
+json_weak int json_pull_is_scalar_char(const char c);
+int json_pull_is_scalar_char(const char c) {
+  return ('0' <= c && c <= '9') || ('a' <= c && c <= 'z') ||
+         ('A' <= c && c <= 'Z') || '-' == c || '+' == c || '.' == c;
+}
+
+/* decodes a complete '"'...'"' token over itself, a NULL "text" means the
+ * value is already in place. */
+json_weak int json_pull_finish_string(struct json_pull_s *pull, char *text,
+                                      size_t size);
+int json_pull_finish_string(struct json_pull_s *pull, char *text,
+                            size_t size) {
+  struct json_parse_state_s state;
+  struct json_string_s string;
+
+  if (json_null != text) {
+    state.src = text;
+    state.size = size;
+    state.offset = 0;
+    state.flags_bitset = json_parse_flags_in_situ;
+    state.data = json_null;
+
+    if (json_single_pass_string(&state, &string)) {
+      return json_pull_fail(pull, json_parse_error_invalid_string);
+    }
+
+    pull->value = string.string;
+    pull->value_size = string.string_size;
+  }
+
+  if (pull->token_is_key) {
+    pull->expect = json_pull_expect_colon;
+    return json_pull_key;
+  }
+
+  return json_pull_value_done(pull, json_pull_string);
+}
+
+json_weak int json_pull_finish_scalar(struct json_pull_s *pull,
+                                      const char *text, size_t size);
+int json_pull_finish_scalar(struct json_pull_s *pull, const char *text,
+                            size_t size) {
+  size_t offset = 0;
+
+  if (4 == size && 0 == memcmp(text, "true", 4)) {
+    return json_pull_value_done(pull, json_pull_true);
+  } else if (5 == size && 0 == memcmp(text, "false", 5)) {
+    return json_pull_value_done(pull, json_pull_false);
+  } else if (4 == size && 0 == memcmp(text, "null", 4)) {
+    return json_pull_value_done(pull, json_pull_null);
+  }
+
+  if ((offset < size) && ('-' == text[offset])) {
+    offset++;
+  }
+
+  if ((offset < size) && ('0' == text[offset])) {
+    offset++;
+  } else if (json_single_pass_digits(text, size, &offset)) {
+    return json_pull_fail(pull, json_parse_error_invalid_number_format);
+  }
+
+  if ((offset < size) && ('.' == text[offset])) {
+    offset++;
+    if (json_single_pass_digits(text, size, &offset)) {
+      return json_pull_fail(pull, json_parse_error_invalid_number_format);
+    }
+  }
+
+  if ((offset < size) && ('e' == text[offset] || 'E' == text[offset])) {
+    offset++;
+    if ((offset < size) && ('-' == text[offset] || '+' == text[offset])) {
+      offset++;
+    }
+    if (json_single_pass_digits(text, size, &offset)) {
+      return json_pull_fail(pull, json_parse_error_invalid_number_format);
+    }
+  }
+
+  if (offset != size) {
+    return json_pull_fail(pull, json_parse_error_invalid_number_format);
+  }
+
+  pull->value = text;
+  pull->value_size = size;
+  return json_pull_value_done(pull, json_pull_number);
+}
+
+json_weak int json_pull_gather(struct json_pull_s *pull, size_t end);
+int json_pull_gather(struct json_pull_s *pull, size_t end) {
+  const size_t size = end - pull->offset;
+
+  if (pull->token_len + size + 1 > pull->token_size) {
+    return json_pull_fail(pull, json_parse_error_allocator_failed);
+  }
+
+  memcpy(pull->token + pull->token_len, pull->src + pull->offset, size);
+  pull->token_len += size;
+  pull->offset = end;
+  return json_pull_need_more;
+}
+
+/* reads a string or scalar token starting at (or continuing from) offset. */
+json_weak int json_pull_token(struct json_pull_s *pull);
+int json_pull_token(struct json_pull_s *pull) {
+  const size_t start = pull->offset;
+  const int is_split = pull->token_len > 0;
+  int plain = 1;
+  size_t end;
+  int ret;
+
+  if ('"' == pull->token_type) {
+    end = json_pull_string_end(pull->src, pull->size,
+                               is_split ? start : start + 1, &pull->escaped,
+                               &plain);
+    if (end == pull->size) {
+      ret = json_pull_gather(pull, end);
+      if (json_pull_need_more == ret && pull->is_last) {
+        ret = json_pull_fail(pull, json_parse_error_premature_end_of_buffer);
+      }
+      return ret;
+    }
+
+    /* include the closing quote. */
+    end++;
+  } else {
+    end = start;
+    while ((end < pull->size) && json_pull_is_scalar_char(pull->src[end])) {
+      end++;
+    }
+
+    if (end == pull->size && !pull->is_last) {
+      return json_pull_gather(pull, end);
+    }
+  }
+
+  pull->token_type = 0;
+
+  if (!is_split) {
+    /* the whole token is in this chunk, use it where it is. */
+    pull->offset = end;
+    if ('"' == pull->src[start] && plain) {
+      /* nothing to decode, terminate it over the closing quote. */
+      pull->src[end - 1] = '\0';
+      pull->value = pull->src + start + 1;
+      pull->value_size = end - start - 2;
+      return json_pull_finish_string(pull, json_null, 0);
+    }
+    if ('"' == pull->src[start]) {
+      return json_pull_finish_string(pull, pull->src + start, end - start);
+    }
+    return json_pull_finish_scalar(pull, pull->src + start, end - start);
+  }
+
+  ret = json_pull_gather(pull, end);
+  if (json_pull_error == ret) {
+    return ret;
+  }
+
+  end = pull->token_len;
+  pull->token_len = 0;
+  pull->token[end] = '\0';
+
+  if ('"' == pull->token[0]) {
+    return json_pull_finish_string(pull, pull->token, end);
+  }
+  return json_pull_finish_scalar(pull, pull->token, end);
+}
+
+int json_pull_next(struct json_pull_s *pull) {
+  if (json_parse_error_none != pull->error) {
+    return json_pull_error;
+  }
+
+  if (0 != pull->token_type) {
+    return json_pull_token(pull);
+  }
+
+  for (;;) {
+    const char *const src = pull->src;
+    char c;
+
+    while ((pull->offset < pull->size) &&
+           (' ' == src[pull->offset] || '\t' == src[pull->offset] ||
+            '\r' == src[pull->offset] || '\n' == src[pull->offset])) {
+      pull->offset++;
+    }
+
+    if (pull->offset >= pull->size) {
+      if (!pull->is_last) {
+        return json_pull_need_more;
+      }
+      if (json_pull_expect_done == pull->expect) {
+        return json_pull_end;
+      }
+      return json_pull_fail(pull, json_parse_error_premature_end_of_buffer);
+    }
+
+    c = src[pull->offset];
+
+    switch (pull->expect) {
+    case json_pull_expect_done:
+      return json_pull_fail(pull,
+                            json_parse_error_unexpected_trailing_characters);
+    case json_pull_expect_colon:
+      if (':' != c) {
+        return json_pull_fail(pull, json_parse_error_expected_colon);
+      }
+      pull->offset++;
+      pull->expect = json_pull_expect_value;
+      continue;
+    case json_pull_expect_comma_or_close:
+      if (',' == c) {
+        pull->offset++;
+        pull->expect = ('{' == pull->stack[pull->depth - 1])
+                           ? json_pull_expect_key
+                           : json_pull_expect_value;
+        continue;
+      }
+      if (('}' == c && '{' == pull->stack[pull->depth - 1]) ||
+          (']' == c && '[' == pull->stack[pull->depth - 1])) {
+        pull->offset++;
+        pull->depth--;
+        return json_pull_value_done(pull, ('}' == c) ? json_pull_object_end
+                                                     : json_pull_array_end);
+      }
+      return json_pull_fail(pull,
+                            json_parse_error_expected_comma_or_closing_bracket);
+    case json_pull_expect_key_or_close:
+      if ('}' == c) {
+        pull->offset++;
+        pull->depth--;
+        return json_pull_value_done(pull, json_pull_object_end);
+      }
+      /* fallthrough */
+    case json_pull_expect_key:
+      if ('"' != c) {
+        return json_pull_fail(pull, json_parse_error_expected_opening_quote);
+      }
+      pull->token_type = '"';
+      pull->token_is_key = 1;
+      return json_pull_token(pull);
+    case json_pull_expect_value_or_close:
+      if (']' == c) {
+        pull->offset++;
+        pull->depth--;
+        return json_pull_value_done(pull, json_pull_array_end);
+      }
+      /* fallthrough */
+    default:
+      break;
+    }
+
+    /* a value. */
+    if ('{' == c || '[' == c) {
+      if (pull->depth == JSON_PULL_MAX_DEPTH) {
+        return json_pull_fail(pull, json_parse_error_allocator_failed);
+      }
+
+      pull->stack[pull->depth++] = c;
+      pull->offset++;
+
+      if ('{' == c) {
+        pull->expect = json_pull_expect_key_or_close;
+        return json_pull_object_start;
+      }
+
+      pull->expect = json_pull_expect_value_or_close;
+      return json_pull_array_start;
+    }
+
+    if ('"' == c) {
+      pull->token_type = '"';
+    } else if ('-' == c || ('0' <= c && c <= '9') || 't' == c || 'f' == c ||
+               'n' == c) {
+      pull->token_type = 'n';
+    } else {
+      return json_pull_fail(pull, json_parse_error_invalid_value);
+    }
+
+    pull->token_is_key = 0;
+    return json_pull_token(pull);
+  }
+}
+
+struct json_extract_result_s {
+  size_t dom_size;
+  size_t data_size;
 };
 
 struct json_value_s *json_extract_value(const struct json_value_s *value) {
@@ -2336,6 +4326,9 @@ void json_extract_copy_value(struct json_extract_state_s *const state,
     object = (struct json_object_s *)state->dom;
     state->dom += sizeof(struct json_object_s);
 
+    /* the copy is not indexed, json_object_find() walks it. */
+    object->index = json_null;
+
     element = object->start;
     object->start = (struct json_object_element_s *)state->dom;
 
@@ -2476,6 +4469,35 @@ int json_value_is_null(const struct json_value_s *const value) {
   return value->type == json_type_null;
 }
 
+struct json_value_s *json_object_find(const struct json_object_s *const object,
+                                      const char *name, size_t name_size) {
+  const struct json_object_element_s *element;
+
+  if (json_null != object->index) {
+    size_t slot = json_object_key_hash(name, name_size) & object->index->mask;
+
+    for (; json_null != (element = object->index->slots[slot]);
+         slot = (slot + 1) & object->index->mask) {
+      if (element->name->string_size == name_size &&
+          0 == memcmp(element->name->string, name, name_size)) {
+        return element->value;
+      }
+    }
+
+    return json_null;
+  }
+
+  for (element = object->start; json_null != element;
+       element = element->next) {
+    if (element->name->string_size == name_size &&
+        0 == memcmp(element->name->string, name, name_size)) {
+      return element->value;
+    }
+  }
+
+  return json_null;
+}
+
 json_weak int
 json_write_minified_get_value_size(const struct json_value_s *value,
                                    size_t *size);
@@ -3091,6 +5113,256 @@ void *json_write_minified(const struct json_value_s *value, size_t *out_size) {
   return data;
 }
 
+size_t json_write_minified_into(const struct json_value_s *value,
+                                void *buffer, size_t buffer_size) {
+  size_t size = 0;
+  char *data_end;
+
+  if (json_null == value) {
+    return 0;
+  }
+
+  if (json_write_minified_get_value_size(value, &size)) {
+    /* value was malformed! */
+    return 0;
+  }
+
+  size += 1; /* for the '\0' null terminating character. */
+
+  if (size > buffer_size) {
+    return size;
+  }
+
+  data_end = json_write_minified_value(value, (char *)buffer);
+
+  if (json_null == data_end) {
+    /* bad chi occurred! */
+    return 0;
+  }
+
+  /* null terminated the string. */
+  *data_end = '\0';
+
+  return size;
+}
+
+struct json_write_stream_s {
+  char *buffer;
+  size_t buffer_size;
+  size_t used;
+  int (*write_func)(void *user_data, const char *data, size_t size);
+  void *user_data;
+};
+
+json_weak int json_write_stream_flush(struct json_write_stream_s *stream);
+int json_write_stream_flush(struct json_write_stream_s *stream) {
+  if (0 != stream->used &&
+      stream->write_func(stream->user_data, stream->buffer, stream->used)) {
+    return 1;
+  }
+
+  stream->used = 0;
+  return 0;
+}
+
+/* room for size bytes at the end of the buffer, null if they cannot fit. */
+json_weak char *json_write_stream_reserve(struct json_write_stream_s *stream,
+                                          size_t size);
+char *json_write_stream_reserve(struct json_write_stream_s *stream,
+                                size_t size) {
+  if (stream->buffer_size - stream->used < size) {
+    if (stream->buffer_size < size || json_write_stream_flush(stream)) {
+      return json_null;
+    }
+  }
+
+  return stream->buffer + stream->used;
+}
+
+json_weak int json_write_stream_bytes(struct json_write_stream_s *stream,
+                                      const char *data, size_t size);
+int json_write_stream_bytes(struct json_write_stream_s *stream,
+                            const char *data, size_t size) {
+  while (size > 0) {
+    size_t chunk = stream->buffer_size - stream->used;
+
+    if (0 == chunk) {
+      if (json_write_stream_flush(stream)) {
+        return 1;
+      }
+      chunk = stream->buffer_size;
+    }
+
+    if (chunk > size) {
+      chunk = size;
+    }
+
+    memcpy(stream->buffer + stream->used, data, chunk);
+    stream->used += chunk;
+    data += chunk;
+    size -= chunk;
+  }
+
+  return 0;
+}
+
+/* numbers and literals are written in place, they must fit in the buffer. */
+json_weak int json_write_stream_leaf(struct json_write_stream_s *stream,
+                                     const struct json_value_s *value);
+int json_write_stream_leaf(struct json_write_stream_s *stream,
+                           const struct json_value_s *value) {
+  size_t size = 0;
+  char *data;
+
+  if (json_write_minified_get_value_size(value, &size)) {
+    /* value was malformed! */
+    return 1;
+  }
+
+  data = json_write_stream_reserve(stream, size);
+
+  if (json_null == data) {
+    return 1;
+  }
+
+  if (json_null == json_write_minified_value(value, data)) {
+    return 1;
+  }
+
+  stream->used += size;
+  return 0;
+}
+
+json_weak int json_write_stream_string(struct json_write_stream_s *stream,
+                                       const struct json_string_s *string);
+int json_write_stream_string(struct json_write_stream_s *stream,
+                             const struct json_string_s *string) {
+  size_t size = 0;
+  size_t i;
+
+  if (json_write_get_string_size(string, &size)) {
+    /* string was malformed! */
+    return 1;
+  }
+
+  if (size <= stream->buffer_size) {
+    char *const data = json_write_stream_reserve(stream, size);
+
+    if (json_null == data) {
+      return 1;
+    }
+
+    stream->used += (size_t)(json_write_string(string, data) - data);
+    return 0;
+  }
+
+  /* longer than the buffer, escape it a character at a time. */
+  if (json_write_stream_bytes(stream, "\"", 1)) {
+    return 1;
+  }
+
+  for (i = 0; i < string->string_size; i++) {
+    struct json_string_s character;
+    char escaped[4];
+    size_t escaped_size;
+
+    character.string = string->string + i;
+    character.string_size = 1;
+
+    /* drop the surrounding '"' characters. */
+    escaped_size =
+        (size_t)(json_write_string(&character, escaped) - escaped) - 2;
+
+    if (json_write_stream_bytes(stream, escaped + 1, escaped_size)) {
+      return 1;
+    }
+  }
+
+  return json_write_stream_bytes(stream, "\"", 1);
+}
+
+json_weak int json_write_stream_value(struct json_write_stream_s *stream,
+                                      const struct json_value_s *value);
+int json_write_stream_value(struct json_write_stream_s *stream,
+                            const struct json_value_s *value) {
+  switch (value->type) {
+  default:
+    return json_write_stream_leaf(stream, value);
+  case json_type_string:
+    return json_write_stream_string(stream,
+                                    (struct json_string_s *)value->payload);
+  case json_type_array: {
+    const struct json_array_s *const array =
+        (struct json_array_s *)value->payload;
+    struct json_array_element_s *element;
+
+    if (json_write_stream_bytes(stream, "[", 1)) {
+      return 1;
+    }
+
+    for (element = array->start; json_null != element;
+         element = element->next) {
+      if (element != array->start && json_write_stream_bytes(stream, ",", 1)) {
+        return 1;
+      }
+
+      if (json_write_stream_value(stream, element->value)) {
+        return 1;
+      }
+    }
+
+    return json_write_stream_bytes(stream, "]", 1);
+  }
+  case json_type_object: {
+    const struct json_object_s *const object =
+        (struct json_object_s *)value->payload;
+    struct json_object_element_s *element;
+
+    if (json_write_stream_bytes(stream, "{", 1)) {
+      return 1;
+    }
+
+    for (element = object->start; json_null != element;
+         element = element->next) {
+      if (element != object->start && json_write_stream_bytes(stream, ",", 1)) {
+        return 1;
+      }
+
+      if (json_write_stream_string(stream, element->name) ||
+          json_write_stream_bytes(stream, ":", 1) ||
+          json_write_stream_value(stream, element->value)) {
+        return 1;
+      }
+    }
+
+    return json_write_stream_bytes(stream, "}", 1);
+  }
+  }
+}
+
+int json_write_minified_stream(
+    const struct json_value_s *value, void *buffer, size_t buffer_size,
+    int (*write_func)(void *user_data, const char *data, size_t size),
+    void *user_data) {
+  struct json_write_stream_s stream;
+
+  if (json_null == value || json_null == buffer || 0 == buffer_size) {
+    return 1;
+  }
+
+  stream.buffer = (char *)buffer;
+  stream.buffer_size = buffer_size;
+  stream.used = 0;
+  stream.write_func = write_func;
+  stream.user_data = user_data;
+
+  if (json_write_stream_value(&stream, value)) {
+    return 1;
+  }
+
+  return json_write_stream_flush(&stream);
+}
+
 json_weak int json_write_pretty_get_value_size(const struct json_value_s *value,
                                                size_t depth, size_t indent_size,
                                                size_t newline_size,
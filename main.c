@@ -1,32 +1,52 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "server.h"
 #include "client.h"
 
 
-#define SERVER_SOCKET_FILE "/tmp/kvrt.sock"
+#define SERVER_SOCKET_FILE  "/tmp/kvrt.sock"
+#define SERVER_HISTORY_FILE "/tmp/kvrt.history"
+#define SERVER_STATUS_PAGE  "/kvrt.status"
 
 
-static int  _run_client(const char cmd[]);
-static int  _run_server(void);
+static int  _run_client(const char *cmds[], int len);
+static int  _run_server(const char interval[], const char history_file[]);
 
 
 /*
  * function impls
  */
 static int
-_run_client(const char cmd[])
+_run_client(const char *cmds[], int len)
 {
-	return -client_run(SERVER_SOCKET_FILE, cmd);
+	return -client_run(SERVER_SOCKET_FILE, SERVER_STATUS_PAGE, cmds, len);
 }
 
 
+/* "interval": ms between status samples, "history_file": where the history
+ * outlives the server, "-": nowhere. NULL: the defaults */
 static int
-_run_server(void)
+_run_server(const char interval[], const char history_file[])
 {
+	unsigned long ms = SERVER_STATUS_INTERVAL;
+	if (interval != NULL) {
+		char *end;
+		ms = strtoul(interval, &end, 10);
+		if ((end == interval) || (*end != '\0') || (ms == 0) || (ms > 3600000)) {
+			fprintf(stderr, "invalid status interval: %s\n", interval);
+			return 1;
+		}
+	}
+
+	if (history_file == NULL)
+		history_file = SERVER_HISTORY_FILE;
+	else if (strcmp(history_file, "-") == 0)
+		history_file = NULL;
+
 	Server server;
-	if (server_init(&server, SERVER_SOCKET_FILE) < 0)
+	if (server_init(&server, SERVER_SOCKET_FILE, (unsigned)ms, history_file, SERVER_STATUS_PAGE) < 0)
 		return 1;
 
 	return -server_run(&server);
@@ -43,11 +63,11 @@ main(int argc, char *argv[])
 		return 1;
 
 	if (strcmp(argv[1], "client") == 0) {
-		if (argc == 3)
-			return _run_client(argv[2]);
+		if (argc >= 3)
+			return _run_client((const char **)&argv[2], argc - 2);
 	} else if (strcmp(argv[1], "server") == 0) {
-		if (argc == 2)
-			return _run_server();
+		if (argc <= 4)
+			return _run_server(argv[2], (argc == 4) ? argv[3] : NULL);
 	}
 
 	return 1;
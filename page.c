@@ -0,0 +1,209 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "page.h"
+
+
+#define PAGE_MAGIC   (0x70737675u)   /* "uvsp" */
+#define PAGE_VERSION (2)
+
+/* a write takes well under a microsecond, a reader spinning this long has
+ * lost to a stopped writer */
+#define PAGE_READ_TRIES (1024)
+
+_Static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "the sequence must be lock free to be shared");
+
+
+static void *_map(const char name[], int flags, size_t size);
+
+
+/*
+ * public
+ */
+int
+page_create(Page *p, const char name[], unsigned interval)
+{
+	memset(p, 0, sizeof(*p));
+
+	/* a new object: readers still mapping a crashed server's see it go stale */
+	shm_unlink(name);
+	const int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		perror("page: page_create: shm_open");
+		return -1;
+	}
+
+	const size_t size = sizeof(PageData);
+	if (ftruncate(fd, (off_t)size) < 0) {
+		perror("page: page_create: ftruncate");
+		close(fd);
+		shm_unlink(name);
+		return -1;
+	}
+
+	close(fd);
+	PageData *const d = _map(name, O_RDWR, size);
+	if (d == NULL) {
+		shm_unlink(name);
+		return -1;
+	}
+
+	d->interval = interval;
+	d->cpus_max = PAGE_CPUS_MAX;
+	d->version = PAGE_VERSION;
+	atomic_store_explicit(&d->seq, 0, memory_order_relaxed);
+	d->magic = PAGE_MAGIC;
+
+	p->data = d;
+	p->size = size;
+	p->name = name;
+	return 0;
+}
+
+
+int
+page_open(Page *p, const char name[])
+{
+	memset(p, 0, sizeof(*p));
+
+	const size_t size = sizeof(PageData);
+	PageData *const d = _map(name, O_RDONLY, size);
+	if (d == NULL)
+		return -1;
+
+	if ((d->magic != PAGE_MAGIC) || (d->version != PAGE_VERSION) || (d->cpus_max != PAGE_CPUS_MAX)) {
+		munmap(d, size);
+		return -1;
+	}
+
+	p->data = d;
+	p->size = size;
+	return 0;
+}
+
+
+void
+page_close(Page *p)
+{
+	if (p->data != NULL)
+		munmap(p->data, p->size);
+
+	if (p->name != NULL)
+		shm_unlink(p->name);
+
+	memset(p, 0, sizeof(*p));
+}
+
+
+int
+page_write(Page *p, const IpcBodyStatus *s, uint64_t time)
+{
+	PageData *const d = p->data;
+	if (s->cpus.len > PAGE_CPUS_MAX)
+		return -1;
+
+	const uint64_t seq = atomic_load_explicit(&d->seq, memory_order_relaxed);
+	atomic_store_explicit(&d->seq, seq + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+
+	d->time = time;
+	d->sample = s->version;
+	d->memory_usage = s->memory_usage;
+	d->memory_capacity = s->memory_capacity;
+	d->cpu_cores = s->cpu_cores;
+	d->cpu = s->cpu;
+	d->cpus_len = s->cpus.len;
+	if (s->cpus.len > 0)
+		memcpy(d->cpus, s->cpus.list, sizeof(IpcCpu) * s->cpus.len);
+
+	atomic_store_explicit(&d->seq, seq + 2, memory_order_release);
+	return 0;
+}
+
+
+int
+page_read(const Page *p, IpcBodyStatus *s, IpcCpu cpus[], uint64_t *time)
+{
+	const PageData *const d = p->data;
+	for (int i = 0; i < PAGE_READ_TRIES; i++) {
+		const uint64_t seq = atomic_load_explicit(&d->seq, memory_order_acquire);
+		if (seq == 0)
+			return -1;
+
+		if (seq & 1)
+			continue;
+
+		/* may be torn, only trusted once "seq" is seen unchanged */
+		const uint64_t t = d->time;
+		s->version = d->sample;
+		s->memory_usage = (size_t)d->memory_usage;
+		s->memory_capacity = (size_t)d->memory_capacity;
+		s->cpu_cores = d->cpu_cores;
+		s->cpu = d->cpu;
+
+		uint32_t len = d->cpus_len;
+		if (len > PAGE_CPUS_MAX)
+			len = PAGE_CPUS_MAX;
+
+		memcpy(cpus, d->cpus, sizeof(IpcCpu) * len);
+
+		atomic_thread_fence(memory_order_acquire);
+		if (atomic_load_explicit(&d->seq, memory_order_relaxed) != seq)
+			continue;
+
+		s->cpus = (IpcCpus) { .len = len, .list = cpus };
+
+		/* clock_gettime() is served by the vdso */
+		struct timespec ts;
+		clock_gettime(CLOCK_REALTIME, &ts);
+
+		const uint64_t now = ((uint64_t)ts.tv_sec * 1000) + ((uint64_t)ts.tv_nsec / 1000000);
+		if ((now > t) && ((now - t) > ((uint64_t)d->interval * PAGE_STALE) + 1000))
+			return -1;
+
+		*time = t;
+		return 0;
+	}
+
+	return -1;
+}
+
+
+/*
+ * private
+ */
+static void *
+_map(const char name[], int flags, size_t size)
+{
+	const int fd = shm_open(name, flags | O_CLOEXEC, 0);
+	if (fd < 0) {
+		/* no page: no server publishing one */
+		if (flags != O_RDONLY)
+			perror("page: _map: shm_open");
+
+		return NULL;
+	}
+
+	/* a shorter one would fault past its end */
+	struct stat st;
+	if ((fstat(fd, &st) < 0) || ((size_t)st.st_size < size)) {
+		close(fd);
+		return NULL;
+	}
+
+	const int prot = (flags == O_RDONLY) ? PROT_READ : (PROT_READ | PROT_WRITE);
+	void *const ret = mmap(NULL, size, prot, MAP_SHARED, fd, 0);
+	close(fd);
+	if (ret == MAP_FAILED) {
+		perror("page: _map: mmap");
+		return NULL;
+	}
+
+	return ret;
+}
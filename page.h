@@ -0,0 +1,58 @@
+#ifndef __PAGE_H__
+#define __PAGE_H__
+
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "ipc.h"
+
+
+#define PAGE_CPUS_MAX (1024)
+
+/* older than this many intervals: the server is gone */
+#define PAGE_STALE    (3)
+
+
+/* the latest status, in shared memory. Written by the server only, under a
+ * sequence lock: "seq" is odd while it is being written, readers copy it out
+ * and retry when "seq" moved meanwhile */
+typedef struct {
+	uint32_t         magic;
+	uint32_t         version;
+	uint32_t         interval;    /* ms between the samples */
+	uint32_t         cpus_max;
+	_Atomic uint64_t seq;         /* 0: nothing yet */
+	uint64_t         time;        /* of the sample, ms since the epoch */
+	uint64_t         sample;      /* its version, as in status responses */
+	uint64_t         memory_usage;
+	uint64_t         memory_capacity;
+	uint32_t         cpu_cores;
+	uint32_t         cpus_len;
+	IpcCpu           cpu;
+	IpcCpu           cpus[PAGE_CPUS_MAX];
+} PageData;
+
+typedef struct {
+	PageData   *data;
+	size_t      size;
+	const char *name;    /* unlinked on close, the server's only */
+} Page;
+
+
+/* the server's, "name": a shm_open() name, e.g. "/kvrt.status" */
+int  page_create(Page *p, const char name[], unsigned interval);
+
+/* a reader's, mapped read only */
+int  page_open(Page *p, const char name[]);
+void page_close(Page *p);
+
+/* -1: too many cpus for the page, it keeps the previous status */
+int  page_write(Page *p, const IpcBodyStatus *s, uint64_t time);
+
+/* a consistent copy without a syscall, "cpus": room for PAGE_CPUS_MAX.
+ * -1: nothing yet, stale, or rewritten on every try */
+int  page_read(const Page *p, IpcBodyStatus *s, IpcCpu cpus[], uint64_t *time);
+
+
+#endif
@@ -0,0 +1,486 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "procs.h"
+
+
+#define PROC_DIR      "/proc"
+#define SEEN_SIZE_MIN (1024)
+
+
+static void       _scan_begin(Procs *p);
+static void       _scan_one(Procs *p, int pid, uint64_t now);
+static void       _scan_finish(Procs *p, IpcBodyTop *top);
+static void       _keep_fds(Procs *p, const ProcsItem items[], unsigned len);
+static int        _read_stat(Procs *p, int pid, int *fd, size_t *len);
+static int        _parse_stat(const char buf[], size_t len, ProcsItem *item, uint64_t *start, uint64_t *ticks);
+static uint64_t   _parse_field(const char **p, const char *end);
+static ProcsSeen *_seen_find(ProcsSeen seen[], unsigned size, int pid);
+static int        _seen_grow(Procs *p);
+static uint64_t   _heap_key(const ProcsItem *item, int by_cpu);
+static void       _heap_add(ProcsItem heap[], unsigned *len, const ProcsItem *item, int by_cpu);
+static void       _heap_down(ProcsItem heap[], unsigned len, unsigned i, int by_cpu);
+static void       _heap_sort(ProcsItem heap[], unsigned len, int by_cpu);
+static uint64_t   _now_ms(clockid_t clock);
+
+
+/*
+ * public
+ */
+int
+procs_init(Procs *p)
+{
+	memset(p, 0, sizeof(*p));
+	p->dir_fd = -1;
+
+	p->dir = opendir(PROC_DIR);
+	if (p->dir == NULL) {
+		perror("procs: procs_init: opendir: " PROC_DIR);
+		return -1;
+	}
+
+	p->dir_fd = dirfd(p->dir);
+	p->page_size = sysconf(_SC_PAGESIZE);
+	p->hz = sysconf(_SC_CLK_TCK);
+	if ((p->page_size <= 0) || (p->hz <= 0)) {
+		perror("procs: procs_init: sysconf");
+		goto err0;
+	}
+
+	for (int i = 0; i < 2; i++) {
+		p->seen[i] = calloc(SEEN_SIZE_MIN, sizeof(ProcsSeen));
+		if (p->seen[i] == NULL) {
+			perror("procs: procs_init: calloc");
+			goto err0;
+		}
+
+		p->seen_size[i] = SEEN_SIZE_MIN;
+	}
+
+	return 0;
+
+err0:
+	procs_deinit(p);
+	return -1;
+}
+
+
+void
+procs_deinit(Procs *p)
+{
+	for (int i = 0; i < 2; i++) {
+		for (unsigned j = 0; j < p->seen_size[i]; j++) {
+			const ProcsSeen *const e = &p->seen[i][j];
+			if ((e->pid != 0) && (e->fd >= 0))
+				close(e->fd);
+		}
+
+		free(p->seen[i]);
+	}
+
+	if (p->dir != NULL)
+		closedir(p->dir);
+
+	memset(p, 0, sizeof(*p));
+	p->dir_fd = -1;
+}
+
+
+int
+procs_scan(Procs *p, IpcBodyTop *top)
+{
+	if (p->is_scanning == 0)
+		_scan_begin(p);
+
+	const uint64_t now = _now_ms(CLOCK_BOOTTIME);
+	for (int i = 0; i < PROCS_CHUNK;) {
+		errno = 0;
+		const struct dirent *const e = readdir(p->dir);
+		if (e == NULL) {
+			if (errno != 0) {
+				perror("procs: procs_scan: readdir");
+				p->is_scanning = 0;
+				return -1;
+			}
+
+			_scan_finish(p, top);
+			return 1;
+		}
+
+		/* the rest of /proc is not a process */
+		char *end;
+		const long pid = strtol(e->d_name, &end, 10);
+		if ((*end != '\0') || (pid <= 0))
+			continue;
+
+		_scan_one(p, (int)pid, now);
+		i++;
+	}
+
+	return 0;
+}
+
+
+/*
+ * private
+ */
+/* the finished scan becomes the previous one, the one before it has no fds
+ * left, see _scan_finish() */
+static void
+_scan_begin(Procs *p)
+{
+	p->cur ^= 1;
+	memset(p->seen[p->cur], 0, sizeof(ProcsSeen) * p->seen_size[p->cur]);
+	p->seen_len[p->cur] = 0;
+	p->count = 0;
+	p->by_rss_len = 0;
+	p->by_cpu_len = 0;
+	p->is_scanning = 1;
+	rewinddir(p->dir);
+}
+
+
+/* a process gone meanwhile is skipped, it was not there */
+static void
+_scan_one(Procs *p, int pid, uint64_t now)
+{
+	const unsigned prev_i = p->cur ^ 1;
+	ProcsSeen *const prev = _seen_find(p->seen[prev_i], p->seen_size[prev_i], pid);
+
+	/* an open stat file moves on to this scan's entry */
+	int fd = -1;
+	if (prev->pid == pid) {
+		fd = prev->fd;
+		prev->fd = -1;
+	}
+
+	size_t len;
+	if (_read_stat(p, pid, &fd, &len) < 0)
+		return;
+
+	ProcsItem item = { .pid = pid };
+	uint64_t start, ticks;
+	if (_parse_stat(p->buffer, len, &item, &start, &ticks) < 0)
+		goto err0;
+
+	item.rss *= (uint64_t)p->page_size;
+
+	/* since the previous scan, or since the start of a new process */
+	const uint64_t hz = (uint64_t)p->hz;
+	uint64_t used = ticks;
+	uint64_t since = (start * 1000) / hz;
+	if ((prev->pid == pid) && (prev->start == start) && (ticks >= prev->ticks)) {
+		used = ticks - prev->ticks;
+		since = prev->at;
+	}
+
+	const uint64_t cpu = (now > since) ? (used * 10000000) / (hz * (now - since)) : 0;
+	item.cpu = (cpu > (unsigned)-1) ? (unsigned)-1 : (unsigned)cpu;
+
+	if (((p->seen_len[p->cur] + 1) * 2 > p->seen_size[p->cur]) && (_seen_grow(p) < 0))
+		goto err0;
+
+	ProcsSeen *const seen = _seen_find(p->seen[p->cur], p->seen_size[p->cur], pid);
+	*seen = (ProcsSeen) { .pid = pid, .fd = fd, .start = start, .ticks = ticks, .at = now };
+	p->seen_len[p->cur]++;
+	p->count++;
+
+	/* kernel threads have no rss, idle processes no place among the busy */
+	if (item.rss > 0)
+		_heap_add(p->by_rss, &p->by_rss_len, &item, 0);
+	if (item.cpu > 0)
+		_heap_add(p->by_cpu, &p->by_cpu_len, &item, 1);
+
+	return;
+
+err0:
+	if (fd >= 0)
+		close(fd);
+}
+
+
+static void
+_scan_finish(Procs *p, IpcBodyTop *top)
+{
+	p->is_scanning = 0;
+
+	/* what is left in the previous table did not show up again */
+	ProcsSeen *const prev = p->seen[p->cur ^ 1];
+	for (unsigned i = 0; i < p->seen_size[p->cur ^ 1]; i++) {
+		if ((prev[i].pid != 0) && (prev[i].fd >= 0)) {
+			close(prev[i].fd);
+			prev[i].fd = -1;
+		}
+	}
+
+	_heap_sort(p->by_rss, p->by_rss_len, 0);
+	_heap_sort(p->by_cpu, p->by_cpu_len, 1);
+	_keep_fds(p, p->by_rss, p->by_rss_len);
+	_keep_fds(p, p->by_cpu, p->by_cpu_len);
+
+	/* and the stat files of the others are closed */
+	ProcsSeen *const cur = p->seen[p->cur];
+	for (unsigned i = 0; i < p->seen_size[p->cur]; i++) {
+		ProcsSeen *const e = &cur[i];
+		if ((e->pid != 0) && !e->is_kept && (e->fd >= 0)) {
+			close(e->fd);
+			e->fd = -1;
+		}
+
+		e->is_kept = 0;
+	}
+
+	const ProcsItem *const heaps[2] = { p->by_rss, p->by_cpu };
+	const unsigned lens[2] = { p->by_rss_len, p->by_cpu_len };
+	for (int k = 0; k < 2; k++) {
+		ProcsItem *const out = p->out[p->list][k];
+		IpcProc *const list = p->lists[p->list][k];
+		memcpy(out, heaps[k], sizeof(ProcsItem) * lens[k]);
+		for (unsigned i = 0; i < lens[k]; i++) {
+			list[i] = (IpcProc) {
+				.pid = (unsigned)out[i].pid,
+				.name = { .str = out[i].name, .len = strlen(out[i].name) },
+				.rss = (size_t)out[i].rss,
+				.cpu = out[i].cpu,
+			};
+		}
+	}
+
+	top->time = _now_ms(CLOCK_REALTIME);
+	top->count = p->count;
+	top->by_rss = (IpcProcs) { .len = lens[0], .list = p->lists[p->list][0] };
+	top->by_cpu = (IpcProcs) { .len = lens[1], .list = p->lists[p->list][1] };
+	p->list ^= 1;
+}
+
+
+/* the processes in the tables are likely to be again, their stat files stay
+ * open and are reread with pread() */
+static void
+_keep_fds(Procs *p, const ProcsItem items[], unsigned len)
+{
+	for (unsigned i = 0; i < len; i++) {
+		ProcsSeen *const e = _seen_find(p->seen[p->cur], p->seen_size[p->cur], items[i].pid);
+		if (e->pid != items[i].pid)
+			continue;
+
+		e->is_kept = 1;
+		if (e->fd >= 0)
+			continue;
+
+		char path[24];
+		snprintf(path, sizeof(path), "%d/stat", e->pid);
+		e->fd = openat(p->dir_fd, path, O_RDONLY | O_CLOEXEC);
+	}
+}
+
+
+/* into p->buffer, through "fd" when it is open. A kept fd that fails belongs
+ * to a process gone, the pid may be another one's by now */
+static int
+_read_stat(Procs *p, int pid, int *fd, size_t *len)
+{
+	if (*fd >= 0) {
+		const ssize_t rd = pread(*fd, p->buffer, sizeof(p->buffer), 0);
+		if (rd > 0) {
+			*len = (size_t)rd;
+			return 0;
+		}
+
+		close(*fd);
+		*fd = -1;
+	}
+
+	char path[24];
+	snprintf(path, sizeof(path), "%d/stat", pid);
+	const int tmp = openat(p->dir_fd, path, O_RDONLY | O_CLOEXEC);
+	if (tmp < 0)
+		return -1;
+
+	const ssize_t rd = pread(tmp, p->buffer, sizeof(p->buffer), 0);
+	close(tmp);
+	if (rd <= 0)
+		return -1;
+
+	*len = (size_t)rd;
+	return 0;
+}
+
+
+/* "pid (name) state ppid ...": the name may hold anything, ')' too, the
+ * fields after it are numbers. "rss" in pages */
+static int
+_parse_stat(const char buf[], size_t len, ProcsItem *item, uint64_t *start, uint64_t *ticks)
+{
+	const char *const end = buf + len;
+	const char *const first = memchr(buf, '(', len);
+	const char *const last = memrchr(buf, ')', len);
+	if ((first == NULL) || (last == NULL) || (last < first) || ((end - last) < 4))
+		return -1;
+
+	size_t name_len = (size_t)(last - first - 1);
+	if (name_len >= PROCS_NAME_MAX)
+		name_len = PROCS_NAME_MAX - 1;
+
+	memcpy(item->name, first + 1, name_len);
+	item->name[name_len] = '\0';
+
+	/* fields 4 to 24: utime 14, stime 15, starttime 22, rss 24 (in pages) */
+	uint64_t v[21];
+	const char *p = last + 3;
+	for (int i = 0; i < 21; i++)
+		v[i] = _parse_field(&p, end);
+
+	if (p >= end)
+		return -1;
+
+	*ticks = v[10] + v[11];
+	*start = v[18];
+	item->rss = v[20];
+	return 0;
+}
+
+
+/* skips the blanks and a minus sign in front, stops at the first non-digit */
+static uint64_t
+_parse_field(const char **p, const char *end)
+{
+	const char *s = *p;
+	while ((s < end) && (*s == ' '))
+		s++;
+
+	if ((s < end) && (*s == '-'))
+		s++;
+
+	uint64_t ret = 0;
+	for (; (s < end) && ((unsigned)(*s - '0') <= 9); s++)
+		ret = (ret * 10) + (uint64_t)(*s - '0');
+
+	*p = s;
+	return ret;
+}
+
+
+/* the entry of "pid", or the free slot it would go to */
+static ProcsSeen *
+_seen_find(ProcsSeen seen[], unsigned size, int pid)
+{
+	unsigned i = ((unsigned)pid * 2654435761u) & (size - 1);
+	while ((seen[i].pid != 0) && (seen[i].pid != pid))
+		i = (i + 1) & (size - 1);
+
+	return &seen[i];
+}
+
+
+/* kept at most half full */
+static int
+_seen_grow(Procs *p)
+{
+	const unsigned old_size = p->seen_size[p->cur];
+	const unsigned size = old_size * 2;
+	ProcsSeen *const seen = calloc(size, sizeof(ProcsSeen));
+	if (seen == NULL) {
+		perror("procs: _seen_grow: calloc");
+		return -1;
+	}
+
+	ProcsSeen *const old = p->seen[p->cur];
+	for (unsigned i = 0; i < old_size; i++) {
+		if (old[i].pid != 0)
+			*_seen_find(seen, size, old[i].pid) = old[i];
+	}
+
+	free(old);
+	p->seen[p->cur] = seen;
+	p->seen_size[p->cur] = size;
+	return 0;
+}
+
+
+static uint64_t
+_heap_key(const ProcsItem *item, int by_cpu)
+{
+	return (by_cpu) ? item->cpu : item->rss;
+}
+
+
+/* keeps the PROCS_TOP_MAX biggest, the smallest of them at the root */
+static void
+_heap_add(ProcsItem heap[], unsigned *len, const ProcsItem *item, int by_cpu)
+{
+	const uint64_t key = _heap_key(item, by_cpu);
+	if (*len < PROCS_TOP_MAX) {
+		unsigned i = (*len)++;
+		while (i > 0) {
+			const unsigned parent = (i - 1) / 2;
+			if (_heap_key(&heap[parent], by_cpu) <= key)
+				break;
+
+			heap[i] = heap[parent];
+			i = parent;
+		}
+
+		heap[i] = *item;
+		return;
+	}
+
+	if (key <= _heap_key(&heap[0], by_cpu))
+		return;
+
+	heap[0] = *item;
+	_heap_down(heap, *len, 0, by_cpu);
+}
+
+
+static void
+_heap_down(ProcsItem heap[], unsigned len, unsigned i, int by_cpu)
+{
+	const ProcsItem item = heap[i];
+	const uint64_t key = _heap_key(&item, by_cpu);
+	for (;;) {
+		unsigned child = (i * 2) + 1;
+		if (child >= len)
+			break;
+
+		if (((child + 1) < len) && (_heap_key(&heap[child + 1], by_cpu) < _heap_key(&heap[child], by_cpu)))
+			child++;
+
+		if (key <= _heap_key(&heap[child], by_cpu))
+			break;
+
+		heap[i] = heap[child];
+		i = child;
+	}
+
+	heap[i] = item;
+}
+
+
+/* the biggest first: the root goes behind the heap, one at a time */
+static void
+_heap_sort(ProcsItem heap[], unsigned len, int by_cpu)
+{
+	for (unsigned n = len; n > 1; n--) {
+		const ProcsItem min = heap[0];
+		heap[0] = heap[n - 1];
+		heap[n - 1] = min;
+		_heap_down(heap, n - 1, 0, by_cpu);
+	}
+}
+
+
+static uint64_t
+_now_ms(clockid_t clock)
+{
+	struct timespec ts;
+	clock_gettime(clock, &ts);
+	return ((uint64_t)ts.tv_sec * 1000) + ((uint64_t)ts.tv_nsec / 1000000);
+}
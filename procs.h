@@ -0,0 +1,74 @@
+#ifndef __PROCS_H__
+#define __PROCS_H__
+
+
+#include <dirent.h>
+#include <stdint.h>
+
+#include "ipc.h"
+
+
+/* entries a list */
+#define PROCS_TOP_MAX (32)
+
+/* processes read per procs_scan() call */
+#define PROCS_CHUNK   (256)
+
+/* /proc/[pid]/comm: 15 bytes and the '\0' */
+#define PROCS_NAME_MAX (16)
+
+
+/* what a scan keeps of a process for the next one, in a table hashed by pid */
+typedef struct {
+	int      pid;        /* 0: a free slot */
+	int      fd;         /* its stat file, open while it is in the tables, else -1 */
+	uint64_t start;      /* in ticks since boot, a new one: the pid was reused */
+	uint64_t ticks;      /* user + system */
+	uint64_t at;         /* ms since boot, when "ticks" was read */
+	int      is_kept;
+} ProcsSeen;
+
+typedef struct {
+	int      pid;
+	uint64_t rss;
+	unsigned cpu;
+	char     name[PROCS_NAME_MAX];
+} ProcsItem;
+
+/* the scanner: the directory, the pid tables and the heaps are allocated
+ * once and reused by every scan. "seen[cur]" is filled by the scan under
+ * way, looking up the previous one in the other. The finished lists go to
+ * "out" and "lists", used in turns */
+typedef struct {
+	DIR        *dir;
+	int         dir_fd;
+	long        page_size;
+	long        hz;
+	int         is_scanning;
+	unsigned    count;
+	ProcsSeen  *seen[2];
+	unsigned    seen_size[2];   /* a power of two */
+	unsigned    seen_len[2];
+	unsigned    cur;
+	ProcsItem   by_rss[PROCS_TOP_MAX];   /* min heaps: the root is the first to go */
+	unsigned    by_rss_len;
+	ProcsItem   by_cpu[PROCS_TOP_MAX];
+	unsigned    by_cpu_len;
+	ProcsItem   out[2][2][PROCS_TOP_MAX];
+	IpcProc     lists[2][2][PROCS_TOP_MAX];
+	unsigned    list;
+	char        buffer[1024];   /* a stat file */
+} Procs;
+
+
+int  procs_init(Procs *p);
+void procs_deinit(Procs *p);
+
+/* reads the next PROCS_CHUNK processes, a scan starts with the first call
+ * after the previous one finished. Returns 1 and the tables in "top" when
+ * the scan is done, they point into "p" and stay valid until the second
+ * scan after this one is done. 0: more to read, -1: /proc failed */
+int  procs_scan(Procs *p, IpcBodyTop *top);
+
+
+#endif
@@ -0,0 +1,500 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "series.h"
+
+
+#define SERIES_MAGIC   "uvipcts"
+#define SERIES_VERSION (1)
+
+/* the worst case: 4 + 32 bits of time, 2 + 5 + 6 + 64 bits a value */
+#define SERIES_POINT_BITS_MAX (36 + (SERIES_VALUES * 77))
+#define SERIES_BLOCK_BITS     ((uint32_t)SERIES_BLOCK_SIZE * 8)
+
+_Static_assert(sizeof(SeriesHeader) <= SERIES_HEADER_SIZE, "the block index must fit the header page");
+_Static_assert(sizeof(SERIES_MAGIC) == 8, "SERIES_MAGIC must fill SeriesHeader.magic");
+
+
+/* msb first */
+typedef struct {
+	uint8_t  *buf;
+	uint32_t  pos;    /* in bits */
+	uint32_t  end;
+} Bits;
+
+
+static void     _bits_put(Bits *b, uint64_t v, unsigned n);
+static int      _bits_get(Bits *b, unsigned n, uint64_t *v);
+static int      _header_check(const SeriesHeader *h);
+static void     _header_reset(SeriesHeader *h);
+static void     _state_reset(SeriesState *st, uint64_t time);
+static void     _state_check(SeriesState *st);
+static uint8_t *_block_at(const Series *s, unsigned block);
+static void     _block_start(Series *s, uint64_t time);
+static int      _block_decode(const Series *s, unsigned block, uint64_t from, SeriesFn fn, void *udata,
+			      SeriesState *st);
+static void     _encode_time(Bits *b, SeriesState *st, uint64_t time);
+static void     _encode_value(Bits *b, SeriesState *st, int i, uint64_t v);
+static int      _decode_time(Bits *b, SeriesState *st);
+static int      _decode_value(Bits *b, SeriesState *st, int i);
+
+
+/*
+ * public
+ */
+int
+series_open(Series *s, const char path[])
+{
+	memset(s, 0, sizeof(*s));
+	s->size = SERIES_HEADER_SIZE + ((size_t)SERIES_BLOCKS * SERIES_BLOCK_SIZE);
+	s->fd = open(path, O_RDWR | O_CREAT | O_NOFOLLOW | O_CLOEXEC, 0644);
+	if (s->fd < 0) {
+		perror("series: series_open: open");
+		return -1;
+	}
+
+	struct stat st;
+	if (fstat(s->fd, &st) < 0) {
+		perror("series: series_open: fstat");
+		goto err0;
+	}
+
+	/* only an empty file is sized, anything else is not ours to overwrite */
+	const int is_new = (st.st_size == 0);
+	if (!S_ISREG(st.st_mode) || ((is_new == 0) && ((size_t)st.st_size != s->size))) {
+		fprintf(stderr, "series: series_open: %s: not a series file\n", path);
+		goto err0;
+	}
+
+	/* allocated up front, writing to the mapping never waits for free blocks */
+	if (is_new) {
+		const int ret = posix_fallocate(s->fd, 0, (off_t)s->size);
+		if (ret != 0) {
+			errno = ret;
+			perror("series: series_open: posix_fallocate");
+			goto err0;
+		}
+	}
+
+	/* nothing is read here but the header page and the newest block */
+	s->map = mmap(NULL, s->size, PROT_READ | PROT_WRITE, MAP_SHARED, s->fd, 0);
+	if (s->map == MAP_FAILED) {
+		perror("series: series_open: mmap");
+		goto err0;
+	}
+
+	/* all zeros: sized here by a run that ended before the reset */
+	static const SeriesHeader blank;
+	s->header = (SeriesHeader *)s->map;
+	if (is_new || (memcmp(s->header, &blank, sizeof(blank)) == 0)) {
+		_header_reset(s->header);
+	} else if (_header_check(s->header) < 0) {
+		fprintf(stderr, "series: series_open: %s: not a series file of this version\n", path);
+		goto err1;
+	}
+
+	for (unsigned i = 1; i < SERIES_BLOCKS; i++) {
+		if (s->header->index[i].seq > s->header->index[s->block].seq)
+			s->block = i;
+	}
+
+	/* carries on where the newest block ends, it starts over if torn */
+	SeriesIndex *const ix = &s->header->index[s->block];
+	if ((ix->count > 0) && (_block_decode(s, s->block, 0, NULL, NULL, &s->state) < 0)) {
+		ix->count = 0;
+		ix->bits = 0;
+	}
+
+	return 0;
+
+err1:
+	munmap(s->map, s->size);
+err0:
+	close(s->fd);
+	memset(s, 0, sizeof(*s));
+	s->fd = -1;
+	return -1;
+}
+
+
+void
+series_close(Series *s)
+{
+	/* no msync(), the kernel writes the pages back on its own */
+	if (s->map != NULL)
+		munmap(s->map, s->size);
+
+	if (s->fd >= 0)
+		close(s->fd);
+
+	memset(s, 0, sizeof(*s));
+	s->fd = -1;
+}
+
+
+void
+series_append(Series *s, const IpcSample *point)
+{
+	SeriesIndex *ix = &s->header->index[s->block];
+	if ((ix->count > 0) && (point->time <= s->state.time))
+		return;
+
+	/* a new block when full, or when the time jumps past 32 bits */
+	const int64_t dod = (int64_t)(point->time - s->state.time) - s->state.delta;
+	if ((ix->count == 0) || ((ix->bits + SERIES_POINT_BITS_MAX) > SERIES_BLOCK_BITS) ||
+	    (dod < INT32_MIN) || (dod > INT32_MAX)) {
+		_block_start(s, point->time);
+		ix = &s->header->index[s->block];
+	}
+
+	const uint64_t values[SERIES_VALUES] = {
+		point->memory_min, point->memory_avg, point->memory_max,
+		point->cpu_min, point->cpu_avg, point->cpu_max,
+	};
+
+	Bits b = { .buf = _block_at(s, s->block), .pos = ix->bits, .end = SERIES_BLOCK_BITS };
+	_encode_time(&b, &s->state, point->time);
+	for (int i = 0; i < SERIES_VALUES; i++)
+		_encode_value(&b, &s->state, i, values[i]);
+
+	_state_check(&s->state);
+
+	/* published after the bits they cover */
+	ix->check = s->state.check;
+	ix->bits = b.pos;
+	ix->last_time = point->time;
+	ix->count++;
+}
+
+
+void
+series_read(const Series *s, uint64_t from, SeriesFn fn, void *udata)
+{
+	/* in the order written: the oldest follows the current one */
+	for (unsigned i = 1; i <= SERIES_BLOCKS; i++) {
+		const unsigned block = (s->block + i) % SERIES_BLOCKS;
+		const SeriesIndex *const ix = &s->header->index[block];
+		if ((ix->count == 0) || (ix->last_time < from))
+			continue;
+
+		/* checked as a whole first, a torn block gives nothing rather than noise */
+		SeriesState st;
+		if (_block_decode(s, block, from, NULL, NULL, &st) < 0)
+			continue;
+
+		_block_decode(s, block, from, fn, udata, &st);
+	}
+}
+
+
+/*
+ * private
+ */
+static void
+_bits_put(Bits *b, uint64_t v, unsigned n)
+{
+	while (n > 0) {
+		const unsigned room = 8 - (b->pos & 7);
+		const unsigned take = (n < room) ? n : room;
+		const unsigned mask = ((1u << take) - 1) << (room - take);
+		const unsigned bits = ((unsigned)(v >> (n - take)) << (room - take)) & mask;
+
+		uint8_t *const byte = &b->buf[b->pos >> 3];
+		*byte = (uint8_t)((*byte & ~mask) | bits);
+		b->pos += take;
+		n -= take;
+	}
+}
+
+
+static int
+_bits_get(Bits *b, unsigned n, uint64_t *v)
+{
+	if ((b->end - b->pos) < n)
+		return -1;
+
+	uint64_t ret = 0;
+	while (n > 0) {
+		const unsigned room = 8 - (b->pos & 7);
+		const unsigned take = (n < room) ? n : room;
+		const unsigned byte = b->buf[b->pos >> 3];
+
+		ret = (ret << take) | ((byte >> (room - take)) & ((1u << take) - 1));
+		b->pos += take;
+		n -= take;
+	}
+
+	*v = ret;
+	return 0;
+}
+
+
+static int
+_header_check(const SeriesHeader *h)
+{
+	if (memcmp(h->magic, SERIES_MAGIC, sizeof(h->magic)) != 0)
+		return -1;
+
+	if ((h->version != SERIES_VERSION) || (h->block_size != SERIES_BLOCK_SIZE) || (h->blocks != SERIES_BLOCKS))
+		return -1;
+
+	return 0;
+}
+
+
+static void
+_header_reset(SeriesHeader *h)
+{
+	memset(h, 0, sizeof(*h));
+	h->version = SERIES_VERSION;
+	h->block_size = SERIES_BLOCK_SIZE;
+	h->blocks = SERIES_BLOCKS;
+
+	/* last, a torn reset is never taken for a series file */
+	memcpy(h->magic, SERIES_MAGIC, sizeof(h->magic));
+}
+
+
+static void
+_state_reset(SeriesState *st, uint64_t time)
+{
+	memset(st, 0, sizeof(*st));
+	memset(st->leading, 0xff, sizeof(st->leading));
+	st->time = time;
+	st->check = 2166136261u;
+}
+
+
+/* fnv-1a over the time and the values, a torn block rarely adds up to it */
+static void
+_state_check(SeriesState *st)
+{
+	uint32_t check = st->check;
+	check = (check ^ (uint32_t)(st->time ^ (st->time >> 32))) * 16777619u;
+	for (int i = 0; i < SERIES_VALUES; i++)
+		check = (check ^ (uint32_t)(st->values[i] ^ (st->values[i] >> 32))) * 16777619u;
+
+	st->check = check;
+}
+
+
+static uint8_t *
+_block_at(const Series *s, unsigned block)
+{
+	return (uint8_t *)s->map + SERIES_HEADER_SIZE + ((size_t)block * SERIES_BLOCK_SIZE);
+}
+
+
+/* over the oldest one, unless the current one is still empty */
+static void
+_block_start(Series *s, uint64_t time)
+{
+	SeriesIndex *ix = &s->header->index[s->block];
+	const uint64_t seq = ix->seq + 1;
+	if (ix->count > 0) {
+		s->block = (s->block + 1) % SERIES_BLOCKS;
+		ix = &s->header->index[s->block];
+	}
+
+	/* emptied first, a crash in between leaves an empty block behind */
+	ix->count = 0;
+	ix->bits = 0;
+	ix->check = 0;
+	ix->first_time = time;
+	ix->last_time = time;
+	ix->seq = seq;
+
+	/* paged in ahead, the appends touch it a page at a time */
+	if (madvise(_block_at(s, s->block), SERIES_BLOCK_SIZE, MADV_WILLNEED) < 0)
+		perror("series: _block_start: madvise");
+
+	_state_reset(&s->state, time);
+}
+
+
+/* "fn" NULL: only checks that it adds up. "st": the state after its last point */
+static int
+_block_decode(const Series *s, unsigned block, uint64_t from, SeriesFn fn, void *udata, SeriesState *st)
+{
+	const SeriesIndex *const ix = &s->header->index[block];
+	if (ix->bits > SERIES_BLOCK_BITS)
+		return -1;
+
+	Bits b = { .buf = _block_at(s, block), .pos = 0, .end = ix->bits };
+	_state_reset(st, ix->first_time);
+	for (uint32_t i = 0; i < ix->count; i++) {
+		const uint64_t prev = st->time;
+		if (_decode_time(&b, st) < 0)
+			return -1;
+
+		if ((i > 0) && (st->time <= prev))
+			return -1;
+
+		for (int j = 0; j < SERIES_VALUES; j++) {
+			if (_decode_value(&b, st, j) < 0)
+				return -1;
+		}
+
+		_state_check(st);
+
+		if ((fn == NULL) || (st->time < from))
+			continue;
+
+		const IpcSample point = {
+			.time = st->time,
+			.memory_min = (size_t)st->values[0],
+			.memory_avg = (size_t)st->values[1],
+			.memory_max = (size_t)st->values[2],
+			.cpu_min = (unsigned)st->values[3],
+			.cpu_avg = (unsigned)st->values[4],
+			.cpu_max = (unsigned)st->values[5],
+		};
+
+		fn(udata, &point);
+	}
+
+	if ((b.pos != ix->bits) || (st->time != ix->last_time) || (st->check != ix->check))
+		return -1;
+
+	return 0;
+}
+
+
+/* delta of delta: '0', '10' + 7 bits, '110' + 9, '1110' + 12, '1111' + 32 */
+static void
+_encode_time(Bits *b, SeriesState *st, uint64_t time)
+{
+	const int64_t delta = (int64_t)(time - st->time);
+	const int64_t dod = delta - st->delta;
+	if (dod == 0) {
+		_bits_put(b, 0, 1);
+	} else if ((dod >= -64) && (dod < 64)) {
+		_bits_put(b, 0x2, 2);
+		_bits_put(b, (uint64_t)dod, 7);
+	} else if ((dod >= -256) && (dod < 256)) {
+		_bits_put(b, 0x6, 3);
+		_bits_put(b, (uint64_t)dod, 9);
+	} else if ((dod >= -2048) && (dod < 2048)) {
+		_bits_put(b, 0xe, 4);
+		_bits_put(b, (uint64_t)dod, 12);
+	} else {
+		_bits_put(b, 0xf, 4);
+		_bits_put(b, (uint64_t)dod, 32);
+	}
+
+	st->time = time;
+	st->delta = delta;
+}
+
+
+/* xor with the previous: '0' the same, '10' + the bits in the previous window,
+ * '11' + 5 bits of leading zeros, 6 of length (0: 64) + the bits */
+static void
+_encode_value(Bits *b, SeriesState *st, int i, uint64_t v)
+{
+	const uint64_t x = v ^ st->values[i];
+	st->values[i] = v;
+	if (x == 0) {
+		_bits_put(b, 0, 1);
+		return;
+	}
+
+	unsigned leading = (unsigned)__builtin_clzll(x);
+	const unsigned trailing = (unsigned)__builtin_ctzll(x);
+	if (leading > 31)
+		leading = 31;
+
+	if ((st->leading[i] != 0xff) && (leading >= st->leading[i]) && (trailing >= st->trailing[i])) {
+		_bits_put(b, 0x2, 2);
+		_bits_put(b, x >> st->trailing[i], 64 - st->leading[i] - st->trailing[i]);
+		return;
+	}
+
+	const unsigned len = 64 - leading - trailing;
+	_bits_put(b, 0x3, 2);
+	_bits_put(b, leading, 5);
+	_bits_put(b, len & 63, 6);
+	_bits_put(b, x >> trailing, len);
+
+	st->leading[i] = (uint8_t)leading;
+	st->trailing[i] = (uint8_t)trailing;
+}
+
+
+static int
+_decode_time(Bits *b, SeriesState *st)
+{
+	static const unsigned widths[] = { 7, 9, 12, 32 };
+
+	unsigned ones = 0;
+	while (ones < 4) {
+		uint64_t bit;
+		if (_bits_get(b, 1, &bit) < 0)
+			return -1;
+
+		if (bit == 0)
+			break;
+
+		ones++;
+	}
+
+	int64_t dod = 0;
+	if (ones > 0) {
+		const unsigned n = widths[ones - 1];
+		uint64_t v;
+		if (_bits_get(b, n, &v) < 0)
+			return -1;
+
+		/* sign extended */
+		dod = (int64_t)(v << (64 - n)) >> (64 - n);
+	}
+
+	st->delta += dod;
+	st->time += (uint64_t)st->delta;
+	return 0;
+}
+
+
+static int
+_decode_value(Bits *b, SeriesState *st, int i)
+{
+	uint64_t ctl;
+	if (_bits_get(b, 1, &ctl) < 0)
+		return -1;
+
+	if (ctl == 0)
+		return 0;
+
+	if (_bits_get(b, 1, &ctl) < 0)
+		return -1;
+
+	if (ctl == 1) {
+		uint64_t leading, len;
+		if ((_bits_get(b, 5, &leading) < 0) || (_bits_get(b, 6, &len) < 0))
+			return -1;
+
+		if (len == 0)
+			len = 64;
+
+		if ((leading + len) > 64)
+			return -1;
+
+		st->leading[i] = (uint8_t)leading;
+		st->trailing[i] = (uint8_t)(64 - leading - len);
+	} else if (st->leading[i] == 0xff) {
+		return -1;
+	}
+
+	uint64_t x;
+	if (_bits_get(b, 64 - st->leading[i] - st->trailing[i], &x) < 0)
+		return -1;
+
+	st->values[i] ^= x << st->trailing[i];
+	return 0;
+}
@@ -0,0 +1,80 @@
+#ifndef __SERIES_H__
+#define __SERIES_H__
+
+
+#include <stdint.h>
+
+#include "ipc.h"
+
+
+/* the file: a page of header and block index, then the blocks, written in
+ * turns. 10 to 30 bytes a point, 1.5 to 4 days of 1 s points in 4 MiB */
+#define SERIES_HEADER_SIZE (4096)
+#define SERIES_BLOCK_SIZE  (65536)
+#define SERIES_BLOCKS      (64)
+
+/* memory min/avg/max, cpu min/avg/max */
+#define SERIES_VALUES      (6)
+
+
+/* "count", "bits" and "check" are stored after the points they cover */
+typedef struct {
+	uint64_t seq;          /* 0: unused, the highest is the one written to */
+	uint64_t first_time;
+	uint64_t last_time;
+	uint32_t count;
+	uint32_t bits;
+	uint32_t check;        /* of the points so far */
+	uint32_t _pad;
+} SeriesIndex;
+
+/* in native byte order, the file never leaves the host */
+typedef struct {
+	char        magic[8];
+	uint32_t    version;
+	uint32_t    block_size;
+	uint32_t    blocks;
+	uint32_t    _pad;
+	SeriesIndex index[SERIES_BLOCKS];
+} SeriesHeader;
+
+/* the codec state after the latest point of a block: delta of delta for the
+ * time, xor with the previous for the values */
+typedef struct {
+	uint64_t time;
+	int64_t  delta;
+	uint64_t values[SERIES_VALUES];
+	uint8_t  leading[SERIES_VALUES];    /* of the last xor window, 0xff: none */
+	uint8_t  trailing[SERIES_VALUES];
+	uint32_t check;
+} SeriesState;
+
+/* a mapped file, appending only writes to the mapping, the kernel writes it
+ * back */
+typedef struct {
+	int           fd;
+	char         *map;
+	size_t        size;
+	SeriesHeader *header;
+	unsigned      block;     /* the one written to */
+	SeriesState   state;
+} Series;
+
+typedef void (*SeriesFn)(void *udata, const IpcSample *point);
+
+
+/* creates the file or maps the existing one, only the newest block is read.
+ * Symlinks are not followed, and a non-empty file that is not a series of
+ * this version is refused, not overwritten */
+int  series_open(Series *s, const char path[]);
+void series_close(Series *s);
+
+/* "point": newer than the previous one, else it is dropped */
+void series_append(Series *s, const IpcSample *point);
+
+/* calls "fn" for the points at or after "from", oldest first, reading only
+ * the blocks that reach it. Blocks that do not add up are skipped */
+void series_read(const Series *s, uint64_t from, SeriesFn fn, void *udata);
+
+
+#endif
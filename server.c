@@ -1,38 +1,268 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
+#include <signal.h>
 
 #include "server.h"
 #include "ipc.h"
+#include "status.h"
+#include "history.h"
+#include "series.h"
+#include "page.h"
+#include "watch.h"
+#include "procs.h"
+
+
+#define RECV_SIZE_MIN (4096)
+
+/* batches up to BATCH_INLINE_MAX elements are decoded on the loop thread,
+ * bigger ones on the threadpool, BATCH_CHUNK elements per work */
+#define BATCH_INLINE_MAX (32)
+#define BATCH_CHUNK      (64)
+#define BATCH_SIZE_MAX   (65536)
+
+/* a subscriber with this much unwritten misses the pushes until it catches up */
+#define PUSH_QUEUE_MAX   (65536)
+
+/* samples kept to diff against: how far back a delta stream can resume */
+#define PUSH_KEEP        (32)
+
+/* samples between the full pushes of a delta stream */
+#define PUSH_KEYFRAME    (30)
+
+/* the processes are scanned every SCAN_INTERVAL ms while asked for, until
+ * SCAN_IDLE ms after the latest request */
+#define SCAN_INTERVAL    (2000)
+#define SCAN_IDLE        (60000)
+
+/* "base" is only sent in deltas */
+#define STATUS_FIELDS_FULL (IPC_FIELDS_ALL(IPC_BODY_STATUS) & ~IPC_FIELD(base))
+
+
+/* a client connection, "pipe" must stay first: handles are freed as Conn */
+typedef struct Conn {
+	uv_pipe_t    pipe;
+	unsigned     refs;
+	int          framing;
+	size_t       max_frame;
+	char        *buffer;
+	size_t       len;
+	size_t       size;
+	IpcArena     arena;
+	IpcSpan     *spans;      /* reused by every batch split */
+	size_t       spans_size;
+
+	/* a status subscription, linked into the sampler's while "is_sub" */
+	int          is_sub;
+	unsigned     sub_id;
+	unsigned     sub_every;  /* in samples */
+	unsigned     sub_ticks;
+	unsigned     sub_left;   /* pushes, 0: no limit */
+	int          sub_delta;
+	uint64_t     sub_version;   /* the latest pushed, deltas apply to it */
+	uint64_t     sub_key;       /* of the latest full push */
+	struct Conn *sub_prev;
+	struct Conn *sub_next;
+	int          has_watches;   /* in the sampler's, until the connection ends */
+} Conn;
+
+/* a request answered on the threadpool, so slow handlers never hold back
+ * the responses of the ones behind them */
+typedef struct {
+	uv_work_t   work;
+	Conn       *conn;
+	IpcRequest  req;       /* string fields point into the compacted conn buffer, do not use */
+	uv_buf_t    buffer;
+	int         ret;
+} Job;
+
+typedef struct {
+	IpcSpan    span;
+	int        ret;       /* ipc_request_parse() */
+	IpcRequest req;
+} BatchItem;
+
+/* a batch decoded in parallel, the requests are answered in order once the
+ * last work is done. "data" is a copy of the payload: the conn buffer is
+ * compacted underneath */
+typedef struct {
+	Conn      *conn;
+	char      *data;
+	void      *works;
+	unsigned   pending;
+	int        is_err;
+	size_t     count;
+	BatchItem  items[];
+} Batch;
+
+typedef struct {
+	uv_work_t  work;
+	Batch     *batch;
+	size_t     first;
+	size_t     count;
+} BatchWork;
 
+/* an encoded response written to many connections, freed with the last write */
+typedef struct {
+	unsigned refs;
+	uv_buf_t buffer;
+} Shared;
+
+/* a past sample, "cpus" points into its own copy */
+typedef struct {
+	IpcBodyStatus  status;
+	IpcCpu        *cpus;
+	unsigned       size;
+} Snapshot;
+
+/* a delta encoded for this round of pushes, shared by the subscribers at "base" */
+typedef struct {
+	uint64_t  base;
+	Shared   *shared;
+} Delta;
+
+/* the latest status, collected on the threadpool every "interval" ms and
+ * encoded once for all the status requests until the next one. "status"
+ * points into "collector" and stays valid while the next one is collected */
+typedef struct {
+	uv_timer_t     timer;
+	uv_work_t      work;
+	int            is_busy;
+	Status         collector;
+	History        history;    /* loop thread only */
+	Series         series;     /* the closed 1 s points of "history" */
+	int            has_series;
+	Page           page;       /* "status" for local readers */
+	int            has_page;
+	unsigned       interval;   /* ms */
+	uint64_t       version;    /* of "status", 0: none yet */
+	Conn          *subs;       /* pushed "response" on every due sample */
+	Snapshot       snapshots[PUSH_KEEP];   /* by version */
+	Delta          deltas[PUSH_KEEP];      /* by base */
+	IpcCpu        *delta_cpus;
+	unsigned       delta_size;
+	Watches        watches;    /* evaluated on every sample */
+	IpcBodyStatus  status;
+	Shared        *response;   /* ipc_response_build_open(), NULL: no sample */
+	IpcBodyStatus  next;
+	uint64_t       next_time;  /* ms since the epoch */
+	Shared        *next_response;
+} Sampler;
+
+/* a top request that came before the table */
+typedef struct {
+	Conn     *conn;
+	unsigned  id;
+	unsigned  count;
+} TopWait;
+
+/* the process table, scanned on the threadpool PROCS_CHUNK processes a work,
+ * so a scan never holds a thread for long, and encoded on the loop. "table"
+ * points into "procs" while the next one is scanned */
+typedef struct {
+	uv_timer_t  timer;
+	uv_work_t   work;
+	int         is_busy;    /* from the first chunk to the last */
+	int         ret;        /* procs_scan() */
+	Procs       procs;
+	int         has_procs;
+	uint64_t    asked;      /* uv_now() of the latest request */
+	IpcBodyTop  table;
+	Shared     *response;   /* NULL: no table, or an old one */
+	IpcBodyTop  next;
+	TopWait    *waits;
+	unsigned    waits_len;
+	unsigned    waits_size;
+} Scanner;
 
 typedef struct {
 	uv_handle_t *handle;
+	int          is_last;
+	char         head[IPC_FRAME_HEAD_SIZE];
+	char         tail[IPC_RESPONSE_TAIL_MAX];
 	uv_buf_t     buffer;
+	Shared      *shared;
 } Context;
 
 
+/* what this server can speak, see ipc_hello_negotiate() */
+static const IpcBodyHello _caps = {
+	.encodings = IPC_ENCODING_JSON,
+	.framing = IPC_FRAMING_NUL | IPC_FRAMING_LENGTH,
+	.compression = IPC_COMPRESSION_NONE,
+	.max_frame = IPC_FRAME_SIZE_MAX,
+	.shm = 1,   /* while the status page is up */
+};
+
+static Sampler _sampler;
+static Scanner _scanner;
+
+
 static void         _allocator(uv_handle_t *u, size_t size, uv_buf_t *buffer);
 static uv_pipe_t   *_prep_ipc(uv_loop_t *u, const char sock_file[]);
 static uv_signal_t *_prep_signal(uv_loop_t *u);
+static int          _prep_sampler(uv_loop_t *u, const Server *s);
+static void         _on_series_point(void *udata, const IpcSample *point);
+static void         _on_sample_tick(uv_timer_t *u);
+static void         _sample_work(uv_work_t *u);
+static void         _on_sample_done(uv_work_t *u, int status);
+static void         _on_sampler_close(uv_handle_t *u);
+static void         _prep_scanner(uv_loop_t *u);
+static void         _on_scan_tick(uv_timer_t *u);
+static void         _scan_work(uv_work_t *u);
+static void         _on_scan_done(uv_work_t *u, int status);
+static void         _on_scanner_close(uv_handle_t *u);
 static void         _on_accept(uv_stream_t *u, int status);
 static void         _on_signal(uv_signal_t *u, int sig);
 static void         _on_walk(uv_handle_t *u, void *arg);
 static void         _on_close(uv_handle_t *u);
 static void         _on_recv(uv_stream_t *u, ssize_t res, const uv_buf_t *buffer);
 static void         _on_send(uv_write_t *u, int res);
-static int          _resp_hello(uv_buf_t *buffer);
-static int          _resp_status(uv_buf_t *buffer);
-static int          _resp_error(uv_buf_t *buffer, int req, int err, const char message[]);
-static int          _resp_shutdown(uv_buf_t *buffer);
+static void         _conn_unref(Conn *conn);
+static int          _on_request(Conn *conn, char data[], size_t len);
+static int          _dispatch(Conn *conn, const IpcRequest *req, int parsed);
+static int          _on_batch(Conn *conn, char data[], size_t len);
+static int          _batch_split(Conn *conn, const char data[], size_t len, size_t *count);
+static int          _batch_start(Conn *conn, const char data[], size_t len, size_t count);
+static void         _batch_work(uv_work_t *u);
+static void         _on_batch_done(uv_work_t *u, int status);
+static int          _job_start(Conn *conn, const IpcRequest *req, uv_work_cb work);
+static void         _job_status(uv_work_t *u);
+static void         _on_job_done(uv_work_t *u, int status);
+static int          _send(Conn *conn, uv_buf_t *buffer, int framing, int request_code, unsigned id);
+static int          _send_shared(Conn *conn, Shared *shared, unsigned id, int framing, int request_code);
+static int          _write(Conn *conn, Context *context, const uv_buf_t body[], unsigned nbody, int framing,
+			   int request_code, unsigned id);
+static void         _context_free(Context *context);
+static void         _shared_unref(Shared *shared);
+static int          _resp_hello(uv_buf_t *buffer, Conn *conn, const IpcRequest *req);
+static int          _resp_status(uv_buf_t *buffer, const IpcRequest *req, const IpcBodyStatus *sample);
+static int          _resp_history(uv_buf_t *buffer, const IpcRequest *req);
+static int          _subscribe(Conn *conn, const IpcRequest *req);
+static void         _unsubscribe(Conn *conn);
+static void         _push(void);
+static int          _push_to(Conn *conn);
+static Shared      *_push_delta(uint64_t base);
+static void         _push_done(void);
+static int          _snapshot_save(const IpcBodyStatus *status);
+static Snapshot    *_snapshot_get(uint64_t version);
+static int          _watch(Conn *conn, const IpcRequest *req);
+static void         _on_watch_fired(void *udata, const Watch *w, uint64_t value);
+static int          _top(Conn *conn, const IpcRequest *req);
+static int          _top_send(Conn *conn, unsigned id, unsigned count);
+static void         _top_wake(void);
+static int          _resp_error(uv_buf_t *buffer, const IpcRequest *req, int err, const char message[]);
+static int          _resp_shutdown(uv_buf_t *buffer, const IpcRequest *req);
 
 
 /*
  * public
  */
 int
-server_init(Server *s, const char sock_file[])
+server_init(Server *s, const char sock_file[], unsigned status_interval, const char history_file[],
+	    const char status_page[])
 {
 	uv_loop_t *const loop = uv_default_loop();
 	if (loop == NULL) {
@@ -42,6 +272,9 @@ server_init(Server *s, const char sock_file[])
 
 	s->sock_file = sock_file;
 	s->loop = loop;
+	s->status_interval = status_interval;
+	s->history_file = history_file;
+	s->status_page = status_page;
 	return 0;
 }
 
@@ -49,6 +282,9 @@ server_init(Server *s, const char sock_file[])
 int
 server_run(Server *s)
 {
+	/* a subscriber gone mid-push fails that write, not the server */
+	signal(SIGPIPE, SIG_IGN);
+
 	int ret = -1;
 	uv_pipe_t *const ipc = _prep_ipc(s->loop, s->sock_file);
 	if (ipc == NULL)
@@ -58,6 +294,11 @@ server_run(Server *s)
 	if (signl == NULL)
 		goto out0;
 
+	if (_prep_sampler(s->loop, s) < 0)
+		goto out1;
+
+	_prep_scanner(s->loop);
+
 	ret = uv_run(s->loop, UV_RUN_DEFAULT);
 	if (ret < 0) {
 		fprintf(stderr, "server: server_run: uv_run: %s\n", uv_strerror(ret));
@@ -93,17 +334,26 @@ out0:
 static void
 _allocator(uv_handle_t *u, size_t size, uv_buf_t *buffer)
 {
-	void *const mem = malloc(size);
-	if (mem == NULL) {
-		perror("server: _allocator: malloc: uv_buf_t");
-		buffer->base = NULL;
-		buffer->len = 0;
-		return;
+	/* read straight into the connection buffer, after the pending bytes */
+	Conn *const conn = (Conn *)u;
+	if (size < RECV_SIZE_MIN)
+		size = RECV_SIZE_MIN;
+
+	if ((conn->size - conn->len) < size) {
+		char *const mem = realloc(conn->buffer, conn->len + size);
+		if (mem == NULL) {
+			perror("server: _allocator: realloc: Conn");
+			buffer->base = NULL;
+			buffer->len = 0;
+			return;
+		}
+
+		conn->buffer = mem;
+		conn->size = conn->len + size;
 	}
 
-	buffer->base = mem;
-	buffer->len = size;
-	(void)u;
+	buffer->base = conn->buffer + conn->len;
+	buffer->len = conn->size - conn->len;
 }
 
 
@@ -128,6 +378,8 @@ _prep_ipc(uv_loop_t *u, const char sock_file[])
 		goto err1;
 	}
 
+	((uv_handle_t *)ipc)->data = NULL;
+
 	ret = uv_listen((uv_stream_t *)ipc, 32, _on_accept);
 	if (ret < 0) {
 		fprintf(stderr, "server: _prep_ipc: uv_listen: %s\n", uv_strerror(ret));
@@ -160,11 +412,356 @@ _prep_signal(uv_loop_t *u)
 		return NULL;
 	}
 
+	((uv_handle_t *)signl)->data = NULL;
 	uv_signal_start(signl, _on_signal, SIGINT);
 	return signl;
 }
 
 
+static int
+_prep_sampler(uv_loop_t *u, const Server *s)
+{
+	const unsigned interval = s->status_interval;
+	if (status_init(&_sampler.collector) < 0)
+		return -1;
+
+	_sampler.interval = interval;
+	watch_init(&_sampler.watches);
+
+	if (history_init(&_sampler.history, interval) < 0)
+		goto err0;
+
+	/* the last day of the previous runs, a missing file only costs the history */
+	if ((s->history_file != NULL) && (series_open(&_sampler.series, s->history_file) == 0)) {
+		struct timespec ts;
+		clock_gettime(CLOCK_REALTIME, &ts);
+
+		const uint64_t now = ((uint64_t)ts.tv_sec * 1000) + ((uint64_t)ts.tv_nsec / 1000000);
+		const uint64_t from = (now > HISTORY_SPAN) ? (now - HISTORY_SPAN) : 0;
+		series_read(&_sampler.series, from, _on_series_point, &_sampler.history);
+		_sampler.has_series = 1;
+	}
+
+	/* likewise, without it local readers ask over the socket */
+	if ((s->status_page != NULL) && (page_create(&_sampler.page, s->status_page, interval) == 0))
+		_sampler.has_page = 1;
+
+	int ret = uv_timer_init(u, &_sampler.timer);
+	if (ret < 0) {
+		fprintf(stderr, "server: _prep_sampler: uv_timer_init: %s\n", uv_strerror(ret));
+		goto err1;
+	}
+
+	_sampler.timer.data = &_sampler;
+
+	/* the first sample right away */
+	ret = uv_timer_start(&_sampler.timer, _on_sample_tick, 0, interval);
+	if (ret < 0) {
+		fprintf(stderr, "server: _prep_sampler: uv_timer_start: %s\n", uv_strerror(ret));
+		uv_close((uv_handle_t *)&_sampler.timer, NULL);
+		goto err1;
+	}
+
+	return 0;
+
+err1:
+	if (_sampler.has_page)
+		page_close(&_sampler.page);
+
+	if (_sampler.has_series)
+		series_close(&_sampler.series);
+
+	_sampler.has_page = 0;
+	_sampler.has_series = 0;
+	history_deinit(&_sampler.history);
+err0:
+	status_deinit(&_sampler.collector);
+	return -1;
+}
+
+
+static void
+_on_series_point(void *udata, const IpcSample *point)
+{
+	history_restore((History *)udata, point);
+}
+
+
+static void
+_on_sample_tick(uv_timer_t *u)
+{
+	/* a slow collection skips ticks instead of piling them up */
+	if (_sampler.is_busy)
+		return;
+
+	const int ret = uv_queue_work(u->loop, &_sampler.work, _sample_work, _on_sample_done);
+	if (ret < 0) {
+		fprintf(stderr, "server: _on_sample_tick: uv_queue_work: %s\n", uv_strerror(ret));
+		return;
+	}
+
+	_sampler.is_busy = 1;
+}
+
+
+/* runs on the threadpool, touches only the "next" members */
+static void
+_sample_work(uv_work_t *u)
+{
+	(void)u;
+	_sampler.next_response = NULL;
+	if (status_collect(&_sampler.collector, &_sampler.next, 0) < 0)
+		return;
+
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	_sampler.next_time = ((uint64_t)ts.tv_sec * 1000) + ((uint64_t)ts.tv_nsec / 1000000);
+	_sampler.next.version = _sampler.version + 1;
+
+	const IpcResponse resp = {
+		.code = IPC_RES_OK,
+		.request_code = IPC_REQ_STATUS,
+		.fields = STATUS_FIELDS_FULL,
+		.status = _sampler.next,
+	};
+
+	Shared *const shared = malloc(sizeof(Shared));
+	char *const str = ipc_response_build_open(&resp);
+	if ((shared == NULL) || (str == NULL)) {
+		perror("server: _sample_work: ipc_response_build_open");
+		free(shared);
+		free(str);
+		return;
+	}
+
+	shared->refs = 1;
+	shared->buffer = uv_buf_init(str, (unsigned)strlen(str));
+	_sampler.next_response = shared;
+}
+
+
+static void
+_on_sample_done(uv_work_t *u, int status)
+{
+	Shared *const shared = _sampler.next_response;
+	(void)u;
+
+	_sampler.is_busy = 0;
+	if (status < 0)
+		fprintf(stderr, "server: _on_sample_done: %s\n", uv_strerror(status));
+
+	if (uv_is_closing((uv_handle_t *)&_sampler.timer)) {
+		if (shared != NULL)
+			_shared_unref(shared);
+
+		status_deinit(&_sampler.collector);
+		return;
+	}
+
+	/* a failed sample drops the old one, status requests collect on their own */
+	if (_sampler.response != NULL)
+		_shared_unref(_sampler.response);
+
+	_sampler.response = shared;
+	_sampler.status = _sampler.next;
+	if (shared == NULL)
+		return;
+
+	/* a failed copy only costs the deltas against it */
+	_sampler.version = _sampler.next.version;
+	_snapshot_save(&_sampler.next);
+
+	if (_sampler.has_page)
+		page_write(&_sampler.page, &_sampler.next, _sampler.next_time);
+
+	_push();
+	watch_eval(&_sampler.watches, &_sampler.next, _on_watch_fired, NULL);
+
+	/* only written to the mapping, never synced here */
+	const IpcSample *const closed = history_add(&_sampler.history, _sampler.next_time, &_sampler.next);
+	if ((closed != NULL) && _sampler.has_series)
+		series_append(&_sampler.series, closed);
+}
+
+
+static void
+_on_sampler_close(uv_handle_t *u)
+{
+	(void)u;
+	if (_sampler.response != NULL)
+		_shared_unref(_sampler.response);
+
+	_sampler.response = NULL;
+	if (_sampler.has_page)
+		page_close(&_sampler.page);
+
+	if (_sampler.has_series)
+		series_close(&_sampler.series);
+
+	_sampler.has_page = 0;
+	_sampler.has_series = 0;
+	history_deinit(&_sampler.history);
+	watch_deinit(&_sampler.watches);
+
+	for (int i = 0; i < PUSH_KEEP; i++)
+		free(_sampler.snapshots[i].cpus);
+
+	free(_sampler.delta_cpus);
+	memset(_sampler.snapshots, 0, sizeof(_sampler.snapshots));
+	_sampler.delta_cpus = NULL;
+	_sampler.delta_size = 0;
+
+	/* else the sample in flight needs it, _on_sample_done() releases it */
+	if (_sampler.is_busy == 0)
+		status_deinit(&_sampler.collector);
+}
+
+
+/* without /proc the top requests fail, the rest of the server does not care */
+static void
+_prep_scanner(uv_loop_t *u)
+{
+	if (procs_init(&_scanner.procs) < 0)
+		return;
+
+	const int ret = uv_timer_init(u, &_scanner.timer);
+	if (ret < 0) {
+		fprintf(stderr, "server: _prep_scanner: uv_timer_init: %s\n", uv_strerror(ret));
+		procs_deinit(&_scanner.procs);
+		return;
+	}
+
+	/* started by the first request */
+	_scanner.timer.data = &_scanner;
+	_scanner.has_procs = 1;
+}
+
+
+static void
+_on_scan_tick(uv_timer_t *u)
+{
+	/* nobody asked for a while, the next request waits for a new table */
+	if ((uv_now(u->loop) - _scanner.asked) > SCAN_IDLE) {
+		uv_timer_stop(u);
+		if (_scanner.response != NULL)
+			_shared_unref(_scanner.response);
+
+		_scanner.response = NULL;
+		return;
+	}
+
+	/* likewise, a slow scan skips ticks */
+	if (_scanner.is_busy)
+		return;
+
+	const int ret = uv_queue_work(u->loop, &_scanner.work, _scan_work, _on_scan_done);
+	if (ret < 0) {
+		fprintf(stderr, "server: _on_scan_tick: uv_queue_work: %s\n", uv_strerror(ret));
+		return;
+	}
+
+	_scanner.is_busy = 1;
+}
+
+
+/* runs on the threadpool, touches only "procs" and "next" */
+static void
+_scan_work(uv_work_t *u)
+{
+	(void)u;
+	_scanner.ret = procs_scan(&_scanner.procs, &_scanner.next);
+}
+
+
+static void
+_on_scan_done(uv_work_t *u, int status)
+{
+	if (status < 0)
+		fprintf(stderr, "server: _on_scan_done: %s\n", uv_strerror(status));
+
+	if (uv_is_closing((uv_handle_t *)&_scanner.timer)) {
+		_scanner.is_busy = 0;
+		procs_deinit(&_scanner.procs);
+		return;
+	}
+
+	/* the next chunk goes behind whatever was queued meanwhile */
+	if ((status == 0) && (_scanner.ret == 0)) {
+		const int ret = uv_queue_work(u->loop, &_scanner.work, _scan_work, _on_scan_done);
+		if (ret == 0)
+			return;
+
+		fprintf(stderr, "server: _on_scan_done: uv_queue_work: %s\n", uv_strerror(ret));
+	}
+
+	_scanner.is_busy = 0;
+
+	/* stopped for idleness meanwhile, the next request starts over */
+	if (!uv_is_active((uv_handle_t *)&_scanner.timer))
+		return;
+
+	if ((status < 0) || (_scanner.ret < 0)) {
+		_top_wake();
+		return;
+	}
+
+	if (_scanner.ret == 0)
+		return;
+
+	/* the previous table is scanned over next, a failed one drops both */
+	if (_scanner.response != NULL)
+		_shared_unref(_scanner.response);
+
+	_scanner.response = NULL;
+	_scanner.table = _scanner.next;
+
+	const IpcResponse resp = {
+		.code = IPC_RES_OK,
+		.request_code = IPC_REQ_TOP,
+		.top = _scanner.table,
+	};
+
+	Shared *const shared = malloc(sizeof(Shared));
+	char *const str = ipc_response_build_open(&resp);
+	if ((shared == NULL) || (str == NULL)) {
+		perror("server: _on_scan_done: ipc_response_build_open");
+		free(shared);
+		free(str);
+		_top_wake();
+		return;
+	}
+
+	shared->refs = 1;
+	shared->buffer = uv_buf_init(str, (unsigned)strlen(str));
+	_scanner.response = shared;
+	_top_wake();
+}
+
+
+static void
+_on_scanner_close(uv_handle_t *u)
+{
+	(void)u;
+	if (_scanner.response != NULL)
+		_shared_unref(_scanner.response);
+
+	_scanner.response = NULL;
+
+	/* closed by the walk too */
+	for (unsigned i = 0; i < _scanner.waits_len; i++)
+		_conn_unref(_scanner.waits[i].conn);
+
+	free(_scanner.waits);
+	_scanner.waits = NULL;
+	_scanner.waits_len = 0;
+	_scanner.waits_size = 0;
+
+	/* else the scan in flight needs it, _on_scan_done() releases it */
+	if (_scanner.is_busy == 0)
+		procs_deinit(&_scanner.procs);
+}
+
+
 static void
 _on_accept(uv_stream_t *u, int status)
 {
@@ -173,19 +770,25 @@ _on_accept(uv_stream_t *u, int status)
 		return;
 	}
 
-	uv_pipe_t *const client = malloc(sizeof(uv_pipe_t));
-	if (client == NULL) {
-		perror("server: on_accept: malloc");
+	Conn *const conn = calloc(1, sizeof(Conn));
+	if (conn == NULL) {
+		perror("server: on_accept: calloc");
 		return;
 	}
 
+	uv_pipe_t *const client = &conn->pipe;
 	const int ret = uv_pipe_init(u->loop, client, 0);
 	if (ret < 0) {
 		fprintf(stderr, "server: uv_pipe_init: %s\n", uv_strerror(ret));
-		free(client);
+		free(conn);
 		return;
 	}
 
+	conn->refs = 1;
+	ipc_arena_init(&conn->arena);
+	conn->framing = IPC_FRAMING_LEGACY;
+	conn->max_frame = IPC_FRAME_SIZE_MAX;
+
 	/* https://docs.libuv.org/en/v1.x/stream.html#c.uv_accept
 	 *  When the uv_connection_cb (this function) callback is called it is guaranteed
 	 *  that this (below) function will complete successfully the first time. 
@@ -195,7 +798,7 @@ _on_accept(uv_stream_t *u, int status)
 	/* test */
 	printf("new client: %p\n", (void *)client);
 
-	((uv_handle_t *)client)->data = "hello";
+	((uv_handle_t *)client)->data = conn;
 
 	uv_read_start((uv_stream_t *)client, _allocator, _on_recv);
 }
@@ -217,7 +820,12 @@ static void
 _on_walk(uv_handle_t *u, void *arg)
 {
 	(void)arg;
-	uv_close(u, _on_close);
+	if (u == (uv_handle_t *)&_sampler.timer)
+		uv_close(u, _on_sampler_close);
+	else if (u == (uv_handle_t *)&_scanner.timer)
+		uv_close(u, _on_scanner_close);
+	else
+		uv_close(u, _on_close);
 }
 
 
@@ -225,91 +833,86 @@ static void
 _on_close(uv_handle_t *u)
 {
 	printf("server: on_close: closed: %p\n", (void *)u);
+
+	/* only client connections carry data */
+	Conn *const conn = u->data;
+	if (conn != NULL) {
+		_unsubscribe(conn);
+		if (conn->has_watches)
+			watch_remove(&_sampler.watches, conn, 0);
+
+		_conn_unref(conn);
+		return;
+	}
+
 	free(u);
 }
 
 
 static void
-_on_recv(uv_stream_t *u, ssize_t res, const uv_buf_t *buffer)
+_conn_unref(Conn *conn)
 {
-	int ret = 0;
-	int is_einval = 0;
-	uv_write_t *writer;
-	//uv_buf_t *_buffer;
-	Context *context;
-
+	if (--conn->refs > 0)
+		return;
 
-	char *const data = buffer->base;
-	if (res < 0) {
-		fprintf(stderr, "server: _on_recv: %s\n", uv_strerror(res));
-		goto out0;
-	}
+	printf("%p: arena high water: %zu\n", (void *)conn, conn->arena.high_water);
+	ipc_arena_deinit(&conn->arena);
+	free(conn->spans);
+	free(conn->buffer);
+	free(conn);
+}
 
-	if (res == UV_EOF)
-		goto out0;
 
-	if (res == 0) {
-		fprintf(stderr, "server: _on_recv: empty request\n");
-		goto out0;
-	}
+static void
+_on_recv(uv_stream_t *u, ssize_t res, const uv_buf_t *buffer)
+{
+	Conn *const conn = (Conn *)u;
+	(void)buffer;
 
-	printf("%p: req: %.*s\n", (void *)u, (int)res - 1, data);
+	if (res < 0) {
+		if (res != UV_EOF)
+			fprintf(stderr, "server: _on_recv: %s\n", uv_strerror(res));
 
-	IpcRequest req;
-	ret = ipc_request_parse(&req, data, res - 1);
-	switch (ret) {
-	case IPC_PARSE_SUCCESS: break;
-	case IPC_PARSE_EINVAL: is_einval = 1; break;
-	default: goto out1;
+		goto err0;
 	}
 
-	writer = malloc(sizeof(uv_write_t));
-	if (writer == NULL) {
-		perror("server: _on_recv: malloc: uv_write_t");
-		goto out0;
-	}
-	
-	context = malloc(sizeof(Context));
-	if (context == NULL) {
-		perror("server: _on_recv: malloc: uv_buf_t");
-		goto out1;
-	}
+	if (res == 0)
+		return;
 
-	if (is_einval) {
-		ret = _resp_error(&context->buffer, req.code, IPC_RES_ERR_BAD_REQUEST, "bad request");
-	} else {
-		switch (req.code) {
-		case IPC_REQ_HELLO: ret = _resp_hello(&context->buffer); break;
-		case IPC_REQ_STATUS: ret = _resp_status(&context->buffer); break;
-		case IPC_REQ_SHUTDOWN: ret = _resp_shutdown(&context->buffer); break;
-		default: ret = -1; break;
+	conn->len += (size_t)res;
+
+	size_t off = 0;
+	while (off < conn->len) {
+		size_t payload, payload_len, frame_len;
+		const int ret = ipc_frame_next(conn->framing, conn->buffer + off, conn->len - off,
+					       conn->max_frame, &payload, &payload_len, &frame_len);
+		if (ret < 0) {
+			fprintf(stderr, "server: _on_recv: invalid frame\n");
+			goto err0;
 		}
-	}
 
-	if (ret < 0)
-		goto out2;
+		if (ret == 0)
+			break;
 
-	context->handle = (uv_handle_t *)u;
-	writer->data = context;
+		if (_on_request(conn, conn->buffer + off + payload, payload_len) < 0)
+			goto err0;
 
-	ret = uv_write(writer, u, &context->buffer, 1, _on_send);
-	if (ret < 0) {
-		fprintf(stderr, "server: _on_recv: uv_write: %s\n", uv_strerror(ret));
-		goto out3;
+		off += frame_len;
+
+		/* legacy: one request per connection, _on_send closes it */
+		if (conn->framing == IPC_FRAMING_LEGACY) {
+			uv_read_stop(u);
+			break;
+		}
 	}
 
-	free(data);
+	conn->len -= off;
+	memmove(conn->buffer, conn->buffer + off, conn->len);
 	return;
 
-out3:
-	free(context->buffer.base);
-out2:
-	free(context);
-out1:
-	free(writer);
-out0:
-	free(data);
-	uv_close((uv_handle_t *)u, _on_close);
+err0:
+	if (!uv_is_closing((uv_handle_t *)u))
+		uv_close((uv_handle_t *)u, _on_close);
 }
 
 
@@ -322,61 +925,1025 @@ _on_send(uv_write_t *u, int res)
 
 	printf("_on_send: %p: %d\n", u, res);
 
-	uv_close(context->handle, _on_close);
-	free(context->buffer.base);
-	free(context);
+	if (((res < 0) || context->is_last) && !uv_is_closing(context->handle))
+		uv_close(context->handle, _on_close);
+
+	_context_free(context);
 	free(u);
 }
 
 
 static int
-_resp_hello(uv_buf_t *buffer)
+_on_request(Conn *conn, char data[], size_t len)
 {
-	char *const resp = ipc_response_build_hello();
-	if (resp == NULL) {
-		perror("server: _resp_hello: ipc_response_build_hello");
-		return -1;
-	}
+	printf("%p: req: %.*s\n", (void *)conn, (int)len, data);
 
-	buffer->base = resp;
-	buffer->len = strlen(resp);
-	return 0;
-}
+	if (ipc_batch_is(data, len))
+		return _on_batch(conn, data, len);
 
+	IpcRequest req;
+	const int ret = ipc_request_parse(&req, data, len, &conn->arena);
 
-static int
-_resp_status(uv_buf_t *buffer)
-{
-	/*
-	 * TODO
-	 */
-	buffer->base = NULL;
-	buffer->len = 0;
-	return 0;
+	/* the decoded request points into "data", the DOM is done with */
+	ipc_arena_reset(&conn->arena);
+	return _dispatch(conn, &req, ret);
 }
 
 
+/* "parsed": what ipc_request_parse() returned for "req" */
 static int
-_resp_error(uv_buf_t *buffer, int req, int err, const char message[])
+_dispatch(Conn *conn, const IpcRequest *req, int parsed)
 {
-	char *const resp = ipc_response_build_error(req, err, message);
-	if (resp == NULL) {
-		perror("server: _resp_hello: ipc_response_build_error");
-		return -1;
-	}
+	int ret;
+	int is_einval = 0;
+	uv_buf_t buffer;
 
-	buffer->base = resp;
-	buffer->len = strlen(resp);
-	return 0;
-}
 
+	switch (parsed) {
+	case IPC_PARSE_SUCCESS: break;
+	case IPC_PARSE_EINVAL: is_einval = 1; break;
+	default: return -1;
+	}
 
-static int
-_resp_shutdown(uv_buf_t *buffer)
+	/* the handshake reply is '\0' terminated, the rest of the connection uses
+	 * whatever it negotiated */
+	int framing = conn->framing;
+
+	if (is_einval) {
+		ret = _resp_error(&buffer, req, IPC_RES_ERR_BAD_REQUEST, "bad request");
+	} else {
+		switch (req->code) {
+		case IPC_REQ_HELLO: ret = _resp_hello(&buffer, conn, req); break;
+		case IPC_REQ_STATUS:
+			if (_sampler.response == NULL)
+				return _job_start(conn, req, _job_status);
+
+			/* the whole body is encoded already */
+			if ((req->query.fields & IPC_FIELDS_ALL(IPC_BODY_STATUS)) == 0)
+				return _send_shared(conn, _sampler.response, req->id, framing, IPC_REQ_STATUS);
+
+			ret = _resp_status(&buffer, req, &_sampler.status);
+			break;
+		case IPC_REQ_SHUTDOWN: ret = _resp_shutdown(&buffer, req); break;
+		case IPC_REQ_HISTORY: ret = _resp_history(&buffer, req); break;
+		case IPC_REQ_SUBSCRIBE: return _subscribe(conn, req);
+		case IPC_REQ_WATCH: return _watch(conn, req);
+		case IPC_REQ_TOP: return _top(conn, req);
+
+		/* from a newer client: the connection and the rest of a batch go on */
+		default: ret = _resp_error(&buffer, req, IPC_RES_ERR_BAD_REQUEST, "unknown request"); break;
+		}
+	}
+
+	if (ret < 0)
+		return -1;
+
+	if ((framing == IPC_FRAMING_LEGACY) && (conn->framing != IPC_FRAMING_LEGACY))
+		framing = IPC_FRAMING_NUL;
+
+	return _send(conn, &buffer, framing, req->code, req->id);
+}
+
+
+static int
+_on_batch(Conn *conn, char data[], size_t len)
+{
+	const IpcRequest none = { .code = IPC_REQ_NONE };
+	const char *err = NULL;
+	uv_buf_t buffer;
+	size_t count;
+
+
+	/* every element is answered with a frame of its own */
+	if (conn->framing == IPC_FRAMING_LEGACY)
+		err = "batch needs framing";
+	else if (_batch_split(conn, data, len, &count) < 0)
+		err = "bad batch";
+	else if (count == 0)
+		err = "empty batch";    /* else nothing would answer it */
+
+	if (err != NULL) {
+		if (_resp_error(&buffer, &none, IPC_RES_ERR_BAD_REQUEST, err) < 0)
+			return -1;
+
+		return _send(conn, &buffer, conn->framing, none.code, none.id);
+	}
+
+	if (count > BATCH_INLINE_MAX)
+		return _batch_start(conn, data, len, count);
+
+	for (size_t i = 0; i < count; i++) {
+		IpcRequest req;
+		const IpcSpan *const span = &conn->spans[i];
+		const int ret = ipc_request_parse(&req, data + span->off, span->len, &conn->arena);
+
+		ipc_arena_reset(&conn->arena);
+		if (_dispatch(conn, &req, ret) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+
+/* into conn->spans, grown to fit */
+static int
+_batch_split(Conn *conn, const char data[], size_t len, size_t *count)
+{
+	if (ipc_batch_split(conn->spans, conn->spans_size, count, data, len) < 0)
+		return -1;
+
+	if (*count <= conn->spans_size)
+		return 0;
+
+	if (*count > BATCH_SIZE_MAX)
+		return -1;
+
+	IpcSpan *const spans = realloc(conn->spans, sizeof(IpcSpan) * *count);
+	if (spans == NULL) {
+		perror("server: _batch_split: realloc: IpcSpan");
+		return -1;
+	}
+
+	conn->spans = spans;
+	conn->spans_size = *count;
+	return ipc_batch_split(conn->spans, conn->spans_size, count, data, len);
+}
+
+
+static int
+_batch_start(Conn *conn, const char data[], size_t len, size_t count)
+{
+	const size_t works_len = (count + BATCH_CHUNK - 1) / BATCH_CHUNK;
+
+	Batch *const batch = malloc(sizeof(Batch) + (sizeof(BatchItem) * count));
+	if (batch == NULL) {
+		perror("server: _batch_start: malloc: Batch");
+		return -1;
+	}
+
+	BatchWork *const works = malloc(sizeof(BatchWork) * works_len);
+	if (works == NULL) {
+		perror("server: _batch_start: malloc: BatchWork");
+		goto err0;
+	}
+
+	batch->data = malloc(len);
+	if (batch->data == NULL) {
+		perror("server: _batch_start: malloc: data");
+		goto err1;
+	}
+
+	memcpy(batch->data, data, len);
+	batch->conn = conn;
+	batch->works = works;
+	batch->pending = 0;
+	batch->is_err = 0;
+	batch->count = count;
+	for (size_t i = 0; i < count; i++)
+		batch->items[i].span = conn->spans[i];
+
+	for (size_t i = 0; i < works_len; i++) {
+		BatchWork *const w = &works[i];
+		w->batch = batch;
+		w->first = i * BATCH_CHUNK;
+		w->count = (count - w->first < BATCH_CHUNK) ? (count - w->first) : BATCH_CHUNK;
+
+		const int ret = uv_queue_work(conn->pipe.loop, &w->work, _batch_work, _on_batch_done);
+		if (ret < 0) {
+			fprintf(stderr, "server: _batch_start: uv_queue_work: %s\n", uv_strerror(ret));
+
+			/* the queued ones still complete, the last closes the connection */
+			batch->is_err = 1;
+			break;
+		}
+
+		batch->pending++;
+	}
+
+	if (batch->pending == 0)
+		goto err2;
+
+	/* the connection may be closed before the batch is done */
+	conn->refs++;
+	return 0;
+
+err2:
+	free(batch->data);
+err1:
+	free(works);
+err0:
+	free(batch);
+	return -1;
+}
+
+
+/* runs on the threadpool, every work has an arena of its own */
+static void
+_batch_work(uv_work_t *u)
+{
+	BatchWork *const w = (BatchWork *)u;
+	Batch *const batch = w->batch;
+	IpcArena arena;
+
+	ipc_arena_init(&arena);
+	for (size_t i = w->first; i < (w->first + w->count); i++) {
+		BatchItem *const item = &batch->items[i];
+		item->ret = ipc_request_parse(&item->req, batch->data + item->span.off, item->span.len, &arena);
+		ipc_arena_reset(&arena);
+	}
+
+	ipc_arena_deinit(&arena);
+}
+
+
+static void
+_on_batch_done(uv_work_t *u, int status)
+{
+	Batch *const batch = ((BatchWork *)u)->batch;
+	Conn *const conn = batch->conn;
+	uv_handle_t *const handle = (uv_handle_t *)conn;
+
+	if (status < 0) {
+		fprintf(stderr, "server: _on_batch_done: %s\n", uv_strerror(status));
+		batch->is_err = 1;
+	}
+
+	if (--batch->pending > 0)
+		return;
+
+	if (!uv_is_closing(handle)) {
+		int ret = batch->is_err ? -1 : 0;
+		for (size_t i = 0; (ret == 0) && (i < batch->count); i++)
+			ret = _dispatch(conn, &batch->items[i].req, batch->items[i].ret);
+
+		if (ret < 0)
+			uv_close(handle, _on_close);
+	}
+
+	_conn_unref(conn);
+	free(batch->data);
+	free(batch->works);
+	free(batch);
+}
+
+
+static int
+_job_start(Conn *conn, const IpcRequest *req, uv_work_cb work)
+{
+	Job *const job = malloc(sizeof(Job));
+	if (job == NULL) {
+		perror("server: _job_start: malloc: Job");
+		return -1;
+	}
+
+	job->conn = conn;
+	job->req = *req;
+	job->ret = -1;
+
+	const int ret = uv_queue_work(conn->pipe.loop, &job->work, work, _on_job_done);
+	if (ret < 0) {
+		fprintf(stderr, "server: _job_start: uv_queue_work: %s\n", uv_strerror(ret));
+		free(job);
+		return -1;
+	}
+
+	/* the connection may be closed before the job is done */
+	conn->refs++;
+	return 0;
+}
+
+
+static void
+_job_status(uv_work_t *u)
+{
+	Job *const job = (Job *)u;
+	job->ret = _resp_status(&job->buffer, &job->req, NULL);
+}
+
+
+static void
+_on_job_done(uv_work_t *u, int status)
+{
+	Job *const job = (Job *)u;
+	Conn *const conn = job->conn;
+	uv_handle_t *const handle = (uv_handle_t *)conn;
+
+	if (status < 0)
+		fprintf(stderr, "server: _on_job_done: %s\n", uv_strerror(status));
+
+	if ((status < 0) || (job->ret < 0)) {
+		if (job->ret == 0)
+			free(job->buffer.base);
+
+		if (!uv_is_closing(handle))
+			uv_close(handle, _on_close);
+	} else if (uv_is_closing(handle)) {
+		free(job->buffer.base);
+	} else if (_send(conn, &job->buffer, conn->framing, job->req.code, job->req.id) < 0) {
+		uv_close(handle, _on_close);
+	}
+
+	_conn_unref(conn);
+	free(job);
+}
+
+
+static int
+_send(Conn *conn, uv_buf_t *buffer, int framing, int request_code, unsigned id)
+{
+	Context *const context = malloc(sizeof(Context));
+	if (context == NULL) {
+		perror("server: _send: malloc: Context");
+		free(buffer->base);
+		return -1;
+	}
+
+	context->buffer = *buffer;
+	context->shared = NULL;
+	return _write(conn, context, buffer, 1, framing, request_code, id);
+}
+
+
+/* "shared" is an open response, see ipc_response_build_open() */
+static int
+_send_shared(Conn *conn, Shared *shared, unsigned id, int framing, int request_code)
+{
+	Context *const context = malloc(sizeof(Context));
+	if (context == NULL) {
+		perror("server: _send_shared: malloc: Context");
+		return -1;
+	}
+
+	shared->refs++;
+	context->buffer = uv_buf_init(NULL, 0);
+	context->shared = shared;
+
+	const uv_buf_t body[] = {
+		shared->buffer,
+		uv_buf_init(context->tail, (unsigned)ipc_response_tail(context->tail, id)),
+	};
+
+	return _write(conn, context, body, 2, framing, request_code, id);
+}
+
+
+/* "context" is released once written, or here on failure. A response the
+ * peer cannot take is answered with an error for "request_code" and "id" */
+static int
+_write(Conn *conn, Context *context, const uv_buf_t body[], unsigned nbody, int framing, int request_code,
+       unsigned id)
+{
+	static char nul = '\0';
+
+
+	size_t len = 0;
+	for (unsigned i = 0; i < nbody; i++)
+		len += body[i].len;
+
+	if ((framing != IPC_FRAMING_LEGACY) && (len > conn->max_frame)) {
+		_context_free(context);
+
+		char *const err = ipc_response_build_error(request_code, id, IPC_RES_ERR_INTERNAL,
+							   "response too large");
+		if (err == NULL) {
+			perror("server: _write: ipc_response_build_error");
+			return -1;
+		}
+
+		/* else it would come back here */
+		uv_buf_t buffer = uv_buf_init(err, (unsigned)strlen(err));
+		if (buffer.len > conn->max_frame) {
+			free(err);
+			return -1;
+		}
+
+		return _send(conn, &buffer, framing, request_code, id);
+	}
+
+	uv_write_t *const writer = malloc(sizeof(uv_write_t));
+	if (writer == NULL) {
+		perror("server: _write: malloc: uv_write_t");
+		goto err0;
+	}
+
+	context->handle = (uv_handle_t *)conn;
+	context->is_last = (framing == IPC_FRAMING_LEGACY);
+	writer->data = context;
+
+	unsigned nbufs = 0;
+	uv_buf_t bufs[4];
+
+	const size_t head_len = ipc_frame_head(context->head, framing, len);
+	if (head_len > 0)
+		bufs[nbufs++] = uv_buf_init(context->head, (unsigned)head_len);
+
+	for (unsigned i = 0; i < nbody; i++)
+		bufs[nbufs++] = body[i];
+
+	if (framing == IPC_FRAMING_NUL)
+		bufs[nbufs++] = uv_buf_init(&nul, 1);
+
+	const int ret = uv_write(writer, (uv_stream_t *)conn, bufs, nbufs, _on_send);
+	if (ret < 0) {
+		fprintf(stderr, "server: _write: uv_write: %s\n", uv_strerror(ret));
+		goto err1;
+	}
+
+	return 0;
+
+err1:
+	free(writer);
+err0:
+	_context_free(context);
+	return -1;
+}
+
+
+static void
+_context_free(Context *context)
+{
+	free(context->buffer.base);
+	if (context->shared != NULL)
+		_shared_unref(context->shared);
+
+	free(context);
+}
+
+
+static void
+_shared_unref(Shared *shared)
+{
+	if (--shared->refs > 0)
+		return;
+
+	free(shared->buffer.base);
+	free(shared);
+}
+
+
+static int
+_resp_hello(uv_buf_t *buffer, Conn *conn, const IpcRequest *req)
+{
+	IpcResponse resp = {
+		.code = IPC_RES_OK,
+		.request_code = IPC_REQ_HELLO,
+		.id = req->id,
+		.fields = IPC_FIELD(message),
+		.hello.message = IPC_STR("well, hello friend!"),
+	};
+
+	IpcBodyHello caps = _caps;
+	caps.shm = _caps.shm && _sampler.has_page;
+
+	/* old clients advertise nothing and stay in the legacy mode */
+	if ((conn->framing == IPC_FRAMING_LEGACY) && (req->fields & IPC_FIELD(framing)) &&
+	    (ipc_hello_negotiate(&resp.hello, &req->hello, &caps) == 0)) {
+		resp.fields = 0;
+		conn->framing = (int)resp.hello.framing;
+		conn->max_frame = resp.hello.max_frame;
+	}
+
+	char *const str = ipc_response_build(&resp);
+	if (str == NULL) {
+		perror("server: _resp_hello: ipc_response_build");
+		return -1;
+	}
+
+	buffer->base = str;
+	buffer->len = strlen(str);
+	return 0;
+}
+
+
+/* only the requested fields are sent, "sample" NULL: collect them now, on the
+ * threadpool */
+static int
+_resp_status(uv_buf_t *buffer, const IpcRequest *req, const IpcBodyStatus *sample)
+{
+	IpcResponse resp = {
+		.code = IPC_RES_OK,
+		.request_code = IPC_REQ_STATUS,
+		.id = req->id,
+		.fields = req->query.fields & STATUS_FIELDS_FULL,
+	};
+
+	/* a status collected now has no version */
+	if (resp.fields == 0)
+		resp.fields = STATUS_FIELDS_FULL;
+
+	if (sample == NULL)
+		resp.fields &= ~IPC_FIELD(version);
+
+	/* a collector of its own: the cpu usage is since boot */
+	Status collector;
+	if (sample != NULL) {
+		resp.status = *sample;
+	} else if ((status_init(&collector) < 0) || (status_collect(&collector, &resp.status, resp.fields) < 0)) {
+		status_deinit(&collector);
+		return _resp_error(buffer, req, IPC_RES_ERR_INTERNAL, "failed to collect status");
+	}
+
+	char *const str = ipc_response_build(&resp);
+	if (sample == NULL)
+		status_deinit(&collector);
+
+	if (str == NULL) {
+		perror("server: _resp_status: ipc_response_build");
+		return -1;
+	}
+
+	buffer->base = str;
+	buffer->len = strlen(str);
+	return 0;
+}
+
+
+/* encoded straight from the history rings */
+static int
+_resp_history(uv_buf_t *buffer, const IpcRequest *req)
+{
+	IpcResponse resp = {
+		.code = IPC_RES_OK,
+		.request_code = IPC_REQ_HISTORY,
+		.id = req->id,
+	};
+
+	const IpcBodyRange *const range = &req->range;
+	if ((range->to != 0) && (range->to < range->from))
+		return _resp_error(buffer, req, IPC_RES_ERR_BAD_REQUEST, "to before from");
+
+	const uint64_t to = (range->to != 0) ? range->to : UINT64_MAX;
+	history_query(&_sampler.history, range->from, to, range->step, &resp.history);
+
+	char *const str = ipc_response_build(&resp);
+	if (str == NULL) {
+		perror("server: _resp_history: ipc_response_build");
+		return -1;
+	}
+
+	buffer->base = str;
+	buffer->len = strlen(str);
+	return 0;
+}
+
+
+/* replaces the connection's subscription, acked before the first push: the
+ * latest status right away, or the delta from the version it resumes from */
+static int
+_subscribe(Conn *conn, const IpcRequest *req)
+{
+	const IpcBodySubscribe *const sub = &req->subscribe;
+	uv_buf_t buffer;
+
+
+	/* pushes are framed like every other response */
+	if (conn->framing == IPC_FRAMING_LEGACY) {
+		if (_resp_error(&buffer, req, IPC_RES_ERR_BAD_REQUEST, "subscribe needs framing") < 0)
+			return -1;
+
+		return _send(conn, &buffer, conn->framing, req->code, req->id);
+	}
+
+	_unsubscribe(conn);
+
+	IpcResponse resp = {
+		.code = IPC_RES_OK,
+		.request_code = IPC_REQ_SUBSCRIBE,
+		.id = req->id,
+		.msg.message = IPC_STR("unsubscribed"),
+	};
+
+	if (sub->interval > 0) {
+		conn->is_sub = 1;
+		conn->sub_id = req->id;
+		/* rounded up in 64 bits, an interval near UINT_MAX would wrap to 0 */
+		conn->sub_every = (unsigned)(((uint64_t)sub->interval + _sampler.interval - 1) / _sampler.interval);
+		conn->sub_ticks = 0;
+		conn->sub_left = sub->count;
+		conn->sub_delta = (sub->delta != 0);
+		conn->sub_version = (conn->sub_delta) ? sub->version : 0;
+		conn->sub_key = conn->sub_version;
+		conn->sub_prev = NULL;
+		conn->sub_next = _sampler.subs;
+		if (_sampler.subs != NULL)
+			_sampler.subs->sub_prev = conn;
+
+		_sampler.subs = conn;
+		resp.msg.message = IPC_STR("subscribed");
+	}
+
+	char *const str = ipc_response_build(&resp);
+	if (str == NULL) {
+		perror("server: _subscribe: ipc_response_build");
+		return -1;
+	}
+
+	buffer = uv_buf_init(str, (unsigned)strlen(str));
+	if (_send(conn, &buffer, conn->framing, IPC_REQ_SUBSCRIBE, req->id) < 0)
+		return -1;
+
+	if ((conn->is_sub == 0) || (_sampler.response == NULL))
+		return 0;
+
+	const int ret = _push_to(conn);
+	_push_done();
+	return ret;
+}
+
+
+static void
+_unsubscribe(Conn *conn)
+{
+	if (conn->is_sub == 0)
+		return;
+
+	Conn *const prev = conn->sub_prev;
+	Conn *const next = conn->sub_next;
+	if (prev != NULL)
+		prev->sub_next = next;
+	else
+		_sampler.subs = next;
+
+	if (next != NULL)
+		next->sub_prev = prev;
+
+	conn->is_sub = 0;
+	conn->sub_every = 0;
+	conn->sub_prev = NULL;
+	conn->sub_next = NULL;
+}
+
+
+/* the new sample to every subscriber due: encoded once, and once per base for
+ * the delta streams, only the frame head and the id are their own */
+static void
+_push(void)
+{
+	Conn *next;
+	for (Conn *conn = _sampler.subs; conn != NULL; conn = next) {
+		next = conn->sub_next;
+		if (++conn->sub_ticks < conn->sub_every)
+			continue;
+
+		conn->sub_ticks = 0;
+		uv_stream_t *const stream = (uv_stream_t *)conn;
+		if (uv_is_closing((uv_handle_t *)stream) || (uv_stream_get_write_queue_size(stream) > PUSH_QUEUE_MAX))
+			continue;
+
+		if (_push_to(conn) < 0)
+			uv_close((uv_handle_t *)stream, _on_close);
+	}
+
+	_push_done();
+}
+
+
+/* a delta from what it has, the whole status when it has nothing the server
+ * still knows or PUSH_KEYFRAME samples went by since the last whole one */
+static int
+_push_to(Conn *conn)
+{
+	const uint64_t version = _sampler.version;
+	const uint64_t base = conn->sub_version;
+	if (conn->sub_delta && (base == version))
+		return 0;
+
+	Shared *shared = NULL;
+	if (conn->sub_delta && (base != 0) && ((version - conn->sub_key) < PUSH_KEYFRAME))
+		shared = _push_delta(base);
+
+	if (shared == NULL) {
+		shared = _sampler.response;
+		conn->sub_key = version;
+	}
+
+	const unsigned id = conn->sub_id;
+	conn->sub_version = version;
+	if (conn->sub_left == 1)
+		_unsubscribe(conn);
+	else if (conn->sub_left > 1)
+		conn->sub_left--;
+
+	return _send_shared(conn, shared, id, conn->framing, IPC_REQ_STATUS);
+}
+
+
+/* encoded on first use in a round, NULL: "base" is gone, or the cpus changed */
+static Shared *
+_push_delta(uint64_t base)
+{
+	Delta *const delta = &_sampler.deltas[base % PUSH_KEEP];
+	if ((delta->shared != NULL) && (delta->base == base))
+		return delta->shared;
+
+	const Snapshot *const from = _snapshot_get(base);
+	if (from == NULL)
+		return NULL;
+
+	const IpcBodyStatus *const to = &_sampler.status;
+	if (_sampler.delta_size < to->cpus.len) {
+		IpcCpu *const cpus = realloc(_sampler.delta_cpus, sizeof(IpcCpu) * to->cpus.len);
+		if (cpus == NULL) {
+			perror("server: _push_delta: realloc");
+			return NULL;
+		}
+
+		_sampler.delta_cpus = cpus;
+		_sampler.delta_size = to->cpus.len;
+	}
+
+	IpcResponse resp = {
+		.code = IPC_RES_OK,
+		.request_code = IPC_REQ_STATUS,
+	};
+
+	if (status_diff(&from->status, to, &resp.status, _sampler.delta_cpus, &resp.fields) < 0)
+		return NULL;
+
+	resp.fields |= IPC_FIELD(version) | IPC_FIELD(base);
+	resp.status.version = _sampler.version;
+	resp.status.base = base;
+
+	Shared *const shared = malloc(sizeof(Shared));
+	char *const str = ipc_response_build_open(&resp);
+	if ((shared == NULL) || (str == NULL)) {
+		perror("server: _push_delta: ipc_response_build_open");
+		free(shared);
+		free(str);
+		return NULL;
+	}
+
+	shared->refs = 1;
+	shared->buffer = uv_buf_init(str, (unsigned)strlen(str));
+	if (delta->shared != NULL)
+		_shared_unref(delta->shared);
+
+	delta->base = base;
+	delta->shared = shared;
+	return shared;
+}
+
+
+/* the writes hold their own references */
+static void
+_push_done(void)
+{
+	for (int i = 0; i < PUSH_KEEP; i++) {
+		if (_sampler.deltas[i].shared != NULL)
+			_shared_unref(_sampler.deltas[i].shared);
+
+		_sampler.deltas[i].shared = NULL;
+	}
+}
+
+
+static int
+_snapshot_save(const IpcBodyStatus *status)
+{
+	Snapshot *const snap = &_sampler.snapshots[status->version % PUSH_KEEP];
+	snap->status.version = 0;
+	if (snap->size < status->cpus.len) {
+		IpcCpu *const cpus = realloc(snap->cpus, sizeof(IpcCpu) * status->cpus.len);
+		if (cpus == NULL) {
+			perror("server: _snapshot_save: realloc");
+			return -1;
+		}
+
+		snap->cpus = cpus;
+		snap->size = status->cpus.len;
+	}
+
+	snap->status = *status;
+	snap->status.cpus.list = snap->cpus;
+	if (status->cpus.len > 0)
+		memcpy(snap->cpus, status->cpus.list, sizeof(IpcCpu) * status->cpus.len);
+
+	return 0;
+}
+
+
+static Snapshot *
+_snapshot_get(uint64_t version)
+{
+	Snapshot *const snap = &_sampler.snapshots[version % PUSH_KEEP];
+	if ((version == 0) || (snap->status.version != version))
+		return NULL;
+
+	return snap;
+}
+
+
+/* adds, replaces or stops the connection's watch with the request's id */
+static int
+_watch(Conn *conn, const IpcRequest *req)
+{
+	uv_buf_t buffer;
+
+
+	/* alerts are framed like every other response */
+	if (conn->framing == IPC_FRAMING_LEGACY) {
+		if (_resp_error(&buffer, req, IPC_RES_ERR_BAD_REQUEST, "watch needs framing") < 0)
+			return -1;
+
+		return _send(conn, &buffer, conn->framing, req->code, req->id);
+	}
+
+	IpcResponse resp = {
+		.code = IPC_RES_OK,
+		.request_code = IPC_REQ_WATCH,
+		.id = req->id,
+		.fields = IPC_FIELD(message),
+		.alert.message = IPC_STR("unwatched"),
+	};
+
+	/* "fields" sent but naming no known key is a typo, not a stop */
+	const uint64_t condition = IPC_FIELD(fields) | IPC_FIELD(above) | IPC_FIELD(below);
+	Watch w;
+	if ((req->fields & condition) == 0) {
+		watch_remove(&_sampler.watches, conn, req->id);
+	} else if (watch_compile(&w, &req->watch, req->fields) < 0) {
+		if (_resp_error(&buffer, req, IPC_RES_ERR_BAD_REQUEST, "bad watch") < 0)
+			return -1;
+
+		return _send(conn, &buffer, conn->framing, req->code, req->id);
+	} else {
+		w.owner = conn;
+		w.id = req->id;
+		if (watch_add(&_sampler.watches, &w) < 0) {
+			if (_resp_error(&buffer, req, IPC_RES_ERR_INTERNAL, "too many watches") < 0)
+				return -1;
+
+			return _send(conn, &buffer, conn->framing, req->code, req->id);
+		}
+
+		conn->has_watches = 1;
+		resp.alert.message = IPC_STR("watching");
+	}
+
+	char *const str = ipc_response_build(&resp);
+	if (str == NULL) {
+		perror("server: _watch: ipc_response_build");
+		return -1;
+	}
+
+	buffer = uv_buf_init(str, (unsigned)strlen(str));
+	return _send(conn, &buffer, conn->framing, IPC_REQ_WATCH, req->id);
+}
+
+
+/* one small response per firing, they are rare next to the samples */
+static void
+_on_watch_fired(void *udata, const Watch *w, uint64_t value)
 {
-	char *const resp = ipc_response_build_shutdown();
+	Conn *const conn = w->owner;
+	(void)udata;
+
+	if (uv_is_closing((uv_handle_t *)conn))
+		return;
+
+	const IpcResponse resp = {
+		.code = IPC_RES_OK,
+		.request_code = IPC_REQ_WATCH,
+		.id = w->id,
+		.alert = {
+			.message = (w->flip == 0) ? IPC_STR("above") : IPC_STR("below"),
+			.value = value,
+			.time = _sampler.next_time,
+		},
+	};
+
+	char *const str = ipc_response_build(&resp);
+	if (str == NULL) {
+		perror("server: _on_watch_fired: ipc_response_build");
+		return;
+	}
+
+	uv_buf_t buffer = uv_buf_init(str, (unsigned)strlen(str));
+	if (_send(conn, &buffer, conn->framing, IPC_REQ_WATCH, w->id) < 0)
+		uv_close((uv_handle_t *)conn, _on_close);
+}
+
+
+/* answered from the latest table, the first request starts the scans and
+ * waits for one */
+static int
+_top(Conn *conn, const IpcRequest *req)
+{
+	uv_buf_t buffer;
+
+
+	if (_scanner.has_procs == 0) {
+		if (_resp_error(&buffer, req, IPC_RES_ERR_INTERNAL, "no process table") < 0)
+			return -1;
+
+		return _send(conn, &buffer, conn->framing, req->code, req->id);
+	}
+
+	_scanner.asked = uv_now(conn->pipe.loop);
+	if (!uv_is_active((uv_handle_t *)&_scanner.timer)) {
+		const int ret = uv_timer_start(&_scanner.timer, _on_scan_tick, 0, SCAN_INTERVAL);
+		if (ret < 0) {
+			fprintf(stderr, "server: _top: uv_timer_start: %s\n", uv_strerror(ret));
+			return -1;
+		}
+	}
+
+	if (_scanner.response != NULL)
+		return _top_send(conn, req->id, req->limit.count);
+
+	if (_scanner.waits_len == _scanner.waits_size) {
+		const unsigned size = (_scanner.waits_size == 0) ? 16 : _scanner.waits_size * 2;
+		TopWait *const waits = realloc(_scanner.waits, sizeof(TopWait) * size);
+		if (waits == NULL) {
+			perror("server: _top: realloc");
+			return -1;
+		}
+
+		_scanner.waits = waits;
+		_scanner.waits_size = size;
+	}
+
+	/* the connection may be closed before the table is done */
+	_scanner.waits[_scanner.waits_len++] = (TopWait) {
+		.conn = conn,
+		.id = req->id,
+		.count = req->limit.count,
+	};
+
+	conn->refs++;
+	return 0;
+}
+
+
+/* the encoded table, or a shorter copy of it */
+static int
+_top_send(Conn *conn, unsigned id, unsigned count)
+{
+	const IpcBodyTop *const table = &_scanner.table;
+	if ((count == 0) || ((count >= table->by_rss.len) && (count >= table->by_cpu.len)))
+		return _send_shared(conn, _scanner.response, id, conn->framing, IPC_REQ_TOP);
+
+	IpcResponse resp = {
+		.code = IPC_RES_OK,
+		.request_code = IPC_REQ_TOP,
+		.id = id,
+		.top = *table,
+	};
+
+	if (resp.top.by_rss.len > count)
+		resp.top.by_rss.len = count;
+	if (resp.top.by_cpu.len > count)
+		resp.top.by_cpu.len = count;
+
+	char *const str = ipc_response_build(&resp);
+	if (str == NULL) {
+		perror("server: _top_send: ipc_response_build");
+		return -1;
+	}
+
+	uv_buf_t buffer = uv_buf_init(str, (unsigned)strlen(str));
+	return _send(conn, &buffer, conn->framing, IPC_REQ_TOP, id);
+}
+
+
+/* the waiting requests get the new table, or an error when the scan failed */
+static void
+_top_wake(void)
+{
+	for (unsigned i = 0; i < _scanner.waits_len; i++) {
+		const TopWait *const wait = &_scanner.waits[i];
+		Conn *const conn = wait->conn;
+		const IpcRequest req = { .code = IPC_REQ_TOP, .id = wait->id };
+		uv_buf_t buffer;
+
+		int ret = 0;
+		if (uv_is_closing((uv_handle_t *)conn)) {
+			/* nobody to answer */
+		} else if (_scanner.response != NULL) {
+			ret = _top_send(conn, wait->id, wait->count);
+		} else {
+			ret = _resp_error(&buffer, &req, IPC_RES_ERR_INTERNAL, "process scan failed");
+			if (ret == 0)
+				ret = _send(conn, &buffer, conn->framing, IPC_REQ_TOP, wait->id);
+		}
+
+		if (ret < 0)
+			uv_close((uv_handle_t *)conn, _on_close);
+
+		_conn_unref(conn);
+	}
+
+	_scanner.waits_len = 0;
+}
+
+
+static int
+_resp_error(uv_buf_t *buffer, const IpcRequest *req, int err, const char message[])
+{
+	char *const resp = ipc_response_build_error(req->code, req->id, err, message);
 	if (resp == NULL) {
-		perror("server: _resp_hello: ipc_response_build_shutdown");
+		perror("server: _resp_error: ipc_response_build_error");
 		return -1;
 	}
 
@@ -385,3 +1952,24 @@ _resp_shutdown(uv_buf_t *buffer)
 	return 0;
 }
 
+
+static int
+_resp_shutdown(uv_buf_t *buffer, const IpcRequest *req)
+{
+	const IpcResponse resp = {
+		.code = IPC_RES_OK,
+		.request_code = IPC_REQ_SHUTDOWN,
+		.id = req->id,
+		.msg.message = IPC_STR("shutting down..."),
+	};
+
+	char *const str = ipc_response_build(&resp);
+	if (str == NULL) {
+		perror("server: _resp_shutdown: ipc_response_build");
+		return -1;
+	}
+
+	buffer->base = str;
+	buffer->len = strlen(str);
+	return 0;
+}
@@ -6,12 +6,19 @@
 #include <uv.h>
 
 
+#define SERVER_STATUS_INTERVAL (1000)   /* ms */
+
+
 typedef struct {
 	const char *sock_file;
 	uv_loop_t  *loop;
+	unsigned    status_interval;   /* ms between status samples */
+	const char *history_file;      /* NULL: the history ends with the server */
+	const char *status_page;       /* a shm_open() name, NULL: none */
 } Server;
 
-int server_init(Server *s, const char sock_file[]);
+int server_init(Server *s, const char sock_file[], unsigned status_interval, const char history_file[],
+		const char status_page[]);
 int server_run(Server *s);
 
 
@@ -0,0 +1,450 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "status.h"
+
+
+#define MEMINFO_FILE "/proc/meminfo"
+#define STAT_FILE    "/proc/stat"
+#define ONLINE_FILE  "/sys/devices/system/cpu/online"
+#define FREQ_FILE    "/sys/devices/system/cpu/cpu%u/cpufreq/scaling_cur_freq"
+
+#define BUFFER_SIZE_MIN (4096)
+
+#define MEMORY_FIELDS (IPC_FIELD(memory_usage) | IPC_FIELD(memory_capacity))
+#define CPU_FIELDS    (IPC_FIELD(cpu) | IPC_FIELD(cpus))
+
+
+static int         _open_file(const char path[], int is_optional);
+static int         _read_file(Status *st, int fd, const char path[], size_t *len);
+static uint64_t    _parse_u64(const char **p, const char *end);
+static const char *_find_line(const char buf[], size_t len, const char key[], size_t key_len);
+static int         _collect_cores(Status *st, IpcBodyStatus *s);
+static int         _collect_memory(Status *st, IpcBodyStatus *s);
+static int         _collect_cpu(Status *st, IpcBodyStatus *s);
+static int         _read_stat(Status *st, StatusCpuTimes times[]);
+static void        _cpu_usage(IpcCpu *c, const StatusCpuTimes *cur, const StatusCpuTimes *prev);
+static unsigned    _cpu_freq(Status *st, unsigned id);
+
+
+/*
+ * public
+ */
+int
+status_init(Status *st)
+{
+	memset(st, 0, sizeof(*st));
+	st->meminfo_fd = -1;
+	st->stat_fd = -1;
+	st->online_fd = -1;
+
+	const long cpus = sysconf(_SC_NPROCESSORS_CONF);
+	if (cpus < 0) {
+		perror("status: status_init: sysconf");
+		return -1;
+	}
+
+	st->slots = (unsigned)cpus + 1;
+	st->times = calloc(STATUS_CPU_SAMPLES * st->slots, sizeof(StatusCpuTimes));
+	st->lists[0] = calloc(st->slots, sizeof(IpcCpu));
+	st->lists[1] = calloc(st->slots, sizeof(IpcCpu));
+	st->freq_fds = calloc(st->slots, sizeof(int));
+	st->buffer = malloc(BUFFER_SIZE_MIN);
+	if ((st->times == NULL) || (st->lists[0] == NULL) || (st->lists[1] == NULL) || (st->freq_fds == NULL) ||
+	    (st->buffer == NULL)) {
+		perror("status: status_init: malloc");
+		goto err0;
+	}
+
+	st->buffer_size = BUFFER_SIZE_MIN;
+
+	/* a cpu without cpufreq now has none later either */
+	for (unsigned i = 0; i < st->slots; i++) {
+		char path[96];
+		snprintf(path, sizeof(path), FREQ_FILE, i);
+		st->freq_fds[i] = _open_file(path, 1);
+	}
+
+	st->meminfo_fd = _open_file(MEMINFO_FILE, 0);
+	st->stat_fd = _open_file(STAT_FILE, 0);
+	st->online_fd = _open_file(ONLINE_FILE, 0);
+	if ((st->meminfo_fd < 0) || (st->stat_fd < 0) || (st->online_fd < 0))
+		goto err0;
+
+	return 0;
+
+err0:
+	status_deinit(st);
+	return -1;
+}
+
+
+void
+status_deinit(Status *st)
+{
+	/* zeroed: not opened yet */
+	if (st->buffer_size > 0) {
+		for (unsigned i = 0; i < st->slots; i++) {
+			if (st->freq_fds[i] >= 0)
+				close(st->freq_fds[i]);
+		}
+	}
+
+	if (st->meminfo_fd >= 0)
+		close(st->meminfo_fd);
+	if (st->stat_fd >= 0)
+		close(st->stat_fd);
+	if (st->online_fd >= 0)
+		close(st->online_fd);
+
+	free(st->times);
+	free(st->lists[0]);
+	free(st->lists[1]);
+	free(st->freq_fds);
+	free(st->buffer);
+	memset(st, 0, sizeof(*st));
+	st->meminfo_fd = -1;
+	st->stat_fd = -1;
+	st->online_fd = -1;
+}
+
+
+int
+status_collect(Status *st, IpcBodyStatus *s, uint64_t fields)
+{
+	memset(s, 0, sizeof(*s));
+	if (fields == 0)
+		fields = IPC_FIELDS_ALL(IPC_BODY_STATUS);
+
+	if ((fields & IPC_FIELD(cpu_cores)) && (_collect_cores(st, s) < 0))
+		return -1;
+
+	if ((fields & MEMORY_FIELDS) && (_collect_memory(st, s) < 0))
+		return -1;
+
+	if ((fields & CPU_FIELDS) && (_collect_cpu(st, s) < 0))
+		return -1;
+
+	return 0;
+}
+
+
+int
+status_diff(const IpcBodyStatus *from, const IpcBodyStatus *to, IpcBodyStatus *delta, IpcCpu cpus[],
+	    uint64_t *fields)
+{
+	memset(delta, 0, sizeof(*delta));
+	if (from->cpus.len != to->cpus.len)
+		return -1;
+
+	uint64_t ret = 0;
+	if (from->cpu_cores != to->cpu_cores) {
+		delta->cpu_cores = to->cpu_cores;
+		ret |= IPC_FIELD(cpu_cores);
+	}
+
+	if (from->memory_usage != to->memory_usage) {
+		delta->memory_usage = to->memory_usage;
+		ret |= IPC_FIELD(memory_usage);
+	}
+
+	if (from->memory_capacity != to->memory_capacity) {
+		delta->memory_capacity = to->memory_capacity;
+		ret |= IPC_FIELD(memory_capacity);
+	}
+
+	if (memcmp(&from->cpu, &to->cpu, sizeof(IpcCpu)) != 0) {
+		delta->cpu = to->cpu;
+		ret |= IPC_FIELD(cpu);
+	}
+
+	unsigned len = 0;
+	for (unsigned i = 0; i < to->cpus.len; i++) {
+		const IpcCpu *const a = &from->cpus.list[i];
+		const IpcCpu *const b = &to->cpus.list[i];
+		if (a->id != b->id)
+			return -1;
+
+		if (memcmp(a, b, sizeof(IpcCpu)) != 0)
+			cpus[len++] = *b;
+	}
+
+	if (len > 0) {
+		delta->cpus = (IpcCpus) { .len = len, .list = cpus };
+		ret |= IPC_FIELD(cpus);
+	}
+
+	*fields = ret;
+	return 0;
+}
+
+
+/*
+ * private
+ */
+static int
+_open_file(const char path[], int is_optional)
+{
+	const int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if ((fd < 0) && !is_optional)
+		fprintf(stderr, "status: _open_file: %s: %s\n", path, strerror(errno));
+
+	return fd;
+}
+
+
+/* the whole file into st->buffer, '\0' terminated: the buffer grows until a
+ * read falls short of it */
+static int
+_read_file(Status *st, int fd, const char path[], size_t *len)
+{
+	for (;;) {
+		const ssize_t rd = pread(fd, st->buffer, st->buffer_size, 0);
+		if (rd < 0) {
+			fprintf(stderr, "status: _read_file: pread: %s: %s\n", path, strerror(errno));
+			return -1;
+		}
+
+		if ((size_t)rd < st->buffer_size) {
+			st->buffer[rd] = '\0';
+			*len = (size_t)rd;
+			return 0;
+		}
+
+		char *const buffer = realloc(st->buffer, st->buffer_size * 2);
+		if (buffer == NULL) {
+			perror("status: _read_file: realloc");
+			return -1;
+		}
+
+		st->buffer = buffer;
+		st->buffer_size *= 2;
+	}
+}
+
+
+/* skips the blanks in front, stops at the first non-digit */
+static uint64_t
+_parse_u64(const char **p, const char *end)
+{
+	const char *s = *p;
+	while ((s < end) && (*s == ' '))
+		s++;
+
+	uint64_t ret = 0;
+	for (; (s < end) && ((unsigned)(*s - '0') <= 9); s++)
+		ret = (ret * 10) + (uint64_t)(*s - '0');
+
+	*p = s;
+	return ret;
+}
+
+
+/* the line starting with "key", NULL if none */
+static const char *
+_find_line(const char buf[], size_t len, const char key[], size_t key_len)
+{
+	const char *const end = buf + len;
+	for (const char *p = buf; p < end;) {
+		const char *const found = memmem(p, (size_t)(end - p), key, key_len);
+		if ((found == NULL) || (found == buf) || (found[-1] == '\n'))
+			return found;
+
+		p = found + 1;
+	}
+
+	return NULL;
+}
+
+
+/* the online mask: "0-3,5-7" */
+static int
+_collect_cores(Status *st, IpcBodyStatus *s)
+{
+	size_t len;
+	if (_read_file(st, st->online_fd, ONLINE_FILE, &len) < 0)
+		return -1;
+
+	unsigned cores = 0;
+	const char *p = st->buffer;
+	const char *const end = p + len;
+	while ((p < end) && ((unsigned)(*p - '0') <= 9)) {
+		const uint64_t first = _parse_u64(&p, end);
+		uint64_t last = first;
+		if ((p < end) && (*p == '-')) {
+			p++;
+			last = _parse_u64(&p, end);
+		}
+
+		cores += (unsigned)(last - first + 1);
+		if ((p < end) && (*p == ','))
+			p++;
+	}
+
+	s->cpu_cores = cores;
+	return 0;
+}
+
+
+/* in bytes, "usage" is what is not available to new allocations */
+static int
+_collect_memory(Status *st, IpcBodyStatus *s)
+{
+	size_t len;
+	if (_read_file(st, st->meminfo_fd, MEMINFO_FILE, &len) < 0)
+		return -1;
+
+	const char *const end = st->buffer + len;
+	const char *total = _find_line(st->buffer, len, "MemTotal:", 9);
+	const char *available = _find_line(st->buffer, len, "MemAvailable:", 13);
+	if ((total == NULL) || (available == NULL)) {
+		fprintf(stderr, "status: _collect_memory: " MEMINFO_FILE ": missing fields\n");
+		return -1;
+	}
+
+	total += 9;
+	available += 13;
+
+	const uint64_t total_kb = _parse_u64(&total, end);
+	const uint64_t available_kb = _parse_u64(&available, end);
+	s->memory_capacity = total_kb * 1024;
+	s->memory_usage = (total_kb - available_kb) * 1024;
+	return 0;
+}
+
+
+/* the next ring slot is read and compared with the latest one */
+static int
+_collect_cpu(Status *st, IpcBodyStatus *s)
+{
+	const unsigned next = (st->head + 1) % STATUS_CPU_SAMPLES;
+	StatusCpuTimes *const cur = &st->times[next * st->slots];
+	if (_read_stat(st, cur) < 0)
+		return -1;
+
+	const StatusCpuTimes *const prev = (st->samples > 0) ? &st->times[st->head * st->slots] : NULL;
+	st->head = next;
+	if (st->samples < STATUS_CPU_SAMPLES)
+		st->samples++;
+
+	IpcCpu *const list = st->lists[st->list];
+	st->list ^= 1;
+
+	unsigned len = 0;
+	unsigned freqs = 0;
+	unsigned long freq_sum = 0;
+	for (unsigned i = 1; i < st->slots; i++) {
+		if (cur[i].is_online == 0)
+			continue;
+
+		IpcCpu *const c = &list[len++];
+		_cpu_usage(c, &cur[i], ((prev != NULL) && prev[i].is_online) ? &prev[i] : NULL);
+		c->id = i - 1;
+		c->freq = _cpu_freq(st, i - 1);
+		if (c->freq != 0) {
+			freq_sum += c->freq;
+			freqs++;
+		}
+	}
+
+	_cpu_usage(&s->cpu, &cur[0], (prev != NULL) ? &prev[0] : NULL);
+	s->cpu.freq = (freqs > 0) ? (unsigned)(freq_sum / freqs) : 0;
+	s->cpus = (IpcCpus) { .len = len, .list = list };
+	return 0;
+}
+
+
+/* the cpu lines come first, a cpu missing from them is offline */
+static int
+_read_stat(Status *st, StatusCpuTimes times[])
+{
+	size_t len;
+	if (_read_file(st, st->stat_fd, STAT_FILE, &len) < 0)
+		return -1;
+
+	memset(times, 0, sizeof(StatusCpuTimes) * st->slots);
+
+	const char *p = st->buffer;
+	const char *const end = p + len;
+	while (((end - p) > 3) && (memcmp(p, "cpu", 3) == 0)) {
+		const char *const eol = memchr(p, '\n', (size_t)(end - p));
+		const char *const line_end = (eol != NULL) ? eol : end;
+
+		p += 3;
+		unsigned slot = 0;
+		if (*p != ' ')
+			slot = (unsigned)_parse_u64(&p, line_end) + 1;
+
+		if (slot < st->slots) {
+			/* user nice system idle iowait irq softirq steal, guest is in user already */
+			uint64_t v[8];
+			for (int i = 0; i < 8; i++)
+				v[i] = _parse_u64(&p, line_end);
+
+			StatusCpuTimes *const t = &times[slot];
+			t->user = v[0] + v[1];
+			t->system = v[2] + v[5] + v[6];
+			t->iowait = v[4];
+			t->steal = v[7];
+			t->total = v[0] + v[1] + v[2] + v[3] + v[4] + v[5] + v[6] + v[7];
+			t->is_online = 1;
+		}
+
+		p = line_end + 1;
+	}
+
+	if (times[0].is_online == 0) {
+		fprintf(stderr, "status: _read_stat: " STAT_FILE ": missing the cpu line\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/* "prev" NULL or reset (a cpu brought back online): since boot */
+static void
+_cpu_usage(IpcCpu *c, const StatusCpuTimes *cur, const StatusCpuTimes *prev)
+{
+	StatusCpuTimes d = *cur;
+	if ((prev != NULL) && (cur->total >= prev->total) && (cur->user >= prev->user) &&
+	    (cur->system >= prev->system) && (cur->iowait >= prev->iowait) && (cur->steal >= prev->steal)) {
+		d.user -= prev->user;
+		d.system -= prev->system;
+		d.iowait -= prev->iowait;
+		d.steal -= prev->steal;
+		d.total -= prev->total;
+	}
+
+	memset(c, 0, sizeof(*c));
+	if (d.total == 0)
+		return;
+
+	c->user = (unsigned)((d.user * 10000) / d.total);
+	c->system = (unsigned)((d.system * 10000) / d.total);
+	c->iowait = (unsigned)((d.iowait * 10000) / d.total);
+	c->steal = (unsigned)((d.steal * 10000) / d.total);
+}
+
+
+/* in MHz, 0: no cpufreq */
+static unsigned
+_cpu_freq(Status *st, unsigned id)
+{
+	if ((id >= st->slots) || (st->freq_fds[id] < 0))
+		return 0;
+
+	char buffer[32];
+	const ssize_t rd = pread(st->freq_fds[id], buffer, sizeof(buffer), 0);
+	if (rd <= 0)
+		return 0;
+
+	const char *p = buffer;
+	return (unsigned)(_parse_u64(&p, buffer + rd) / 1000);
+}
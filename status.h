@@ -0,0 +1,59 @@
+#ifndef __STATUS_H__
+#define __STATUS_H__
+
+
+#include <stdint.h>
+
+#include "ipc.h"
+
+
+/* /proc/stat samples kept for the cpu deltas */
+#define STATUS_CPU_SAMPLES (2)
+
+
+/* one cpu line of /proc/stat, in clock ticks */
+typedef struct {
+	uint64_t user;       /* + nice */
+	uint64_t system;     /* + irq, softirq */
+	uint64_t iowait;
+	uint64_t steal;
+	uint64_t total;
+	int      is_online;
+} StatusCpuTimes;
+
+/* the collector: a ring of STATUS_CPU_SAMPLES samples, "slots" cpu lines each
+ * (the total first, then cpu N at N + 1), allocated once. The sources stay
+ * open and are reread from offset 0 into "buffer" */
+typedef struct {
+	unsigned        slots;
+	unsigned        head;       /* the latest sample */
+	unsigned        samples;
+	StatusCpuTimes *times;
+	IpcCpu         *lists[2];   /* the per cpu results, used in turns */
+	unsigned        list;
+	int             meminfo_fd;
+	int             stat_fd;
+	int             online_fd;
+	int            *freq_fds;   /* per cpu id, -1: no cpufreq */
+	char           *buffer;
+	size_t          buffer_size;
+} Status;
+
+
+int  status_init(Status *st);
+void status_deinit(Status *st);
+
+/* fills the IPC_BODY_STATUS fields selected by "fields" (0: all), the rest
+ * are zeroed and their sources never read. The cpu usage covers the time
+ * since the previous call, since boot for the first one. "cpus" points into
+ * "st" and stays valid until the second call after this one */
+int  status_collect(Status *st, IpcBodyStatus *s, uint64_t fields);
+
+/* the fields of "to" that differ from "from" into "delta" and "fields", the
+ * cpus among them into "cpus" (room for to->cpus.len). -1: cpus came or went,
+ * only a whole status tells */
+int  status_diff(const IpcBodyStatus *from, const IpcBodyStatus *to, IpcBodyStatus *delta, IpcCpu cpus[],
+		 uint64_t *fields);
+
+
+#endif
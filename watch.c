@@ -0,0 +1,152 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "watch.h"
+
+
+static int _value_from_field(uint64_t field);
+
+
+/*
+ * public
+ */
+int
+watch_compile(Watch *w, const IpcBodyWatch *b, uint64_t present)
+{
+	memset(w, 0, sizeof(*w));
+
+	const int value = _value_from_field(b->fields);
+	if (value < 0)
+		return -1;
+
+	const int is_above = (present & IPC_FIELD(above)) != 0;
+	const int is_below = (present & IPC_FIELD(below)) != 0;
+	if (is_above == is_below)
+		return -1;
+
+	w->flip = (is_above) ? 0 : ~0ull;
+	w->fire = ((is_above) ? b->above : b->below) ^ w->flip;
+	w->clear = (present & IPC_FIELD(clear)) ? (b->clear ^ w->flip) : w->fire;
+
+	/* rearming past the threshold would fire on every sample */
+	if (w->clear > w->fire)
+		return -1;
+
+	w->value = (uint8_t)value;
+	return 0;
+}
+
+
+void
+watch_init(Watches *ws)
+{
+	memset(ws, 0, sizeof(*ws));
+}
+
+
+void
+watch_deinit(Watches *ws)
+{
+	free(ws->list);
+	memset(ws, 0, sizeof(*ws));
+}
+
+
+int
+watch_add(Watches *ws, const Watch *w)
+{
+	for (unsigned i = 0; i < ws->len; i++) {
+		if ((ws->list[i].owner == w->owner) && (ws->list[i].id == w->id)) {
+			ws->list[i] = *w;
+			return 0;
+		}
+	}
+
+	if (ws->len == WATCH_MAX)
+		return -1;
+
+	if (ws->len == ws->size) {
+		const unsigned size = (ws->size == 0) ? 64 : ws->size * 2;
+		Watch *const list = realloc(ws->list, sizeof(Watch) * size);
+		if (list == NULL) {
+			perror("watch: watch_add: realloc");
+			return -1;
+		}
+
+		ws->list = list;
+		ws->size = size;
+	}
+
+	ws->list[ws->len++] = *w;
+	return 0;
+}
+
+
+unsigned
+watch_remove(Watches *ws, const void *owner, unsigned id)
+{
+	unsigned len = 0;
+	for (unsigned i = 0; i < ws->len; i++) {
+		const Watch *const w = &ws->list[i];
+		if ((w->owner == owner) && ((id == 0) || (w->id == id)))
+			continue;
+
+		ws->list[len++] = *w;
+	}
+
+	const unsigned ret = ws->len - len;
+	ws->len = len;
+	return ret;
+}
+
+
+void
+watch_eval(Watches *ws, const IpcBodyStatus *s, WatchFn fn, void *udata)
+{
+	uint64_t values[WATCH_VALUES];
+	values[WATCH_CPU_CORES] = s->cpu_cores;
+	values[WATCH_MEMORY_USAGE] = s->memory_usage;
+	values[WATCH_MEMORY_CAPACITY] = s->memory_capacity;
+	values[WATCH_CPU] = (uint64_t)s->cpu.user + s->cpu.system;
+	values[WATCH_USER] = s->cpu.user;
+	values[WATCH_SYSTEM] = s->cpu.system;
+	values[WATCH_IOWAIT] = s->cpu.iowait;
+	values[WATCH_STEAL] = s->cpu.steal;
+
+	/* no branch per watch but the rare firing one */
+	Watch *const list = ws->list;
+	const unsigned len = ws->len;
+	for (unsigned i = 0; i < len; i++) {
+		Watch *const w = &list[i];
+		const uint64_t v = values[w->value] ^ w->flip;
+		const int fire = (w->is_fired == 0) & (v > w->fire);
+		const int clear = (w->is_fired != 0) & (v < w->clear);
+
+		w->is_fired ^= (uint8_t)(fire | clear);
+		if (fire)
+			fn(udata, w, v ^ w->flip);
+	}
+}
+
+
+/*
+ * private
+ */
+/* "field": exactly one of the keys a watch can compare */
+static int
+_value_from_field(uint64_t field)
+{
+	switch (field) {
+	case IPC_FIELD(cpu_cores): return WATCH_CPU_CORES;
+	case IPC_FIELD(memory_usage): return WATCH_MEMORY_USAGE;
+	case IPC_FIELD(memory_capacity): return WATCH_MEMORY_CAPACITY;
+	case IPC_FIELD(cpu): return WATCH_CPU;
+	case IPC_FIELD(user): return WATCH_USER;
+	case IPC_FIELD(system): return WATCH_SYSTEM;
+	case IPC_FIELD(iowait): return WATCH_IOWAIT;
+	case IPC_FIELD(steal): return WATCH_STEAL;
+	}
+
+	return -1;
+}
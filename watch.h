@@ -0,0 +1,68 @@
+#ifndef __WATCH_H__
+#define __WATCH_H__
+
+
+#include <stdint.h>
+
+#include "ipc.h"
+
+
+/* of all the connections together */
+#define WATCH_MAX (65536)
+
+/* the status values a watch can compare, read once per sample */
+enum {
+	WATCH_CPU_CORES = 0,
+	WATCH_MEMORY_USAGE,
+	WATCH_MEMORY_CAPACITY,
+	WATCH_CPU,
+	WATCH_USER,
+	WATCH_SYSTEM,
+	WATCH_IOWAIT,
+	WATCH_STEAL,
+	WATCH_VALUES,
+};
+
+
+/* a compiled IpcBodyWatch: xor with "flip" turns a "below" into an "above",
+ * so every watch is two unsigned compares. Fires when the value goes past
+ * "fire", rearms when it comes back past "clear" */
+typedef struct {
+	uint64_t  flip;       /* 0: above, all ones: below */
+	uint64_t  fire;       /* flipped, like the values compared to them */
+	uint64_t  clear;
+	void     *owner;
+	unsigned  id;
+	uint8_t   value;      /* WATCH_* */
+	uint8_t   is_fired;
+} Watch;
+
+/* a flat array, evaluated front to back */
+typedef struct {
+	Watch    *list;
+	unsigned  len;
+	unsigned  size;
+} Watches;
+
+typedef void (*WatchFn)(void *udata, const Watch *w, uint64_t value);
+
+
+/* "present": the fields set in "b". -1: not exactly one known key, not
+ * exactly one threshold, or "clear" on the wrong side of it */
+int  watch_compile(Watch *w, const IpcBodyWatch *b, uint64_t present);
+
+void watch_init(Watches *ws);
+void watch_deinit(Watches *ws);
+
+/* replaces the one with the same owner and id. -1: WATCH_MAX reached or no
+ * memory */
+int  watch_add(Watches *ws, const Watch *w);
+
+/* "id" 0: all of the owner's. Returns how many were removed */
+unsigned watch_remove(Watches *ws, const void *owner, unsigned id);
+
+/* calls "fn" for every watch firing on "s", in the order they were added */
+void watch_eval(Watches *ws, const IpcBodyStatus *s, WatchFn fn, void *udata);
+
+
+#endif